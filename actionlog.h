@@ -0,0 +1,247 @@
+////////////////////////////////////////////////////////
+// File name: actionlog.h
+// Description: Header only reader for action lists (see actionlistformat).
+// actionLog maps the whole file into memory and actionScanner decodes
+// it in place, one line at a time, into a fixed size actionRecord.
+// Nothing is allocated or copied per record, so every tool that reads
+// an action list (printmap, logindex, civstats...) should go through
+// here instead of getline/stringstream.
+//
+#ifndef ACTIONLOG_H
+#define ACTIONLOG_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+
+//Kinds of records, the action letters are the ones used in the file
+#define turnRecord 'T'
+#define moveRecord 'M'
+#define colorRecord 'L'
+#define createRecord 'C'
+#define destroyRecord 'D'
+#define hashRecord 'H'	//State hash at the end of a turn
+
+//Objects of a create record
+#define cityObject 'c'
+#define roadObject 'r'
+#define armyObject 'a'
+
+//actionRecord - one decoded line of an action list
+struct actionRecord
+{
+char action;	//One of the record kinds above
+char layer;	//1 city/road layer, 2 unit layer
+char object;	//Object of a create record
+int x;
+int y;
+int newX;	//Destination of a move record
+int newY;
+int color;
+int turn;	//Turn number of a turn record
+unsigned long long hash;	//State hash of a hash record
+};
+
+//actionLog - read only memory mapping of an action list file
+class actionLog
+{
+public:
+actionLog()
+{
+	data = 0;
+	length = 0;
+}
+
+~actionLog()
+{
+	close();
+}
+
+//Maps the file, returns false if it cannot be opened
+bool open(const char* name)
+{
+	struct stat info;
+	int fd;
+
+	close();
+	fd = ::open(name, O_RDONLY);
+	if(fd < 0)
+	{
+		return false;
+	}
+	if(fstat(fd, &info) < 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	length = info.st_size;
+	if(length > 0)
+	{
+		void* mapping = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(mapping == MAP_FAILED)
+		{
+			::close(fd);
+			length = 0;
+			return false;
+		}
+		madvise(mapping, length, MADV_SEQUENTIAL);
+		data = (const char*)mapping;
+	}
+	::close(fd);
+	return true;
+}
+
+void close()
+{
+	if(data)
+	{
+		munmap((void*)data, length);
+	}
+	data = 0;
+	length = 0;
+}
+
+const char* begin() { return data; }
+const char* end() { return data + length; }
+long long size() { return length; }
+
+private:
+const char* data;
+long long length;
+//Mappings are not shared between two owners
+actionLog(const actionLog&);
+actionLog& operator=(const actionLog&);
+};
+
+//actionScanner - cursor decoding the records between two pointers.
+//Several scanners may walk different parts of one actionLog.
+class actionScanner
+{
+public:
+actionScanner(const char* begin, const char* end)
+{
+	first = begin;
+	last = end;
+	cursor = begin;
+}
+
+//Decodes the next record, returns false at the end of the range.
+//Lines that are not records (blank lines, comments) are skipped.
+bool next(actionRecord& rec)
+{
+	while(cursor < last)
+	{
+		char c = *cursor;
+
+		if(c >= '0' && c <= '9')
+		{
+			rec.action = turnRecord;
+			rec.turn = number();
+			skipLine();
+			return true;
+		}
+
+		if(c == moveRecord || c == colorRecord || c == createRecord || c == destroyRecord || c == hashRecord)
+		{
+			rec.action = c;
+			cursor++;
+			switch(c)
+			{
+				case moveRecord:
+				rec.x = number();
+				rec.y = number();
+				rec.newX = number();
+				rec.newY = number();
+				break;
+
+				case colorRecord:
+				rec.layer = number();
+				rec.x = number();
+				rec.y = number();
+				rec.color = number();
+				break;
+
+				case createRecord:
+				rec.layer = number();
+				rec.x = number();
+				rec.y = number();
+				rec.color = number();
+				while(cursor < last && *cursor == ' ') cursor++;
+				rec.object = cursor < last ? *cursor : 0;
+				break;
+
+				case destroyRecord:
+				rec.layer = number();
+				rec.x = number();
+				rec.y = number();
+				break;
+
+				case hashRecord:
+				rec.hash = hexNumber();
+				break;
+			}
+			skipLine();
+			return true;
+		}
+		skipLine();
+	}
+	return false;
+}
+
+//True if the next line is a turn line (or the range is over)
+bool atTurn()
+{
+	return cursor >= last || (*cursor >= '0' && *cursor <= '9');
+}
+
+//Byte offset of the cursor from the start of the range
+long long tell() { return cursor - first; }
+void seek(long long offset) { cursor = first + offset; }
+bool done() { return cursor >= last; }
+const char* position() { return cursor; }
+
+private:
+const char* first;
+const char* last;
+const char* cursor;
+
+//Reads one unsigned decimal field after any spaces
+int number()
+{
+	int value = 0;
+	while(cursor < last && *cursor == ' ') cursor++;
+	while(cursor < last && (unsigned char)(*cursor - '0') <= 9)
+	{
+		value = value*10 + (*cursor - '0');
+		cursor++;
+	}
+	return value;
+}
+
+//Reads one lower case hexadecimal field after any spaces
+unsigned long long hexNumber()
+{
+	unsigned long long value = 0;
+	while(cursor < last && *cursor == ' ') cursor++;
+	while(cursor < last)
+	{
+		char c = *cursor;
+		int digit = (unsigned char)(c - '0') <= 9 ? c - '0' : (unsigned char)(c - 'a') <= 5 ? c - 'a' + 10 : -1;
+		if(digit < 0) break;
+		value = value*16 + digit;
+		cursor++;
+	}
+	return value;
+}
+
+void skipLine()
+{
+	const char* newline = (const char*)memchr(cursor, '\n', last - cursor);
+	cursor = newline ? newline + 1 : last;
+}
+};
+
+#endif
@@ -0,0 +1,212 @@
+////////////////////////////////////////////////////////
+// File name: actionqueue.h
+// Description: Header only hand-off between the threads of civsim.
+// boundedQueue is a blocking FIFO with a fixed capacity, so a fast
+// producer waits for a slow consumer instead of buffering the whole
+// run. actionQueueBuf is a stream buffer the simulation writes its
+// action list into; it cuts the text into chunks that end at a turn
+// line and pushes them to a boundedQueue. spscQueue is a lock free
+// ring for exactly one producer and one consumer thread.
+//
+#ifndef ACTIONQUEUE_H
+#define ACTIONQUEUE_H
+
+#include <deque>
+#include <atomic>
+#include <utility>
+#include <string>
+#include <streambuf>
+#include <mutex>
+#include <condition_variable>
+#include "trace.h"
+
+#define actionChunkSize 65536	//Chunks are cut here even inside a turn
+#define actionQueueChunks 64	//Chunks waiting between two threads
+
+//boundedQueue - blocking FIFO shared by one producer and one consumer
+template <class T>
+class boundedQueue
+{
+public:
+boundedQueue(size_t size = actionQueueChunks)
+{
+	capacity = size;
+	closed = false;
+}
+
+//Waits while the queue is full, returns false once it is closed
+bool push(T item)
+{
+	std::unique_lock<std::mutex> lock(guard);
+	notFull.wait(lock, [this]{ return closed || items.size() < capacity; });
+	if(closed)
+	{
+		return false;
+	}
+	items.push_back(std::move(item));
+	notEmpty.notify_one();
+	return true;
+}
+
+//Waits for an item, returns false when the queue is closed and empty
+bool pop(T& item)
+{
+	std::unique_lock<std::mutex> lock(guard);
+	notEmpty.wait(lock, [this]{ return closed || !items.empty(); });
+	if(items.empty())
+	{
+		return false;
+	}
+	item = std::move(items.front());
+	items.pop_front();
+	notFull.notify_one();
+	return true;
+}
+
+//No more items, waiting threads wake up. Items already queued can
+//still be popped.
+void close()
+{
+	std::lock_guard<std::mutex> lock(guard);
+	closed = true;
+	notFull.notify_all();
+	notEmpty.notify_all();
+}
+
+private:
+std::deque<T> items;
+size_t capacity;
+bool closed;
+std::mutex guard;
+std::condition_variable notFull;
+std::condition_variable notEmpty;
+};
+
+//spscQueue - lock free ring of size items shared by one producer and
+//one consumer thread. Neither side ever waits, a full or empty queue
+//is reported and the caller decides how to back off.
+template <class T, size_t size>
+class spscQueue
+{
+public:
+spscQueue()
+{
+	head = 0;
+	tail = 0;
+}
+
+//Producer side, false if the queue is full
+bool push(const T& item)
+{
+	size_t end = tail.load(std::memory_order_relaxed);
+	if(end - head.load(std::memory_order_acquire) == size)
+	{
+		return false;
+	}
+	items[end % size] = item;
+	tail.store(end + 1, std::memory_order_release);
+	return true;
+}
+
+//Consumer side, false if the queue is empty
+bool pop(T& item)
+{
+	size_t start = head.load(std::memory_order_relaxed);
+	if(start == tail.load(std::memory_order_acquire))
+	{
+		return false;
+	}
+	item = items[start % size];
+	head.store(start + 1, std::memory_order_release);
+	return true;
+}
+
+private:
+T items[size];
+alignas(64) std::atomic<size_t> head;	//Apart so both sides do not
+alignas(64) std::atomic<size_t> tail;	//fight over one cache line
+};
+
+//actionQueueBuf - stream buffer that sends an action list through a queue.
+//The simulation flushes after every line; a chunk is only pushed when the
+//flushed text ends with a turn line, so a consumer gets whole turns.
+class actionQueueBuf : public std::streambuf
+{
+public:
+actionQueueBuf(boundedQueue<std::string>& target) : queue(target)
+{
+	dropped = false;
+}
+
+//Pushes what is left and closes the queue
+void close()
+{
+	pushChunk();
+	queue.close();
+}
+
+//True if the consumer went away and text was thrown away
+bool lost() { return dropped; }
+
+protected:
+int overflow(int c)
+{
+	if(c != EOF)
+	{
+		chunk += (char)c;
+	}
+	return c == EOF ? 0 : c;
+}
+
+std::streamsize xsputn(const char* text, std::streamsize length)
+{
+	chunk.append(text, length);
+	return length;
+}
+
+int sync()
+{
+	if(chunk.size() >= actionChunkSize || endsWithTurn())
+	{
+		pushChunk();
+	}
+	return 0;
+}
+
+private:
+boundedQueue<std::string>& queue;
+std::string chunk;
+bool dropped;
+
+//True if the last line of the chunk is a turn number
+bool endsWithTurn()
+{
+	size_t end = chunk.size();
+	if(end < 2 || chunk[end-1] != '\n')
+	{
+		return false;
+	}
+	size_t start = end - 1;
+	while(start > 0 && chunk[start-1] >= '0' && chunk[start-1] <= '9')
+	{
+		start--;
+	}
+	return start < end - 1 && (start == 0 || chunk[start-1] == '\n');
+}
+
+void pushChunk()
+{
+	if(chunk.empty())
+	{
+		return;
+	}
+	traceSpan span("push actions", "bytes", chunk.size());
+	if(!queue.push(std::move(chunk)))
+	{
+		dropped = true;
+	}
+	chunk.clear();
+}
+};
+
+#endif
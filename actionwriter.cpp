@@ -0,0 +1,332 @@
+////////////////////////////////////////////////////////
+// File name: actionwriter.cpp
+// Description: Implementation of the actionWriter class
+//
+#include "actionwriter.h"
+#include "spectator.h"
+#include "trace.h"
+#include <chrono>
+#include <errno.h>
+#include <stdlib.h>
+using namespace std;
+
+typedef chrono::steady_clock writerClock;
+
+// Waits a little longer every time a queue is found full or empty
+static void backOff(int& tries)
+{
+	if(++tries < 64)
+	{
+		this_thread::yield();
+	}
+	else
+	{
+		this_thread::sleep_for(chrono::microseconds(50));
+	}
+}
+
+// Appends a number and a space, the list only holds positive numbers
+static char* appendNumber(char* out, int value)
+{
+	char digits[12];
+	int count = 0;
+	do
+	{
+		digits[count++] = '0' + value % 10;
+		value /= 10;
+	} while(value > 0);
+	while(count > 0)
+	{
+		*out++ = digits[--count];
+	}
+	*out++ = ' ';
+	return out;
+}
+
+actionWriter::actionWriter()
+{
+	stallSeconds = 0;
+	writeSeconds = 0;
+	bytes = 0;
+	writes = 0;
+	direct = false;
+	unbuffered = false;
+	started = false;
+	failed = false;
+	fd = -1;
+	target = NULL;
+	spectators = NULL;
+	text = NULL;
+	used = 0;
+	current = &buffers[0];
+	for(int b = 0; b <= actionWriterDepth; b++)
+	{
+		buffers[b].reserve(actionTurnRecords);
+		if(b > 0) empty.push(&buffers[b]);
+	}
+}
+
+actionWriter::~actionWriter()
+{
+	close();
+}
+
+bool actionWriter::open(const char* name, bool directIO)
+{
+	// The text buffer has room for one more record past a full block
+	if(posix_memalign((void**)&text, actionWriteAlign, actionWriteSize + actionWriteAlign) != 0)
+	{
+		text = NULL;
+		return false;
+	}
+	if(directIO)
+	{
+		fd = ::open(name, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+		direct = fd >= 0;
+		unbuffered = direct;
+	}
+	if(fd < 0)
+	{
+		fd = ::open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if(fd < 0)
+	{
+		return false;
+	}
+	started = true;
+	writer = thread(&actionWriter::run, this);
+	return true;
+}
+
+void actionWriter::open(streambuf* output)
+{
+	text = (char*)malloc(actionWriteSize + actionWriteAlign);
+	target = output;
+	started = true;
+	writer = thread(&actionWriter::run, this);
+}
+
+void actionWriter::turn(int number)
+{
+	if(!started)
+	{
+		current->clear();	//Nowhere to write to
+		return;
+	}
+	actionRecord rec;
+	rec.action = turnRecord;
+	rec.turn = number;
+	current->push_back(rec);
+
+	// The writer always returns a buffer before it takes the next one,
+	// so a free buffer means there is room in the queue
+	handOver(current);
+	nextBuffer();
+}
+
+// The writer checks the queue under wakeGuard before it sleeps, so taking
+// the lock after the push means it either saw the buffer or gets the signal
+void actionWriter::handOver(turnBuffer* buffer)
+{
+	full.push(buffer);
+	{
+		lock_guard<mutex> lock(wakeGuard);
+	}
+	wake.notify_one();
+}
+
+void actionWriter::nextBuffer()
+{
+	if(empty.pop(current))
+	{
+		return;
+	}
+	traceSpan span("log stall");
+	writerClock::time_point start = writerClock::now();
+	int tries = 0;
+	while(!empty.pop(current))
+	{
+		backOff(tries);
+	}
+	stallSeconds += chrono::duration<double>(writerClock::now() - start).count();
+}
+
+bool actionWriter::close()
+{
+	if(started)
+	{
+		if(!current->empty())
+		{
+			handOver(current);
+			nextBuffer();
+		}
+		handOver(NULL);
+		writer.join();
+		started = false;
+		if(fd >= 0 && ::close(fd) != 0)
+		{
+			failed = true;
+		}
+		fd = -1;
+	}
+	free(text);
+	text = NULL;
+	return !failed;
+}
+
+char* formatAction(char* out, const actionRecord& rec)
+{
+	switch(rec.action)
+	{
+		case turnRecord:
+		out = appendNumber(out, rec.turn);
+		break;
+
+		case moveRecord:
+		*out++ = 'M';
+		*out++ = ' ';
+		out = appendNumber(out, rec.x);
+		out = appendNumber(out, rec.y);
+		out = appendNumber(out, rec.newX);
+		out = appendNumber(out, rec.newY);
+		break;
+
+		case colorRecord:
+		case createRecord:
+		*out++ = rec.action;
+		*out++ = ' ';
+		out = appendNumber(out, rec.layer);
+		out = appendNumber(out, rec.x);
+		out = appendNumber(out, rec.y);
+		out = appendNumber(out, rec.color);
+		if(rec.action == createRecord)
+		{
+			const char* type = rec.object == cityObject ? "city " : rec.object == roadObject ? "road " : "army ";
+			memcpy(out, type, 5);
+			out += 5;
+		}
+		break;
+
+		case destroyRecord:
+		*out++ = 'D';
+		*out++ = ' ';
+		out = appendNumber(out, rec.layer);
+		out = appendNumber(out, rec.x);
+		out = appendNumber(out, rec.y);
+		break;
+
+		case hashRecord:
+		*out++ = 'H';
+		*out++ = ' ';
+		for(int shift = 60; shift >= 0; shift -= 4)
+		{
+			*out++ = "0123456789abcdef"[(rec.hash >> shift) & 15];
+		}
+		*out++ = ' ';
+		break;
+	}
+	// The last field ends the line instead of a space
+	out[-1] = '\n';
+	return out;
+}
+
+void actionWriter::run()
+{
+	traceThreadName("action writer");
+	turnBuffer* buffer;
+
+	while(true)
+	{
+		if(!full.pop(buffer))
+		{
+			// Nothing to write until the simulation ends a turn
+			unique_lock<mutex> lock(wakeGuard);
+			wake.wait(lock, [&]() { return full.pop(buffer); });
+		}
+		if(buffer == NULL)
+		{
+			break;
+		}
+
+		traceSpan span("format turn", "records", buffer->size());
+		for(size_t r = 0; r < buffer->size(); r++)
+		{
+			used = formatAction(text + used, (*buffer)[r]) - text;
+			if(used >= actionWriteSize)
+			{
+				writeText(fd >= 0 ? actionWriteSize : used);
+			}
+		}
+		// A stream buffer gets every turn as soon as it is done
+		if(target && used > 0)
+		{
+			writeText(used);
+		}
+		if(spectators)
+		{
+			spectators->add(buffer->data(), buffer->size());
+		}
+		buffer->clear();
+		empty.push(buffer);
+	}
+
+	if(used > 0)
+	{
+		writeText(used);
+	}
+}
+
+void actionWriter::writeText(long long length)
+{
+	traceSpan span("write actions", "bytes", length);
+	writerClock::time_point start = writerClock::now();
+
+	if(target)
+	{
+		if(target->sputn(text, length) != length)
+		{
+			failed = true;
+		}
+		target->pubsync();
+		writes++;
+	}
+	else
+	{
+		// O_DIRECT needs whole blocks, the tail of the file is written
+		// through the page cache
+		if(unbuffered && length % actionWriteAlign != 0)
+		{
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+			unbuffered = false;
+		}
+		long long done = 0;
+		while(done < length)
+		{
+			ssize_t count = write(fd, text + done, length - done);
+			if(count < 0 && errno == EINVAL && unbuffered)
+			{
+				// The file system took the flag at open but not the write
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+				unbuffered = false;
+				direct = false;
+				continue;
+			}
+			if(count < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if(count <= 0)
+			{
+				failed = true;
+				break;
+			}
+			done += count;
+			writes++;
+		}
+	}
+
+	bytes += length;
+	used -= length;
+	memmove(text, text + length, used);
+	writeSeconds += chrono::duration<double>(writerClock::now() - start).count();
+}
@@ -0,0 +1,94 @@
+////////////////////////////////////////////////////////
+// File name: actionwriter.h
+// Description: Header file for the actionWriter class, which writes the
+// action list of a simulation on a thread of its own. The simulation
+// adds fixed size records to the buffer of the current turn and hands
+// the buffer over a lock free queue at every turn line; the writer
+// thread formats the records as text and writes them in large blocks,
+// so turn N+1 is simulated while turn N is written. Buffers go back to
+// the simulation once written. When all of them are in use the
+// simulation waits, and the time it waits is reported as stall time.
+// With no turn to write the writer thread sleeps on a condition
+// variable until the simulation hands one over or closes the list.
+//
+#ifndef ACTIONWRITER_H
+#define ACTIONWRITER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+#include <vector>
+#include "actionlog.h"
+#include "actionqueue.h"
+
+#define actionWriterDepth 8		//Turns that may wait for the writer
+#define actionTurnRecords 4096		//Records a turn buffer holds before it grows
+#define actionWriteSize (1 << 20)	//Bytes of one write to the file
+#define actionWriteAlign 4096		//Buffer and size alignment of O_DIRECT writes
+#define actionRecordText 64		//Longest text of one record
+
+class spectatorServer;
+
+//Writes the text of one record line at out, returns the end of the line
+char* formatAction(char* out, const actionRecord& rec);
+
+//actionWriter - asynchronous action list writer
+class actionWriter
+{
+public:
+actionWriter();
+~actionWriter();
+//Writes to a file. With directIO the page cache is bypassed where the
+//file system allows it; the writer falls back to normal writes if not.
+//Returns false if the file cannot be created.
+bool open(const char* name, bool directIO);
+//Writes to a stream buffer and syncs it after every turn line
+void open(std::streambuf* target);
+//Adds a record to the current turn
+void add(const actionRecord& rec) { current->push_back(rec); }
+//Adds a turn line and hands the records so far to the writer
+void turn(int number);
+//Also hands every turn to server, set before the first turn
+void watch(spectatorServer* server) { spectators = server; }
+//Hands over the last records and waits until everything is written.
+//Returns false if a write failed.
+bool close();
+
+double stallSeconds;	//Time the simulation waited for a free buffer
+double writeSeconds;	//Time the writer spent in write calls
+long long bytes;	//Bytes written
+long long writes;	//Write calls
+bool direct;		//True if the file was written with O_DIRECT
+
+private:
+typedef std::vector<actionRecord> turnBuffer;
+
+//Writer thread
+void run();
+//Writes the first length bytes of text
+void writeText(long long length);
+//Next free buffer, waits for the writer if there is none
+void nextBuffer();
+//Queues a turn (NULL closes the list) and wakes the writer
+void handOver(turnBuffer* buffer);
+
+turnBuffer buffers[actionWriterDepth + 1];
+turnBuffer* current;
+spscQueue<turnBuffer*, actionWriterDepth + 1> full;	//Simulation -> writer
+spscQueue<turnBuffer*, actionWriterDepth + 1> empty;	//Writer -> simulation
+std::thread writer;
+std::mutex wakeGuard;
+std::condition_variable wake;	//Signalled after every handOver
+bool started;
+bool failed;
+
+int fd;			//File target, -1 for a stream buffer
+bool unbuffered;	//O_DIRECT is set on fd
+std::streambuf* target;
+spectatorServer* spectators;
+char* text;		//Formatted text not written yet
+long long used;
+};
+
+#endif
@@ -0,0 +1,88 @@
+////////////////////////////////////////////////////////
+// File name: allocount.cpp
+// Description: Counting replacements of the global operator new and delete
+//
+#include "allocount.h"
+#include <stdlib.h>
+#include <new>
+
+bool allocTracking = false;
+
+static thread_local long long allocCount = 0;
+static thread_local long long allocBytes = 0;
+
+void allocCounts(long long& count, long long& bytes)
+{
+	count = allocCount;
+	bytes = allocBytes;
+}
+
+// Every form of new ends up here
+static void* countedAlloc(std::size_t size)
+{
+	if(allocTracking)
+	{
+		allocCount++;
+		allocBytes += size;
+	}
+	void* block = malloc(size > 0 ? size : 1);
+	if(block == NULL)
+	{
+		throw std::bad_alloc();
+	}
+	return block;
+}
+
+void* operator new(std::size_t size)
+{
+	return countedAlloc(size);
+}
+
+void* operator new[](std::size_t size)
+{
+	return countedAlloc(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return countedAlloc(size);
+	}
+	catch(...)
+	{
+		return NULL;
+	}
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return countedAlloc(size);
+	}
+	catch(...)
+	{
+		return NULL;
+	}
+}
+
+void operator delete(void* block) noexcept
+{
+	free(block);
+}
+
+void operator delete[](void* block) noexcept
+{
+	free(block);
+}
+
+void operator delete(void* block, std::size_t) noexcept
+{
+	free(block);
+}
+
+void operator delete[](void* block, std::size_t) noexcept
+{
+	free(block);
+}
@@ -0,0 +1,18 @@
+////////////////////////////////////////////////////////
+// File name: allocount.h
+// Description: Heap allocation accounting. allocount.cpp replaces the
+// global operator new and delete of every program it is linked into;
+// while allocTracking is set they count the allocations and bytes of
+// the calling thread. perfSection reads these counts, so the phase
+// report of perfcount.h shows the allocations of every phase.
+//
+#ifndef ALLOCOUNT_H
+#define ALLOCOUNT_H
+
+//True while allocations are counted
+extern bool allocTracking;
+
+//Allocations and bytes the calling thread asked for so far
+void allocCounts(long long& count, long long& bytes);
+
+#endif
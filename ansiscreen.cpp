@@ -0,0 +1,281 @@
+////////////////////////////////////////////////////////
+// File name: ansiscreen.cpp
+// Description: Implementation of the ansiScreen class
+//
+#include "ansiscreen.h"
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+using namespace std;
+
+// Appends a decimal number
+static void appendNumber(string& out, int value)
+{
+	char digits[12];
+	int count = 0;
+	do
+	{
+		digits[count++] = '0' + value % 10;
+		value /= 10;
+	} while(value > 0);
+	while(count > 0)
+	{
+		out += digits[--count];
+	}
+}
+
+ansiScreen::ansiScreen()
+{
+	width = 80;
+	height = 24;
+	frames = 0;
+	sent = 0;
+	cursorX = 0;
+	cursorY = 0;
+	started = false;
+}
+
+void ansiScreen::start()
+{
+	struct winsize size;
+	if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0 && size.ws_row > 0)
+	{
+		width = size.ws_col;
+		height = size.ws_row;
+	}
+
+	screenCell blank = {' ', ansiDefaultColor, ansiDefaultColor, false};
+	back.assign(width*height, blank);
+	front.assign(width*height, blank);
+	out.reserve(width*height*16);
+
+	// Keys arrive one at a time and are not echoed
+	if(tcgetattr(STDIN_FILENO, &saved) == 0)
+	{
+		struct termios raw = saved;
+		raw.c_lflag &= ~(ICANON | ECHO);
+		raw.c_cc[VMIN] = 0;
+		raw.c_cc[VTIME] = 0;
+		tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+		started = true;
+	}
+
+	// Alternate screen, hidden cursor, cleared with default colors
+	out = "\033[?1049h\033[?25l\033[0m\033[2J";
+	writeOut();
+}
+
+void ansiScreen::end()
+{
+	out = "\033[0m\033[?25h\033[?1049l";
+	writeOut();
+	if(started)
+	{
+		tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+		started = false;
+	}
+}
+
+void ansiScreen::put(int x, int y, char glyph, int fg, int bg, bool bold)
+{
+	if(x < 0 || y < 0 || x >= width || y >= height)
+	{
+		return;
+	}
+	screenCell& cell = back[y*width + x];
+	cell.glyph = glyph;
+	cell.fg = fg;
+	cell.bg = bg;
+	cell.bold = bold;
+}
+
+void ansiScreen::text(const char* text, int fg, int bg, bool bold)
+{
+	for(; *text; text++)
+	{
+		if(*text == '\n')
+		{
+			clearToEnd();
+			cursorX = 0;
+			cursorY++;
+			continue;
+		}
+		put(cursorX++, cursorY, *text, fg, bg, bold);
+	}
+}
+
+void ansiScreen::clearToEnd()
+{
+	for(int x = cursorX; x < width; x++)
+	{
+		put(x, cursorY, ' ', ansiDefaultColor, ansiDefaultColor, false);
+	}
+}
+
+void ansiScreen::setColors(const screenCell& cell, screenCell& current, bool& known)
+{
+	if(known && cell.fg == current.fg && cell.bg == current.bg && cell.bold == current.bold)
+	{
+		return;
+	}
+	out += "\033[";
+	// Bold can only be turned off with a reset, which also resets the colors
+	bool reset = !known || (current.bold && !cell.bold);
+	bool first = true;
+	if(reset)
+	{
+		out += '0';
+		first = false;
+	}
+	if(cell.bold && (reset || !current.bold))
+	{
+		out += first ? "1" : ";1";
+		first = false;
+	}
+	if(reset || cell.fg != current.fg)
+	{
+		out += first ? "3" : ";3";
+		appendNumber(out, cell.fg);
+		first = false;
+	}
+	if(reset || cell.bg != current.bg)
+	{
+		out += first ? "4" : ";4";
+		appendNumber(out, cell.bg);
+	}
+	out += 'm';
+	current = cell;
+	known = true;
+}
+
+void ansiScreen::moveTo(int x, int y, int& atX, int& atY)
+{
+	if(x == atX && y == atY)
+	{
+		return;
+	}
+	out += "\033[";
+	if(y == atY && x > atX)
+	{
+		// Forward on the same row is shorter than a full position
+		if(x - atX > 1) appendNumber(out, x - atX);
+		out += 'C';
+	}
+	else
+	{
+		appendNumber(out, y + 1);
+		out += ';';
+		appendNumber(out, x + 1);
+		out += 'H';
+	}
+	atX = x;
+	atY = y;
+}
+
+long long ansiScreen::present()
+{
+	screenCell current;
+	bool known = false;	//The colors of the terminal are not known at the start of a frame
+	int atX = -1, atY = -1;	//Neither is the cursor
+
+	out.clear();
+	for(int y = 0; y < height; y++)
+	{
+		int row = y*width;
+		for(int x = 0; x < width; x++)
+		{
+			if(back[row + x] == front[row + x])
+			{
+				continue;
+			}
+			// A short gap in the same colors is cheaper to resend than to skip
+			if(y == atY && atX >= 0 && x > atX && x - atX <= ansiGapCells)
+			{
+				int g = atX;
+				while(g < x && back[row + g].fg == current.fg && back[row + g].bg == current.bg
+				      && back[row + g].bold == current.bold)
+				{
+					g++;
+				}
+				if(g == x)
+				{
+					for(g = atX; g < x; g++) out += back[row + g].glyph;
+					atX = x;
+				}
+			}
+			moveTo(x, y, atX, atY);
+			setColors(back[row + x], current, known);
+			out += back[row + x].glyph;
+			front[row + x] = back[row + x];
+			atX++;
+			// The cursor stays on the last column after it is written to,
+			// where it is best not to guess what the next character does
+			if(atX == width)
+			{
+				atX = -1;
+				atY = -1;
+			}
+		}
+	}
+	if(!out.empty())
+	{
+		out += "\033[0m";
+	}
+	frames++;
+	long long length = out.size();
+	writeOut();
+	return length;
+}
+
+void ansiScreen::writeOut()
+{
+	size_t done = 0;
+	while(done < out.size())
+	{
+		ssize_t count = write(STDOUT_FILENO, out.data() + done, out.size() - done);
+		if(count <= 0) break;
+		done += count;
+	}
+	sent += done;
+	out.clear();
+}
+
+int ansiScreen::readKey(int milliseconds)
+{
+	struct pollfd input;
+	input.fd = STDIN_FILENO;
+	input.events = POLLIN;
+	if(poll(&input, 1, milliseconds) <= 0)
+	{
+		return ansiNoKey;
+	}
+
+	unsigned char keys[8];
+	ssize_t count = read(STDIN_FILENO, keys, sizeof(keys));
+	if(count <= 0)
+	{
+		return ansiNoKey;
+	}
+	// Arrow, home and end keys come as escape sequences
+	if(keys[0] == 27 && count >= 3 && (keys[1] == '[' || keys[1] == 'O'))
+	{
+		switch(keys[2])
+		{
+			case 'C': return ansiKeyRight;
+			case 'D': return ansiKeyLeft;
+			case 'H': return ansiKeyHome;
+			case 'F': return ansiKeyEnd;
+			case '1': return ansiKeyHome;
+			case '4': return ansiKeyEnd;
+		}
+	}
+	return keys[0];
+}
+
+void ansiScreen::beep()
+{
+	out = "\a";
+	writeOut();
+}
@@ -0,0 +1,82 @@
+////////////////////////////////////////////////////////
+// File name: ansiscreen.h
+// Description: Header file for the ansiScreen class, a terminal
+// renderer that needs no curses. Drawing goes into a back buffer of
+// cells (glyph, colors, bold); present compares it with the front
+// buffer, the cells the terminal shows, and sends only the cells that
+// changed. Runs of changed cells are sent without cursor moves, colors
+// are only set when they differ from the last cell sent, and the whole
+// frame goes out in a single write().
+//
+#ifndef ANSISCREEN_H
+#define ANSISCREEN_H
+
+#include <string>
+#include <vector>
+#include <termios.h>
+
+#define ansiDefaultColor 9	//SGR color that leaves the terminal default
+#define ansiGapCells 4		//Unchanged cells resent instead of a cursor move
+
+//Keys of readKey besides plain characters
+#define ansiNoKey -1
+#define ansiKeyLeft 0x101
+#define ansiKeyRight 0x102
+#define ansiKeyHome 0x103
+#define ansiKeyEnd 0x104
+
+//screenCell - one character cell of the terminal
+struct screenCell
+{
+	char glyph;
+	unsigned char fg, bg;	//Colors 0-7 or ansiDefaultColor
+	bool bold;
+	bool operator==(const screenCell& other) const
+	{
+		return glyph == other.glyph && fg == other.fg && bg == other.bg && bold == other.bold;
+	}
+	bool operator!=(const screenCell& other) const { return !(*this == other); }
+};
+
+//ansiScreen - double buffered ANSI terminal
+class ansiScreen
+{
+public:
+ansiScreen();
+//Switches the terminal to the alternate screen and raw keyboard input
+void start();
+//Restores the terminal
+void end();
+
+//Cells of the back buffer, drawing outside the screen is ignored
+void put(int x, int y, char glyph, int fg, int bg, bool bold);
+//Writes text at the text cursor and moves it along
+void text(const char* text, int fg, int bg, bool bold);
+//Moves the text cursor
+void move(int x, int y) { cursorX = x; cursorY = y; }
+//Blanks the row of the text cursor from the cursor on
+void clearToEnd();
+//Sends the changes of the back buffer, returns the bytes written
+long long present();
+//Waits up to milliseconds for a key (forever if negative)
+int readKey(int milliseconds);
+void beep();
+
+int width, height;
+long long frames;	//Frames presented
+long long sent;		//Bytes written by present
+
+private:
+std::vector<screenCell> front, back;
+std::string out;	//Escape sequences and text of a frame
+int cursorX, cursorY;	//Text cursor in the back buffer
+bool started;
+struct termios saved;	//Terminal settings before start
+
+//Appends an SGR sequence for the differences from the last cell sent
+void setColors(const screenCell& cell, screenCell& current, bool& known);
+void moveTo(int x, int y, int& atX, int& atY);
+void writeOut();
+};
+
+#endif
@@ -0,0 +1,77 @@
+////////////////////////////////////////////////////////
+// File name: arena.cpp
+// Description: Implementation of the gameArena class
+//
+#include "arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <sys/mman.h>
+using namespace std;
+
+gameArena::gameArena(size_t bytes)
+{
+	peak = 0;
+	overflowed = 0;
+	huge = false;
+	base = next = end = NULL;
+
+	// Over-reserves by a huge page so the range can start on one.
+	// MAP_NORESERVE: untouched pages cost no memory or swap.
+	mapped = bytes + arenaHugePage;
+	mapping = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(mapping == MAP_FAILED)
+	{
+		// Everything then comes from the heap
+		mapping = NULL;
+		mapped = 0;
+		return;
+	}
+	base = (char*)(((uintptr_t)mapping + arenaHugePage - 1) & ~(uintptr_t)(arenaHugePage - 1));
+	next = base;
+	end = base + bytes;
+#ifdef MADV_HUGEPAGE
+	huge = madvise(base, bytes, MADV_HUGEPAGE) == 0;
+#endif
+}
+
+gameArena::~gameArena()
+{
+	rewind();
+	if(mapping)
+	{
+		munmap(mapping, mapped);
+	}
+}
+
+void* gameArena::allocate(size_t bytes, size_t align)
+{
+	char* start = (char*)(((uintptr_t)next + align - 1) & ~(uintptr_t)(align - 1));
+	if(base && start + bytes <= end)
+	{
+		next = start + bytes;
+		if(used() > peak) peak = used();
+		return start;
+	}
+
+	// Past the reserved range, kept until the next rewind
+	void* block = NULL;
+	if(posix_memalign(&block, align < sizeof(void*) ? sizeof(void*) : align, bytes ? bytes : 1) != 0)
+	{
+		throw bad_alloc();
+	}
+	overflow.push_back(block);
+	overflowed += bytes;
+	return block;
+}
+
+void gameArena::rewind()
+{
+	next = base;
+	// Only games that outgrew the range have blocks here
+	for(size_t i = 0; i < overflow.size(); i++)
+	{
+		free(overflow[i]);
+	}
+	overflow.clear();
+}
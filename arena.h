@@ -0,0 +1,71 @@
+////////////////////////////////////////////////////////
+// File name: arena.h
+// Description: Header file for the gameArena class, a bump allocator for
+// the state of one game at a time. The arena reserves a large range of
+// address space up front (asking for transparent huge pages where the
+// kernel has them) and hands out memory by moving a pointer; nothing is
+// freed on its own, rewind() gives everything back at once. Pages stay
+// mapped across rewinds, so back to back games on one thread reuse the
+// same memory without faulting it in again. Not thread safe, keep one
+// arena per thread.
+//
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+#define arenaReserveBytes ((size_t)1 << 30)	//Address space reserved by default
+#define arenaHugePage ((size_t)2 << 20)		//Alignment of the range, for huge pages
+
+//gameArena - per thread game memory
+class gameArena
+{
+public:
+//Reserves bytes of address space, pages are only backed once used
+gameArena(size_t bytes = arenaReserveBytes);
+~gameArena();
+//bytes aligned to align, from the reserved range or past it from the heap
+void* allocate(size_t bytes, size_t align);
+//Gives back everything allocated so far. Whatever lives in the arena
+//must be gone by then.
+void rewind();
+//Bytes handed out since the last rewind
+size_t used() const { return next - base; }
+//Most bytes ever in use, and bytes that did not fit and came from the heap
+size_t highWater() const { return peak; }
+size_t overflowBytes() const { return overflowed; }
+//True if the range is backed by huge pages where the kernel allows it
+bool hugePages() const { return huge; }
+
+private:
+char* base;
+char* next;
+char* end;
+void* mapping;		//Start and length of the mmap, base is aligned within it
+size_t mapped;
+size_t peak;
+size_t overflowed;
+bool huge;
+std::vector<void*> overflow;	//Heap blocks of allocations past the end
+
+gameArena(const gameArena&);
+gameArena& operator=(const gameArena&);
+};
+
+//Standard allocator on an arena, deallocate is a no-op
+template <class T>
+struct arenaAllocator
+{
+typedef T value_type;
+gameArena* arena;
+
+arenaAllocator(gameArena* a) : arena(a) {}
+template <class U> arenaAllocator(const arenaAllocator<U>& other) : arena(other.arena) {}
+T* allocate(size_t n) { return (T*)arena->allocate(n*sizeof(T), alignof(T)); }
+void deallocate(T*, size_t) {}
+template <class U> bool operator==(const arenaAllocator<U>& other) const { return arena == other.arena; }
+template <class U> bool operator!=(const arenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+#endif
@@ -0,0 +1,64 @@
+#!/bin/bash
+# Benchmark suite, run from the build directory after make.
+# Times the map generator and the simulation on a fixed seed and fails
+# if a simulation turn allocates heap memory. Then plays one game on a
+# big map with both grid layouts and compares their time and, where the
+# kernel allows hardware counters, cache misses per turn. Last, runs a
+# batch of games with civsweep and reports their setup time per game.
+x=${1:-400}
+y=${2:-200}
+layoutX=${3:-2000}
+layoutY=${4:-2000}
+seed=7
+bin=$(pwd)
+mapfile=$(mktemp)
+layoutdir=$(mktemp -d)
+trap 'rm -f $mapfile; rm -rf $layoutdir' EXIT
+
+echo "== mapcreate -s $seed $x $y"
+time ./mapcreate -s $seed -f rle $x $y > $mapfile
+
+echo "== simulation"
+report=$( { time ./simulation --alloc-stats $mapfile; } 2>&1 )
+echo "$report"
+
+# allocs is the fourth column from the end of the phase report
+turnAllocs=$(echo "$report" | awk '$1 == "turn" { print $(NF-3) }')
+if [ "$turnAllocs" != "0" ]; then
+	echo "benchmark: simulation turns made ${turnAllocs:-unknown} heap allocations, expected 0"
+	exit 1
+fi
+echo "benchmark: no heap allocations in simulation turns"
+
+echo "== grid layouts, mapcreate --mode noise -s $seed $layoutX $layoutY"
+./mapcreate --mode noise -s $seed -f rle $layoutX $layoutY > $mapfile
+for layout in rows morton; do
+	sed "s/^grid_layout = .*/grid_layout = '$layout'/" config > $layoutdir/config
+	report=$(cd $layoutdir && $bin/simulation --perf-counters $mapfile 2>&1)
+	mv $layoutdir/action_list.txt $layoutdir/$layout.txt
+	# Counter columns are 12 wide from column 57 of the report
+	echo "$report" | awk -v layout=$layout '
+		$1 == "phase" { header = $0 }
+		$1 == "turn" {
+			line = sprintf("%-8s %8.2f ms/turn", layout, $4/$2)
+			for(c = 57; c + 11 <= length(header); c += 12) {
+				name = substr(header, c, 12)
+				gsub(/^ +/, "", name)
+				if(name ~ /miss/) line = line sprintf(", %.0f %s/turn", substr($0, c, 12)/$2, name)
+			}
+			print line
+		}'
+done
+if ! cmp -s $layoutdir/rows.txt $layoutdir/morton.txt; then
+	echo "benchmark: the grid layouts played different games"
+	exit 1
+fi
+echo "benchmark: both grid layouts played the same game"
+
+echo "== batch of games, civsweep $x $y"
+cp config $layoutdir/config
+printf "size $x $y\nmode noise\nseeds 1-4\nrandom maximum_armies 50 200\nsamples 8\n" > $layoutdir/spec
+(cd $layoutdir && $bin/civsweep -j 1 -o sweep.csv spec) || exit 1
+# setup_us and sim_ms are the last two columns
+awk -F, 'NR > 1 { setup += $(NF-1); sim += $NF*1000; n++ }
+	END { printf("%d games, %.0f us setup per game, %.2f%% of a game\n", n, setup/n, 100*setup/sim) }' $layoutdir/sweep.csv
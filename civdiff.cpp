@@ -0,0 +1,377 @@
+// civdiff.cpp
+// Finds where two action lists stop agreeing, e.g. the same seed and
+// config before and after a change that should not have changed the
+// game. The logs are compared as bytes from the first turn that may
+// differ, so identical stretches only cost a memcmp. When both logs
+// have a logindex index that turn is bisected instead of scanned for:
+// on the state hash lines at the end of every turn when both logs have
+// them, else on the keyframes. The report gives the turn, the first
+// differing record of both logs, its cell and a map excerpt of the
+// state just before that record.
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include "actionlog.h"
+#include "mapfile.h"
+#include "mapstate.h"
+using namespace std;
+
+#define compareChunk (1 << 20)	//Bytes compared by one memcmp
+
+//One of the two logs and its index
+struct diffLog
+{
+	string name;
+	actionLog log;
+	actionIndex index;
+	bool indexed;
+};
+
+void printHelpMessage(ostream& out)
+{
+	out<<"Usage: civdiff [OPTION]... <action-list-a> <action-list-b>"<<endl<<endl;
+	out<<"Options:"<<endl;
+	out<<"-h          display this help message"<<endl;
+	out<<"-m          map of the runs, shows its terrain in the excerpt"<<endl;
+	out<<"-r          cells around the first difference in the excerpt (default 5)"<<endl;
+	out<<"--no-index  scan from the start even if both logs are indexed"<<endl;
+	out<<"<action-list>.idx is used when it exists (see logindex)."<<endl;
+	out<<"Exits with 0 if the logs are the same, 1 if they differ and 2 on errors."<<endl;
+}
+
+// Opens a log and its index, an index that does not fit the log is not used
+bool openLog(diffLog& side, bool useIndex)
+{
+	if(!side.log.open(side.name.c_str()))
+	{
+		cerr<<"civdiff: could not open "<<side.name<<endl;
+		return false;
+	}
+	side.indexed = useIndex && side.index.load((side.name + ".idx").c_str()) && side.index.turns() > 0;
+	if(side.indexed)
+	{
+		long long last = side.index.turnOffset.back();
+		if(last >= side.log.size() || (unsigned char)(side.log.begin()[last] - '0') > 9)
+		{
+			cerr<<"civdiff: "<<side.name<<".idx is not an index of "<<side.name<<", not using it"<<endl;
+			side.indexed = false;
+		}
+	}
+	return true;
+}
+
+// Reads the hash line that ends a turn, false if the turn has none
+bool turnHash(diffLog& side, int turn, unsigned long long& hash)
+{
+	const char* end = turn + 1 < side.index.turns() ? side.log.begin() + side.index.turnOffset[turn + 1] : side.log.end();
+	const char* line = end - 1;
+	if(line > side.log.begin() && *line == '\n') line--;
+	while(line > side.log.begin() && line[-1] != '\n') line--;
+
+	actionScanner scan(line, end);
+	actionRecord rec;
+	if(*line != hashRecord || !scan.next(rec))
+	{
+		return false;
+	}
+	hash = rec.hash;
+	return true;
+}
+
+bool sameState(const mapState& a, const mapState& b)
+{
+	return a.cityRoad == b.cityRoad && a.unit == b.unit && a.cityRoadColor == b.cityRoadColor && a.unitColor == b.unitColor;
+}
+
+// First turn whose state may differ, found by bisection. Assumes that
+// once the states part they stay apart, which a run that went another
+// way does. method says how the turn was found.
+int firstTurn(diffLog& a, diffLog& b, const char*& method)
+{
+	int turns = min(a.index.turns(), b.index.turns());
+	unsigned long long hashA, hashB;
+
+	// On the hash of every turn when both logs have them
+	if(turnHash(a, turns - 1, hashA) && turnHash(b, turns - 1, hashB))
+	{
+		method = "bisecting the state hashes";
+		if(hashA == hashB)
+		{
+			// The states never part, any difference is in the order of the records
+			return 0;
+		}
+		int same = -1, differs = turns - 1;
+		while(differs - same > 1)
+		{
+			int middle = same + (differs - same)/2;
+			if(!turnHash(a, middle, hashA) || !turnHash(b, middle, hashB))
+			{
+				method = "scanning, a turn had no state hash";
+				return 0;
+			}
+			if(hashA == hashB) same = middle;
+			else differs = middle;
+		}
+		return differs;
+	}
+
+	// On the keyframes, which only line up if both were taken as often
+	if(a.index.interval != b.index.interval)
+	{
+		method = "scanning, the indexes have different keyframe intervals";
+		return 0;
+	}
+	method = "bisecting the keyframes";
+	int keys = min(a.index.keyOffset.size(), b.index.keyOffset.size());
+	int width = max(a.index.width, b.index.width), height = max(a.index.height, b.index.height);
+	mapState stateA(width, height), stateB(width, height);
+	int same = 0, differs = keys;
+	while(differs - same > 1)
+	{
+		int middle = same + (differs - same)/2;
+		a.index.keyframe(middle, stateA);
+		b.index.keyframe(middle, stateB);
+		if(sameState(stateA, stateB)) same = middle;
+		else differs = middle;
+	}
+	return same*a.index.interval;
+}
+
+// Offset of the first byte where a and b differ from offset start on,
+// the length of the shorter one if it is a prefix of the other
+long long firstDifference(const char* a, long long lengthA, const char* b, long long lengthB, long long start)
+{
+	long long length = min(lengthA, lengthB);
+	long long at = start;
+	while(at < length)
+	{
+		long long size = min((long long)compareChunk, length - at);
+		if(memcmp(a + at, b + at, size) != 0)
+		{
+			while(a[at] == b[at]) at++;
+			return at;
+		}
+		at += size;
+	}
+	return length;
+}
+
+// Start of the line that holds text[at]
+long long lineStart(const char* text, long long at)
+{
+	while(at > 0 && text[at - 1] != '\n') at--;
+	return at;
+}
+
+// The line at text[at] without its newline, or a note at the end of the log
+string lineAt(const char* text, long long length, long long at)
+{
+	if(at >= length)
+	{
+		return "(end of the log)";
+	}
+	const char* newline = (const char*)memchr(text + at, '\n', length - at);
+	return string(text + at, newline ? newline : text + length);
+}
+
+// One cell of the excerpt: the top layer and its owner, else the terrain
+void printCell(const mapState& state, const mapFile& terrain, bool hasMap, int x, int y, char mark)
+{
+	int cell = y*state.width + x;
+	char glyph = hasMap && x < terrain.width && y < terrain.height ? terrain.at(x, y) : '.';
+	char owner = ' ';
+	if(state.unit[cell])
+	{
+		glyph = state.unit[cell];
+		owner = '0' + state.unitColor[cell] % 10;
+	}
+	else if(state.cityRoad[cell])
+	{
+		glyph = state.cityRoad[cell];
+		owner = '0' + state.cityRoadColor[cell] % 10;
+	}
+	cout<<mark<<glyph<<owner;
+}
+
+int main(int argc, char* argv[])
+{
+	diffLog a, b;
+	string mapName;
+	bool useIndex = true;
+	int radius = 5;
+	int arg = 1;
+
+	while(arg < argc && argv[arg][0] == '-')
+	{
+		if(strcmp(argv[arg],"-m") == 0 && arg+1 < argc)
+		{
+			mapName = argv[arg+1];
+			arg += 2;
+		}
+		else if(strcmp(argv[arg],"-r") == 0 && arg+1 < argc)
+		{
+			radius = atoi(argv[arg+1]);
+			arg += 2;
+		}
+		else if(strcmp(argv[arg],"--no-index") == 0)
+		{
+			useIndex = false;
+			arg++;
+		}
+		else if(strcmp(argv[arg],"-h") == 0)
+		{
+			printHelpMessage(cout);
+			return 0;
+		}
+		else
+		{
+			printHelpMessage(cerr);
+			return 2;
+		}
+	}
+	if(argc - arg != 2)
+	{
+		printHelpMessage(cerr);
+		return 2;
+	}
+	a.name = argv[arg];
+	b.name = argv[arg+1];
+
+	mapFile terrain;
+	bool hasMap = !mapName.empty();
+	if(hasMap && !terrain.load(mapName.c_str()))
+	{
+		cerr<<"civdiff: could not open "<<mapName<<endl;
+		return 2;
+	}
+	if(!openLog(a, useIndex) || !openLog(b, useIndex))
+	{
+		return 2;
+	}
+
+	// Both logs agree up to the turn line of the start turn
+	int start = 0;
+	const char* method = "scanning";
+	if(a.indexed && b.indexed)
+	{
+		start = firstTurn(a, b, method);
+	}
+	long long startOffset = start > 0 ? a.index.turnOffset[start] : 0;
+	if(start > 0 && startOffset != b.index.turnOffset[start])
+	{
+		// Records that went elsewhere before the states parted
+		start = 0;
+		startOffset = 0;
+		method = "scanning, the turn offsets differ";
+	}
+
+	long long at = firstDifference(a.log.begin(), a.log.size(), b.log.begin(), b.log.size(), startOffset);
+	if(at == a.log.size() && at == b.log.size())
+	{
+		cout<<"civdiff: "<<a.name<<" and "<<b.name<<" are the same"<<endl;
+		return 0;
+	}
+
+	// The turn and record the first difference is in, both logs are
+	// the same up to there
+	const char* text = a.log.begin();
+	long long record = lineStart(text, at);
+	long long turnLine = record;
+	int recordNumber = 0;
+	while(turnLine > 0 && (unsigned char)(text[turnLine] - '0') > 9)
+	{
+		turnLine = lineStart(text, turnLine - 1);
+		recordNumber++;
+	}
+	int turn = atoi(text + turnLine);
+	if((unsigned char)(text[turnLine] - '0') > 9)
+	{
+		turn = -1;	//Before the first turn line
+	}
+
+	cout<<"civdiff: "<<a.name<<" and "<<b.name<<" first differ in turn "<<turn<<", found by "<<method<<endl;
+	cout<<"record "<<recordNumber<<" of the turn:"<<endl;
+	cout<<"  "<<a.name<<": "<<lineAt(text, a.log.size(), record)<<endl;
+	cout<<"  "<<b.name<<": "<<lineAt(b.log.begin(), b.log.size(), record)<<endl;
+
+	// State just before the record: the turns before it, then the
+	// records of its turn that both logs share. Its size is the map's,
+	// else that of the index, else the area of the records before it.
+	int width = 1, height = 1;
+	actionRecord rec;
+	if(hasMap)
+	{
+		width = terrain.width;
+		height = terrain.height;
+	}
+	else if(a.indexed)
+	{
+		width = a.index.width;
+		height = a.index.height;
+	}
+	else
+	{
+		actionScanner area(text, text + record);
+		while(area.next(rec))
+		{
+			growArea(rec, width, height);
+		}
+	}
+	mapState state(width, height);
+	actionScanner scan(text, text + turnLine);
+	if(a.indexed && turn > 0 && a.index.seek(turn - 1, scan, state) < 0)
+	{
+		state.clear();
+		scan.seek(0);
+	}
+	while(replayTurn(scan, state) >= 0) {}
+	actionScanner shared(text + turnLine, text + record);
+	replayTurn(shared, state);
+	if(state.outside > 0)
+	{
+		cerr<<"civdiff: "<<state.outside<<" records of "<<a.name<<" lie outside the "<<width<<"x"<<height
+			<<(hasMap ? " map "+mapName : " area of its index")<<endl;
+		return 2;
+	}
+
+	// The cell of the record, from whichever log still has one
+	actionScanner recordA(text + record, a.log.end());
+	actionScanner recordB(b.log.begin() + record, b.log.end());
+	if(!(recordA.next(rec) && rec.action != turnRecord && rec.action != hashRecord)
+	   && !(recordB.next(rec) && rec.action != turnRecord && rec.action != hashRecord))
+	{
+		return 1;
+	}
+	int cell = rec.y*state.width + rec.x;
+	if(rec.x < 0 || rec.y < 0 || rec.x >= state.width || rec.y >= state.height)
+	{
+		cout<<"cell "<<rec.x<<","<<rec.y<<" is outside the map"<<endl;
+		return 1;
+	}
+	cout<<"cell "<<rec.x<<","<<rec.y<<" before it: ";
+	if(state.cityRoad[cell]) cout<<"city/road layer "<<state.cityRoad[cell]<<" color "<<state.cityRoadColor[cell];
+	else cout<<"no city or road";
+	if(state.unit[cell]) cout<<", unit layer "<<state.unit[cell]<<" color "<<state.unitColor[cell];
+	else cout<<", no unit";
+	cout<<endl;
+
+	// Excerpt, every cell is its glyph and owner color, * marks the cell
+	int left = max(rec.x - radius, 0), right = min(rec.x + radius, state.width - 1);
+	int top = max(rec.y - radius, 0), bottom = min(rec.y + radius, state.height - 1);
+	char label[16];
+	cout<<"columns "<<left<<"-"<<right<<", * marks the cell"<<endl;
+	for(int y = top; y <= bottom; y++)
+	{
+		snprintf(label, sizeof(label), "%5d ", y);
+		cout<<label;
+		for(int x = left; x <= right; x++)
+		{
+			printCell(state, terrain, hasMap, x, y, x == rec.x && y == rec.y ? '*' : ' ');
+		}
+		cout<<endl;
+	}
+	return 1;
+}
@@ -0,0 +1,342 @@
+// civfork.cpp
+// What-if branching. Runs the simulation of a map up to a fork turn,
+// then runs several branches on from there in parallel, each with its
+// own changes (a config key such as maximum_armies, or a new seed for
+// the random sequence), and reports how they came apart. The branches
+// are forks of one simulate: they share its map rows and unit lists
+// and only copy the chunks they change (see cowarray.h), so the fork
+// point is neither rerun nor copied for every branch.
+//
+// A branch is a comma separated list of key=value, e.g.
+//   maximum_armies=50,seed=3
+// where seed restarts the random sequence at the fork. Branch 0 (base)
+// always runs on unchanged; divergence is counted against it through
+// the state hash of every turn.
+
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include "simulate.h"
+#include "workpool.h"
+using namespace std;
+
+typedef chrono::steady_clock forkClock;
+
+struct branchSpec
+{
+	string name;		//As given on the command line
+	string config;		//Config lines of the changed keys
+	bool reseed;
+	unsigned int seed;
+};
+
+struct branchResult
+{
+	int turns;
+	int stop;
+	int cities[2], roads[2], armies[2];
+	int winner;
+	bool failed;		//The simulation rejected the config of the branch
+	int diverged;		//First turn whose state differs from base, -1 for never
+	unsigned long long hash;
+	vector <unsigned long long> hashes;	//State hash after each turn past the fork
+	long long shared, owned;
+	double forkSeconds;
+	double runSeconds;
+};
+
+void printHelpMessage(ostream& out)
+{
+	out<<"Usage: civfork [OPTION]... <map> [branch]..."<<endl<<endl;
+	out<<"Options:"<<endl;
+	out<<"-h     display this help message"<<endl;
+	out<<"-c     config file (default config)"<<endl;
+	out<<"-s     seed of the run up to the fork (default 1)"<<endl;
+	out<<"-t     turn to fork at (default 100)"<<endl;
+	out<<"-k     also run k branches that only reseed, with seeds 1 to k"<<endl;
+	out<<"-j     branches run at once (default all cores)"<<endl;
+	out<<"-o     write the action list of branch i to <prefix><i>.txt"<<endl;
+	out<<"A branch is key=value[,key=value]..., keys are config keys or seed."<<endl;
+	out<<"Keys only read by setup (cities_per_player, colors) have no effect."<<endl;
+	out<<"One CSV row per branch goes to stdout, a summary to stderr."<<endl;
+}
+
+// Value of key in config, empty if the config does not set it
+string configValue(const string& config, const string& key)
+{
+	istringstream in(config);
+	string line;
+	while(getline(in, line))
+	{
+		size_t start = line.find_first_not_of(" \t");
+		if(start == string::npos || line.compare(start, key.size(), key) != 0) continue;
+		size_t first = line.find('\'');
+		size_t last = line.rfind('\'');
+		if(first != string::npos && last > first) return line.substr(first + 1, last - first - 1);
+	}
+	return "";
+}
+
+// Reads key=value pairs, false if one is malformed or not a config key
+bool parseBranch(const string& text, const string& config, branchSpec& branch)
+{
+	istringstream in(text);
+	string pair;
+	branch.name = text;
+	branch.reseed = false;
+	while(getline(in, pair, ','))
+	{
+		size_t equals = pair.find('=');
+		if(equals == string::npos || equals == 0 || equals + 1 == pair.size())
+		{
+			return false;
+		}
+		string key = pair.substr(0, equals), value = pair.substr(equals + 1);
+		if(key == "seed")
+		{
+			branch.reseed = true;
+			branch.seed = strtoul(value.c_str(), NULL, 10);
+		}
+		else if(configValue(config, key).empty())
+		{
+			return false;
+		}
+		else
+		{
+			branch.config += key + " = '" + value + "'\n";
+		}
+	}
+	return true;
+}
+
+void runBranch(const simulate& fork, const branchSpec& branch, const int color[2], const string& prefix,
+               const string& forkLog, int index, branchResult& result)
+{
+	forkClock::time_point start = forkClock::now();
+	stringbuf actions;
+	simulate sim(fork, &actions);
+	forkClock::time_point forked = forkClock::now();
+
+	istringstream config(branch.config);
+	sim.parseConfig(config);
+	if(branch.reseed)
+	{
+		sim.setSeed(branch.seed);
+	}
+	sim.runSim();
+	sim.memoryUse(result.shared, result.owned);
+
+	result.failed = sim.failed();
+	result.turns = sim.turnsRun();
+	result.stop = sim.stopReason();
+	result.hash = sim.stateHash();
+	for(int p = 0; p < 2; p++)
+	{
+		result.cities[p] = sim.count(1, color[p]);
+		result.roads[p] = sim.count(2, color[p]);
+		result.armies[p] = sim.count(3, color[p]);
+	}
+	result.winner = 0;
+	if(result.cities[0] != result.cities[1]) result.winner = result.cities[0] > result.cities[1] ? 1 : 2;
+	else if(result.armies[0] != result.armies[1]) result.winner = result.armies[0] > result.armies[1] ? 1 : 2;
+
+	string text = actions.str();
+	actionScanner scan(text.data(), text.data() + text.size());
+	actionRecord rec;
+	while(scan.next(rec))
+	{
+		if(rec.action == hashRecord) result.hashes.push_back(rec.hash);
+	}
+	if(!prefix.empty())
+	{
+		// The log up to the fork and the branch after it make a whole action list
+		ofstream out((prefix + to_string(index) + ".txt").c_str(), ios::binary);
+		out<<forkLog<<text;
+	}
+	result.forkSeconds = chrono::duration<double>(forked - start).count();
+	result.runSeconds = chrono::duration<double>(forkClock::now() - forked).count();
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int threads = thread::hardware_concurrency();
+	string configName = "config", prefix;
+	unsigned int seed = 1;
+	int forkTurn = 100, reseeds = 0;
+	int arg = 1;
+
+	while(arg < argc && argv[arg][0] == '-')
+	{
+		if(strcmp(argv[arg],"-c") == 0 && arg+1 < argc)
+		{
+			configName = argv[arg+1];
+			arg += 2;
+		}
+		else if(strcmp(argv[arg],"-s") == 0 && arg+1 < argc)
+		{
+			seed = strtoul(argv[arg+1], NULL, 10);
+			arg += 2;
+		}
+		else if(strcmp(argv[arg],"-t") == 0 && arg+1 < argc)
+		{
+			forkTurn = atoi(argv[arg+1]);
+			arg += 2;
+		}
+		else if(strcmp(argv[arg],"-k") == 0 && arg+1 < argc)
+		{
+			reseeds = atoi(argv[arg+1]);
+			arg += 2;
+		}
+		else if(strcmp(argv[arg],"-j") == 0 && arg+1 < argc)
+		{
+			threads = atoi(argv[arg+1]);
+			arg += 2;
+		}
+		else if(strcmp(argv[arg],"-o") == 0 && arg+1 < argc)
+		{
+			prefix = argv[arg+1];
+			arg += 2;
+		}
+		else if(strcmp(argv[arg],"-h") == 0)
+		{
+			printHelpMessage(cout);
+			return 0;
+		}
+		else
+		{
+			printHelpMessage(cerr);
+			return 1;
+		}
+	}
+	if(arg >= argc || forkTurn < 0)
+	{
+		printHelpMessage(cerr);
+		return 1;
+	}
+	if(threads <= 0) threads = 1;
+
+	mapFile terrain;
+	if(!terrain.load(argv[arg]))
+	{
+		cerr<<"civfork: could not open "<<argv[arg]<<endl;
+		return 1;
+	}
+	ifstream configFile(configName.c_str());
+	if(!configFile.is_open())
+	{
+		cerr<<"civfork: could not open "<<configName<<endl;
+		return 1;
+	}
+	stringstream configText;
+	configText<<configFile.rdbuf();
+	string config = configText.str();
+
+	vector <branchSpec> branches(1);
+	branches[0].name = "base";
+	branches[0].reseed = false;
+	for(arg++; arg < argc; arg++)
+	{
+		branchSpec branch;
+		if(!parseBranch(argv[arg], config, branch))
+		{
+			cerr<<"civfork: bad branch "<<argv[arg]<<", expected key=value[,key=value]... with config keys or seed"<<endl;
+			return 1;
+		}
+		branches.push_back(branch);
+	}
+	for(int k = 1; k <= reseeds; k++)
+	{
+		branchSpec branch;
+		branch.name = "seed=" + to_string(k);
+		branch.reseed = true;
+		branch.seed = k;
+		branches.push_back(branch);
+	}
+	int color[2] = {atoi(configValue(config, "player1_color").c_str()), atoi(configValue(config, "player2_color").c_str())};
+
+	// The run up to the fork, its action list starts every branch's
+	forkClock::time_point start = forkClock::now();
+	stringbuf forkActions;
+	simulate fork(terrain.height, terrain.width, &forkActions);
+	istringstream configIn(config);
+	fork.parseConfig(configIn);
+	fork.setSeed(seed);
+	fork.populateMap(terrain);
+	fork.runTo(forkTurn);
+	fork.finish();
+	if(fork.failed())
+	{
+		return 1;
+	}
+	if(fork.turnsRun() < forkTurn)
+	{
+		cerr<<"civfork: the run ended after turn "<<fork.turnsRun()<<", before the fork at turn "<<forkTurn<<endl;
+		return 1;
+	}
+	string forkLog = forkActions.str();
+	long long forkShared, forkBytes;
+	fork.memoryUse(forkShared, forkBytes);
+	double forkSeconds = chrono::duration<double>(forkClock::now() - start).count();
+
+	vector <branchResult> results(branches.size());
+	workPool pool(threads);
+	start = forkClock::now();
+	pool.run(branches.size(), [&](size_t b, unsigned int)
+	{
+		runBranch(fork, branches[b], color, prefix, forkLog, b, results[b]);
+	});
+	double branchSeconds = chrono::duration<double>(forkClock::now() - start).count();
+
+	// Divergence from base, the first turn whose state hash differs
+	const vector <unsigned long long>& base = results[0].hashes;
+	for(unsigned int b = 0; b < results.size(); b++)
+	{
+		const vector <unsigned long long>& hashes = results[b].hashes;
+		results[b].diverged = -1;
+		for(unsigned int t = 0; t < hashes.size() || t < base.size(); t++)
+		{
+			if(t >= hashes.size() || t >= base.size() || hashes[t] != base[t])
+			{
+				results[b].diverged = forkTurn + 1 + t;
+				break;
+			}
+		}
+	}
+
+	cout<<"branch,changes,turns,stop,diverged,p1_cities,p2_cities,p1_roads,p2_roads,p1_armies,p2_armies,winner,"
+		<<"shared_kb,copied_kb,fork_us,run_s"<<endl;
+	set <unsigned long long> outcomes;
+	int wins[3] = {0, 0, 0};
+	double sharedFraction = 0;
+	int failed = 0;
+	for(unsigned int b = 0; b < results.size(); b++)
+	{
+		branchResult& r = results[b];
+		cout<<b<<",\""<<branches[b].name<<"\","<<r.turns<<","<<r.stop<<","<<r.diverged<<","
+			<<r.cities[0]<<","<<r.cities[1]<<","<<r.roads[0]<<","<<r.roads[1]<<","
+			<<r.armies[0]<<","<<r.armies[1]<<","<<r.winner<<","
+			<<r.shared/1024<<","<<r.owned/1024<<","<<(long long)(r.forkSeconds*1e6)<<","<<r.runSeconds<<"\n";
+		outcomes.insert(r.hash);
+		wins[r.winner]++;
+		if(r.failed) failed++;
+		sharedFraction += r.shared + r.owned > 0 ? (double)r.shared/(r.shared + r.owned) : 0;
+	}
+	cout.flush();
+
+	cerr<<"civfork: "<<results.size()<<" branches from turn "<<forkTurn<<" ("<<forkSeconds<<"s, "
+		<<forkBytes/1024<<" KB of state) run in "<<branchSeconds<<"s on "<<pool.size()<<" threads"<<endl;
+	cerr<<"civfork: "<<outcomes.size()<<" distinct final states; player 1 ahead in "<<wins[1]
+		<<", player 2 in "<<wins[2]<<", even in "<<wins[0]<<endl;
+	cerr<<"civfork: at their end the branches still shared "<<(int)(100*sharedFraction/results.size())
+		<<"% of their map and units with the fork on average"<<endl;
+	if(failed > 0)
+	{
+		cerr<<"civfork: "<<failed<<" branches failed, their rows are not results"<<endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,182 @@
+// civreplay.cpp
+// Rebuilds the state of a run at the end of some of its turns from the
+// action list alone and prints the totals of every color, or with -e
+// every city, road and army. With a logindex index each turn starts at
+// its keyframe, so any turn of a long run comes back in a fraction of
+// the time a replay from the top takes, and several turns are rebuilt
+// in parallel. See replay.h.
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "mapfile.h"
+#include "replay.h"
+using namespace std;
+
+void printHelpMessage(ostream& out)
+{
+	out<<"Usage: civreplay [OPTION]... <action-list> <turn>..."<<endl<<endl;
+	out<<"Options:"<<endl;
+	out<<"-h          display this help message"<<endl;
+	out<<"-j          number of threads (default: all cores)"<<endl;
+	out<<"-m          map of the run, for its size (default: the size in the index)"<<endl;
+	out<<"-e          list the cities, roads and armies instead of the totals"<<endl;
+	out<<"--no-index  replay from the start even if the log is indexed"<<endl;
+	out<<"<action-list>.idx is used when it exists (see logindex), a log without one needs -m."<<endl;
+	out<<"Prints the state at the end of each turn as CSV, timings go to stderr."<<endl;
+}
+
+void printEntities(ostream& out, int turn, const char* kind, const vector<replayUnit>& list)
+{
+	for(unsigned int i = 0; i < list.size(); i++)
+	{
+		out<<turn<<","<<kind<<","<<list[i].x<<","<<list[i].y<<","<<list[i].color<<"\n";
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int threads = 0;
+	string mapName;
+	bool listEntities = false, useIndex = true;
+	int arg = 1;
+
+	while(arg < argc && argv[arg][0] == '-')
+	{
+		if(strcmp(argv[arg],"-j") == 0 && arg+1 < argc)
+		{
+			threads = atoi(argv[arg+1]);
+			arg += 2;
+		}
+		else if(strcmp(argv[arg],"-m") == 0 && arg+1 < argc)
+		{
+			mapName = argv[arg+1];
+			arg += 2;
+		}
+		else if(strcmp(argv[arg],"-e") == 0)
+		{
+			listEntities = true;
+			arg++;
+		}
+		else if(strcmp(argv[arg],"--no-index") == 0)
+		{
+			useIndex = false;
+			arg++;
+		}
+		else if(strcmp(argv[arg],"-h") == 0)
+		{
+			printHelpMessage(cout);
+			return 0;
+		}
+		else
+		{
+			printHelpMessage(cerr);
+			return 1;
+		}
+	}
+	if(argc - arg < 2)
+	{
+		printHelpMessage(cerr);
+		return 1;
+	}
+	string logName = argv[arg++];
+	vector<int> turns;
+	for(; arg < argc; arg++)
+	{
+		turns.push_back(atoi(argv[arg]));
+	}
+
+	chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+	replayEngine engine(threads);
+	if(!engine.open(logName.c_str(), useIndex ? NULL : "/dev/null"))
+	{
+		cerr<<"civreplay: could not open "<<logName<<endl;
+		return 1;
+	}
+
+	// The map's size, else the area the index found the records in
+	int width = engine.width, height = engine.height;
+	if(!mapName.empty())
+	{
+		mapFile terrain;
+		if(!terrain.load(mapName.c_str()))
+		{
+			cerr<<"civreplay: could not open "<<mapName<<endl;
+			return 1;
+		}
+		width = terrain.width;
+		height = terrain.height;
+	}
+	else if(!engine.indexed)
+	{
+		cerr<<"civreplay: "<<logName<<" has no index (see logindex), give the map of the run with -m"<<endl;
+		return 1;
+	}
+
+	// Rebuilt turns come back in any order, printed in the order asked for
+	vector<string> rows(turns.size());
+	vector<char> found(turns.size(), 0);
+	vector<long long> outside(turns.size(), 0);
+	engine.statesAt(turns, width, height, [&](size_t i, const mapState& state)
+	{
+		string row;
+		outside[i] = state.outside;
+		if(listEntities)
+		{
+			vector<replayUnit> cities, roads, armies;
+			replayEngine::entities(state, cities, roads, armies);
+			ostringstream out;
+			printEntities(out, turns[i], "city", cities);
+			printEntities(out, turns[i], "road", roads);
+			printEntities(out, turns[i], "army", armies);
+			row = out.str();
+		}
+		else
+		{
+			for(int c = 0; c < maxPlayerColor; c++)
+			{
+				if(state.cities[c] || state.roads[c] || state.units[c])
+				{
+					row += to_string(turns[i]) + "," + to_string(c) + "," + to_string(state.cities[c]) + ","
+						+ to_string(state.roads[c]) + "," + to_string(state.units[c]) + "\n";
+				}
+			}
+		}
+		rows[i] = row;
+		found[i] = 1;
+	});
+
+	// A map smaller than the run's leaves records out, the totals would be wrong
+	for(unsigned int i = 0; i < turns.size(); i++)
+	{
+		if(outside[i] > 0)
+		{
+			cerr<<"civreplay: up to turn "<<turns[i]<<", "<<outside[i]<<" records lie outside the "
+				<<width<<"x"<<height<<" map"<<endl;
+			return 1;
+		}
+	}
+
+	cout<<(listEntities ? "turn,kind,x,y,color" : "turn,color,cities,roads,armies")<<endl;
+	int missing = 0;
+	for(unsigned int i = 0; i < turns.size(); i++)
+	{
+		if(!found[i])
+		{
+			cerr<<"civreplay: "<<logName<<" has no turn "<<turns[i]<<endl;
+			missing++;
+		}
+		cout<<rows[i];
+	}
+	cout.flush();
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+	cerr<<"civreplay: "<<turns.size() - missing<<" turns, "<<engine.records<<" records, "
+		<<engine.bytes/1e6<<" MB replayed "<<(engine.indexed ? "from keyframes" : "from the start")
+		<<" in "<<seconds<<"s ("<<(seconds > 0 ? engine.records/seconds/1e6 : 0)<<" M records/s)"<<endl;
+	return missing > 0 ? 1 : 0;
+}
@@ -0,0 +1,310 @@
+// civsim.cpp
+// Single process version of simulator.sh. The map is generated in
+// memory and handed to the simulation, which runs on its own thread
+// and streams its action list through a bounded queue to the viewer.
+// The map file and action list are only written when asked for, by
+// threads of their own, so they never hold up the run.
+
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <time.h>
+#include "mapgen.h"
+#include "simulate.h"
+#include "mapview.h"
+#include "actionqueue.h"
+#include "trace.h"
+using namespace std;
+
+typedef chrono::steady_clock civClock;
+
+void printHelpMessage(ostream& out)
+{
+	out<<"Usage: civsim [OPTION]... <integer-x-dimension> <integer-y-dimension>"<<endl<<endl;
+	out<<"Options:"<<endl;
+	out<<"-h          display this help message"<<endl;
+	out<<"-s          map seed, the same seed and config give the same run"<<endl;
+	out<<"-j          threads used by the map generator"<<endl;
+	out<<"-c          stage cache directory of the agent generator"<<endl;
+	out<<"--mode      agent|noise terrain generator (default agent)"<<endl;
+	out<<"-o          also write the map to this file"<<endl;
+	out<<"-f          text|raw|rle format of the -o map (default rle)"<<endl;
+	out<<"-a          also write the action list to this file"<<endl;
+	out<<"-d          milliseconds each turn is shown (default 100)"<<endl;
+	out<<"--fps       turns shown per second, instead of -d"<<endl;
+	out<<"--ansi      draw with ANSI escape codes instead of curses"<<endl;
+	out<<"--headless  no display, print the final totals only"<<endl;
+	out<<"--trace     write a Chrome trace-event timeline of the run to this file"<<endl;
+}
+
+// Runs the simulation on terrain, its action list goes to actions.
+// failed is set if the simulation could not run.
+void runSimulation(const mapFile* terrain, actionQueueBuf* actions, bool* failed)
+{
+	traceThreadName("simulation");
+	simulate sim(terrain->height, terrain->width, actions);
+	ifstream conf("config");
+
+	if(!conf.is_open())
+	{
+		cerr<<"civsim: Could not open configuration file, simulation failed!"<<endl;
+		*failed = true;
+	}
+	else
+	{
+		sim.parseConfig(conf);
+		sim.populateMap(*terrain);
+		sim.runSim();
+		*failed = sim.failed();
+	}
+	actions->close();
+}
+
+// Writes the action list to a file on its way to the viewer. The file
+// is finished even if the viewer quits early.
+void teeActions(boundedQueue<string>* in, boundedQueue<string>* out, ofstream* file)
+{
+	string chunk;
+	bool forward = true;
+	traceThreadName("action writer");
+	while(in->pop(chunk))
+	{
+		{
+			traceSpan span("write actions", "bytes", chunk.size());
+			file->write(chunk.data(), chunk.size());
+		}
+		if(forward) forward = out->push(chunk);
+	}
+	file->flush();
+	out->close();
+}
+
+// Writes the map file while the simulation runs, both only read the terrain
+void saveMap(mapFile* terrain, string name, int format, bool* saved)
+{
+	traceThreadName("map writer");
+	traceSpan span("save map");
+	ofstream out(name.c_str(), ios::binary);
+	*saved = out.is_open() && terrain->save(out, format);
+}
+
+// Offset of the last turn line in text, everything before it are whole turns
+size_t lastTurnLine(const string& text)
+{
+	size_t at = text.size();
+	while(at > 0)
+	{
+		size_t start = text.rfind('\n', at - 1);
+		start = start == string::npos ? 0 : start + 1;
+		if(start < text.size() && text[start] >= '0' && text[start] <= '9')
+		{
+			return start;
+		}
+		if(start == 0) break;
+		at = start - 1;
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int seed = time(NULL);
+	unsigned int threads = 0;
+	const char* cacheDir = NULL;
+	bool noiseMode = false;
+	bool headless = false;
+	bool ansi = false;
+	string mapName, actionName, traceName;
+	int format = mapRle;
+	int delay = 100;
+	int arg = 1;
+
+	while(arg < argc && argv[arg][0] == '-')
+	{
+		string option = argv[arg];
+		if(option == "-h")
+		{
+			printHelpMessage(cout);
+			return 0;
+		}
+		if(option == "--headless" || option == "--ansi")
+		{
+			headless = headless || option == "--headless";
+			ansi = ansi || option == "--ansi";
+			arg++;
+			continue;
+		}
+		if(arg + 1 >= argc)
+		{
+			printHelpMessage(cerr);
+			return 1;
+		}
+		string value = argv[arg+1];
+		if(option == "-s") seed = strtoul(value.c_str(), NULL, 10);
+		else if(option == "-j") threads = atoi(value.c_str());
+		else if(option == "-c") cacheDir = argv[arg+1];
+		else if(option == "-o") mapName = value;
+		else if(option == "-a") actionName = value;
+		else if(option == "-d") delay = atoi(value.c_str());
+		else if(option == "--fps" && atof(value.c_str()) > 0) delay = 1000/atof(value.c_str());
+		else if(option == "--trace") traceName = value;
+		else if(option == "--mode" && (value == "agent" || value == "noise")) noiseMode = value == "noise";
+		else if(option == "-f" && value == "text") format = mapText;
+		else if(option == "-f" && value == "raw") format = mapRaw;
+		else if(option == "-f" && value == "rle") format = mapRle;
+		else
+		{
+			printHelpMessage(cerr);
+			return 1;
+		}
+		arg += 2;
+	}
+
+	if(arg + 2 != argc)
+	{
+		printHelpMessage(cerr);
+		return 1;
+	}
+	unsigned int xSize = atoi(argv[arg]);
+	unsigned int ySize = atoi(argv[arg+1]);
+
+	civClock::time_point start = civClock::now();
+	if(!traceName.empty())
+	{
+		traceStart(traceName.c_str());
+		traceThreadName("viewer");
+	}
+
+	// Generation, the simulation places its cities anywhere on the map
+	// so it can only start once the whole map is done
+	mapSettings settings;
+	mapFile terrain;
+	parseConfig(&settings);
+	mapHeader(settings, xSize, ySize, seed, noiseMode ? mapNoise : mapAgent, terrain);
+	if(noiseMode)
+	{
+		traceSpan span("generate map");
+		noiseCreator map(xSize, ySize);
+		map.setSeed(seed);
+		if(threads > 0) map.setThreads(threads);
+		map.setTerrain(settings.oceanChar, settings.landChar, settings.mountainChar, settings.forestChar);
+		map.setFrequencies(settings.landAgentNum, settings.landFrequency, settings.mountainAgentNum,
+			settings.mountainFrequency, settings.forestAgentNum, settings.forestFrequency);
+		map.createMap();
+		terrain.setRows(map.printMap());
+	}
+	else
+	{
+		traceSpan span("generate map");
+		terrainCreator map(xSize, ySize);
+		vector<terrainStage> stages;
+		map.setSeed(seed);
+		if(threads > 0) map.setThreads(threads);
+		agentStages(settings, stages);
+		map.runStages(stages, cacheDir);
+		terrain.setRows(map.printMap());
+	}
+	double mapSeconds = chrono::duration<double>(civClock::now() - start).count();
+
+	// Simulation -> (action list file) -> viewer
+	boundedQueue<string> simQueue, viewQueue;
+	boundedQueue<string>* actions = &simQueue;
+	actionQueueBuf simOutput(simQueue);
+	ofstream actionFile;
+	vector<thread> workers;
+	bool mapSaved = true;
+
+	if(!mapName.empty())
+	{
+		workers.push_back(thread(saveMap, &terrain, mapName, format, &mapSaved));
+	}
+	if(!actionName.empty())
+	{
+		actionFile.open(actionName.c_str());
+		if(!actionFile.is_open())
+		{
+			cerr<<"civsim: could not write "<<actionName<<endl;
+			return 1;
+		}
+		workers.push_back(thread(teeActions, &simQueue, &viewQueue, &actionFile));
+		actions = &viewQueue;
+	}
+	bool simFailed = false;
+	workers.push_back(thread(runSimulation, &terrain, &simOutput, &simFailed));
+
+	// The viewer replays whole turns as they arrive
+	mapState state(terrain.width, terrain.height);
+	string pending, chunk;
+	long long destroyed;
+	int turns = 0;
+	bool running = true;
+	bool quit = false;
+	double firstSeconds = 0;
+
+	// Turns are due on a fixed grid, drawing time counts against the delay
+	civClock::time_point nextFrame = civClock::now();
+	if(!headless) startView(terrain, ansi);
+	while(running && !quit)
+	{
+		running = actions->pop(chunk);
+		if(running) pending += chunk;
+		size_t complete = running ? lastTurnLine(pending) : pending.size();
+		actionScanner scan(pending.data(), pending.data() + complete);
+
+		while(!quit)
+		{
+			destroyed = state.destroyed;
+			int turn = replayTurn(scan, state);
+			if(turn < 0) break;
+			if(turns++ == 0) firstSeconds = chrono::duration<double>(civClock::now() - start).count();
+			if(headless) continue;
+
+			{
+				traceSpan span("frame", "turn", turn);
+				drawFrame(terrain, state, turn);
+				showStatus("[q] quit");
+			}
+			if(state.destroyed != destroyed) viewBeep();
+			nextFrame += chrono::milliseconds(delay);
+			civClock::time_point now = civClock::now();
+			if(nextFrame < now) nextFrame = now;
+			if(waitKey(chrono::duration_cast<chrono::milliseconds>(nextFrame - now).count()) == 'q') quit = true;
+		}
+		pending.erase(0, complete);
+	}
+	// Producers blocked on a queue the viewer left are let go
+	actions->close();
+	double lastSeconds = chrono::duration<double>(civClock::now() - start).count();
+
+	if(!headless)
+	{
+		if(!quit)
+		{
+			showStatus("  run over, press a key");
+			waitKey(-1);
+		}
+		endView(state);
+	}
+	else
+	{
+		readDisplayConfig(terrain);
+		printTotals(state);
+	}
+
+	for(unsigned int t = 0; t < workers.size(); t++)
+	{
+		workers[t].join();
+	}
+	if(!mapSaved)
+	{
+		cerr<<"civsim: could not write "<<mapName<<endl;
+	}
+	if(!traceStop())
+	{
+		cerr<<"civsim: could not write "<<traceName<<endl;
+	}
+
+	cerr<<"civsim: map "<<mapSeconds<<"s, first turn "<<firstSeconds<<"s, "<<turns<<" turns shown by "<<lastSeconds<<"s"<<endl;
+	return simFailed ? 1 : 0;
+}
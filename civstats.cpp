@@ -0,0 +1,498 @@
+// civstats.cpp
+// Scans an action list and prints per turn statistics for every player
+// (cities, roads, armies, captures, kills, moves) as CSV followed by a
+// short summary of the run.
+//
+// The log is cut into turn aligned blocks which are scanned in parallel.
+// A block does not know who owned what when it started, so cells it has
+// not touched yet are tracked symbolically ("whatever cell k held at the
+// start of the block") and the events that depend on them are kept aside.
+// Blocks are then merged in order, resolving those events against the
+// state left by the previous blocks.
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <unordered_map>
+#include "actionlog.h"
+using namespace std;
+
+#define maxColor 16
+
+//Counters kept per turn and per player color
+#define citiesStat 0
+#define roadsStat 1
+#define armiesStat 2
+#define capturesStat 3
+#define killsStat 4
+#define movesStat 5
+#define lossesStat 6
+#define numStats 7
+
+//Content of a cell. type is 'C', 'R', 'U' or 0 for nothing.
+//A type of '?' or a color of -1 means "the same as cell ref when the
+//block started".
+struct cellValue
+{
+	char type;
+	int color;
+	long long ref;
+};
+
+//An event whose owner was not known inside its block
+struct pendingEvent
+{
+	int turn;
+	char action;
+	int layer; //0 city/road layer, 1 unit layer
+	int color; //New color of a color record
+	cellValue old; //Cell before the event
+};
+
+//Counters of one turn, the first three are changes during the block
+struct turnStats
+{
+	int stat[numStats][maxColor];
+};
+
+//Everything one block learned
+struct blockResult
+{
+	const char* begin;
+	const char* end;
+	int firstTurn;
+	long long records;
+	vector <turnStats> turns;
+	vector <pendingEvent> pending;
+	unordered_map <long long, cellValue> cells[2]; //Final city/road and unit layers
+	vector <int> created; //Colors in the order they first create something
+};
+
+//Occupied cells of one layer once the blocks before have been merged
+typedef unordered_map <long long, cellValue> layerState;
+
+static long long cellKey(int x, int y)
+{
+	return ((long long)y << 32) | (unsigned int)x;
+}
+
+static bool known(const cellValue& v)
+{
+	return v.type != '?' && v.color >= 0;
+}
+
+static int statOfType(char type)
+{
+	if(type == 'C') return citiesStat;
+	if(type == 'R') return roadsStat;
+	return armiesStat;
+}
+
+static void add(turnStats& t, int stat, int color, int n)
+{
+	if(color >= 0 && color < maxColor)
+	{
+		t.stat[stat][color] += n;
+	}
+}
+
+//Value of a cell as seen from inside a block
+static cellValue lookup(blockResult& block, int layer, long long key)
+{
+	unordered_map <long long, cellValue>::iterator it = block.cells[layer].find(key);
+	if(it != block.cells[layer].end())
+	{
+		return it->second;
+	}
+	cellValue start;
+	start.type = '?';
+	start.color = -1;
+	start.ref = key;
+	return start;
+}
+
+//Value of a symbolic cell once the state at the start of its block is known
+static cellValue resolve(const cellValue& v, layerState& start)
+{
+	cellValue out = v;
+	if(!known(v))
+	{
+		layerState::iterator it = start.find(v.ref);
+		cellValue empty = {0, 0, -1};
+		const cellValue& s = it == start.end() ? empty : it->second;
+		if(out.type == '?') out.type = s.type;
+		if(out.color < 0) out.color = s.color;
+	}
+	out.ref = -1;
+	return out;
+}
+
+//Applies an event whose old cell value is known
+static void countEvent(turnStats& t, char action, int color, const cellValue& old)
+{
+	switch(action)
+	{
+		case colorRecord:
+		if(old.type == 0) break;
+		add(t, statOfType(old.type), old.color, -1);
+		add(t, statOfType(old.type), color, 1);
+		add(t, capturesStat, color, 1);
+		break;
+
+		case destroyRecord:
+		if(old.type == 0) break;
+		add(t, statOfType(old.type), old.color, -1);
+		if(old.type == 'U') add(t, lossesStat, old.color, 1);
+		break;
+
+		case moveRecord:
+		if(old.type == 0) break;
+		add(t, movesStat, old.color, 1);
+		break;
+	}
+}
+
+//Scans one block with no knowledge of the blocks before it
+static void scanBlock(blockResult* block)
+{
+	actionScanner scan(block->begin, block->end);
+	actionRecord rec;
+	turnStats empty;
+	turnStats* current = 0;
+	int turn = -1;
+	bool seen[maxColor];
+
+	memset(&empty, 0, sizeof(empty));
+	memset(seen, 0, sizeof(seen));
+	block->firstTurn = -1;
+	block->records = 0;
+	block->cells[0].reserve(1 << 12);
+	block->cells[1].reserve(1 << 12);
+
+	while(scan.next(rec))
+	{
+		block->records++;
+		if(rec.action == turnRecord)
+		{
+			if(block->firstTurn < 0) block->firstTurn = rec.turn;
+			turn = rec.turn;
+			if(turn - block->firstTurn >= (int)block->turns.size())
+			{
+				block->turns.resize(turn - block->firstTurn + 1, empty);
+			}
+			current = &block->turns[turn - block->firstTurn];
+			continue;
+		}
+		if(!current || rec.action == hashRecord || (rec.action != moveRecord && (rec.layer < 1 || rec.layer > 2)))
+		{
+			continue;
+		}
+
+		int layer = rec.action == moveRecord ? 1 : rec.layer - 1;
+		long long key = cellKey(rec.x, rec.y);
+		cellValue old = lookup(*block, layer, key);
+		cellValue now;
+		pendingEvent event;
+
+		switch(rec.action)
+		{
+			case createRecord:
+			now.type = layer == 1 ? 'U' : (rec.object == cityObject ? 'C' : 'R');
+			now.color = rec.color;
+			now.ref = -1;
+			add(*current, statOfType(now.type), rec.color, 1);
+			if(rec.color >= 0 && rec.color < maxColor && !seen[rec.color])
+			{
+				seen[rec.color] = true;
+				block->created.push_back(rec.color);
+			}
+			block->cells[layer][key] = now;
+			break;
+
+			case colorRecord:
+			now = old;
+			now.color = rec.color;
+			block->cells[layer][key] = now;
+			break;
+
+			case destroyRecord:
+			now.type = 0;
+			now.color = 0;
+			now.ref = -1;
+			block->cells[layer][key] = now;
+			break;
+
+			case moveRecord:
+			now.type = 0;
+			now.color = 0;
+			now.ref = -1;
+			block->cells[layer][key] = now;
+			block->cells[layer][cellKey(rec.newX, rec.newY)] = old;
+			break;
+		}
+
+		if(rec.action != createRecord)
+		{
+			if(known(old))
+			{
+				countEvent(*current, rec.action, rec.color, old);
+			}
+			else
+			{
+				event.turn = turn;
+				event.action = rec.action;
+				event.layer = layer;
+				event.color = rec.color;
+				event.old = old;
+				block->pending.push_back(event);
+			}
+		}
+	}
+}
+
+//Cuts the log into at most count pieces that each start on a turn line
+static vector <blockResult> splitLog(actionLog& log, int count)
+{
+	vector <blockResult> blocks;
+	const char* start = log.begin();
+	long long step = log.size() / count + 1;
+
+	while(start < log.end())
+	{
+		const char* cut = start + step < log.end() ? start + step : log.end();
+		// Moves the cut forward to the beginning of the next turn line
+		while(cut < log.end())
+		{
+			const char* newline = (const char*)memchr(cut, '\n', log.end() - cut);
+			if(!newline)
+			{
+				cut = log.end();
+				break;
+			}
+			cut = newline + 1;
+			if(cut < log.end() && *cut >= '0' && *cut <= '9') break;
+		}
+		blockResult block;
+		block.begin = start;
+		block.end = cut;
+		blocks.push_back(block);
+		start = cut;
+	}
+	return blocks;
+}
+
+void printHelpMessage(ostream& out)
+{
+	out<<"Usage: civstats [-j <threads>] [-o <csv-file>] [action-list]"<<endl<<endl;
+	out<<"Options:"<<endl;
+	out<<"-h     display this help message"<<endl;
+	out<<"-j     number of scanning threads (default: all cores)"<<endl;
+	out<<"-o     write the per turn CSV to a file instead of stdout"<<endl;
+	out<<"The action list defaults to action_list.txt, the summary goes to stderr"<<endl;
+}
+
+int main(int argc, char* argv[])
+{
+	int threads = thread::hardware_concurrency();
+	string logName = "action_list.txt";
+	string csvName;
+	int arg = 1;
+
+	while(arg < argc && argv[arg][0] == '-')
+	{
+		if(strcmp(argv[arg],"-j") == 0 && arg+1 < argc)
+		{
+			threads = atoi(argv[arg+1]);
+			arg += 2;
+		}
+		else if(strcmp(argv[arg],"-o") == 0 && arg+1 < argc)
+		{
+			csvName = argv[arg+1];
+			arg += 2;
+		}
+		else if(strcmp(argv[arg],"-h") == 0)
+		{
+			printHelpMessage(cout);
+			return 0;
+		}
+		else
+		{
+			printHelpMessage(cerr);
+			return 1;
+		}
+	}
+	if(arg < argc) logName = argv[arg];
+	if(threads <= 0) threads = 1;
+
+	chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+
+	actionLog log;
+	if(!log.open(logName.c_str()))
+	{
+		cerr<<"civstats: could not open "<<logName<<endl;
+		return 1;
+	}
+
+	// Scan: every block on its own thread, a few blocks per thread
+	// so a slow block does not hold everything up.
+	vector <blockResult> blocks = splitLog(log, threads*4);
+	vector <thread> workers;
+	for(int i = 0; i < threads; i++)
+	{
+		workers.push_back(thread([&blocks, i, threads]()
+		{
+			for(unsigned int b = i; b < blocks.size(); b += threads)
+			{
+				scanBlock(&blocks[b]);
+			}
+		}));
+	}
+	for(unsigned int i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+
+	// Merge: blocks in order, resolving what each one could not know
+	layerState state[2];
+	vector <turnStats> series;
+	vector <int> players;
+	bool isPlayer[maxColor];
+	long long records = 0;
+	turnStats empty;
+	memset(&empty, 0, sizeof(empty));
+	memset(isPlayer, 0, sizeof(isPlayer));
+
+	for(unsigned int b = 0; b < blocks.size(); b++)
+	{
+		blockResult& block = blocks[b];
+		records += block.records;
+		for(unsigned int i = 0; i < block.created.size(); i++)
+		{
+			if(!isPlayer[block.created[i]])
+			{
+				isPlayer[block.created[i]] = true;
+				players.push_back(block.created[i]);
+			}
+		}
+		if(block.firstTurn < 0) continue;
+
+		for(unsigned int i = 0; i < block.pending.size(); i++)
+		{
+			pendingEvent& event = block.pending[i];
+			cellValue old = resolve(event.old, state[event.layer]);
+			countEvent(block.turns[event.turn - block.firstTurn], event.action, event.color, old);
+		}
+
+		for(int layer = 0; layer < 2; layer++)
+		{
+			vector < pair <long long, cellValue> > changes;
+			unordered_map <long long, cellValue>::iterator it;
+			for(it = block.cells[layer].begin(); it != block.cells[layer].end(); ++it)
+			{
+				changes.push_back(make_pair(it->first, resolve(it->second, state[layer])));
+			}
+			for(unsigned int i = 0; i < changes.size(); i++)
+			{
+				if(changes[i].second.type == 0) state[layer].erase(changes[i].first);
+				else state[layer][changes[i].first] = changes[i].second;
+			}
+		}
+
+		// Changes become totals by carrying the previous turn forward
+		for(unsigned int t = 0; t < block.turns.size(); t++)
+		{
+			int turn = block.firstTurn + t;
+			if(turn >= (int)series.size()) series.resize(turn + 1, empty);
+			turnStats& out = series[turn];
+			for(int s = 0; s < numStats; s++)
+			{
+				for(int c = 0; c < maxColor; c++)
+				{
+					int carried = s <= armiesStat && turn > 0 ? series[turn-1].stat[s][c] : 0;
+					out.stat[s][c] = carried + block.turns[t].stat[s][c];
+				}
+			}
+		}
+	}
+
+	// With two players every army lost is a kill for the other one
+	if(players.size() == 2)
+	{
+		for(unsigned int t = 0; t < series.size(); t++)
+		{
+			series[t].stat[killsStat][players[0]] = series[t].stat[lossesStat][players[1]];
+			series[t].stat[killsStat][players[1]] = series[t].stat[lossesStat][players[0]];
+		}
+	}
+
+	ofstream csvFile;
+	if(!csvName.empty())
+	{
+		csvFile.open(csvName.c_str());
+		if(!csvFile.is_open())
+		{
+			cerr<<"civstats: could not open "<<csvName<<endl;
+			return 1;
+		}
+	}
+	ostream& csv = csvName.empty() ? cout : csvFile;
+
+	int firstContact = -1;
+	int peakArmies[maxColor], peakTurn[maxColor];
+	long long totals[numStats][maxColor];
+	memset(peakArmies, 0, sizeof(peakArmies));
+	memset(peakTurn, 0, sizeof(peakTurn));
+	memset(totals, 0, sizeof(totals));
+
+	csv<<"turn,player,color,cities,roads,armies,captures,kills,moves"<<endl;
+	for(unsigned int t = 0; t < series.size(); t++)
+	{
+		for(unsigned int p = 0; p < players.size(); p++)
+		{
+			int c = players[p];
+			int* stat[numStats];
+			for(int s = 0; s < numStats; s++)
+			{
+				stat[s] = &series[t].stat[s][c];
+				if(s > armiesStat) totals[s][c] += *stat[s];
+			}
+			csv<<t<<","<<p+1<<","<<c<<","<<*stat[citiesStat]<<","<<*stat[roadsStat]<<","
+				<<*stat[armiesStat]<<","<<*stat[capturesStat]<<","<<*stat[killsStat]<<","
+				<<*stat[movesStat]<<"\n";
+
+			if(*stat[armiesStat] > peakArmies[c])
+			{
+				peakArmies[c] = *stat[armiesStat];
+				peakTurn[c] = t;
+			}
+			if(firstContact < 0 && (*stat[capturesStat] > 0 || *stat[lossesStat] > 0))
+			{
+				firstContact = t;
+			}
+		}
+	}
+	csv.flush();
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+	cerr<<"civstats: "<<series.size()<<" turns, "<<records<<" records, "<<blocks.size()
+		<<" blocks on "<<threads<<" threads in "<<seconds<<"s ("
+		<<(seconds > 0 ? log.size()/seconds/1e6 : 0)<<" MB/s)"<<endl;
+	if(firstContact >= 0) cerr<<"first contact: turn "<<firstContact<<endl;
+	else cerr<<"first contact: never"<<endl;
+	for(unsigned int p = 0; p < players.size(); p++)
+	{
+		int c = players[p];
+		turnStats& last = series.back();
+		cerr<<"player "<<p+1<<" (color "<<c<<"): cities "<<last.stat[citiesStat][c]
+			<<" roads "<<last.stat[roadsStat][c]<<" armies "<<last.stat[armiesStat][c]
+			<<", peak armies "<<peakArmies[c]<<" on turn "<<peakTurn[c]
+			<<", captures "<<totals[capturesStat][c]<<" kills "<<totals[killsStat][c]
+			<<" losses "<<totals[lossesStat][c]<<" moves "<<totals[movesStat][c]<<endl;
+	}
+	return 0;
+}
@@ -0,0 +1,534 @@
+// civsweep.cpp
+// Parameter sweep runner. Reads a sweep spec, runs every trial (one
+// map + simulation with an edited copy of the config) in this process
+// on a work-stealing pool and writes one row of outcome metrics and
+// runtimes per trial. The config file on disk is only read.
+//
+// Spec file, one statement per line, # starts a comment:
+//   size <x> <y>                  map size (default 100 50)
+//   mode agent|noise              terrain generator (default agent)
+//   seeds <a> <b> ... | <a>-<b>   map and simulation seeds (default 1)
+//   grid <key> <v1> <v2> ...      every value is tried
+//   random <key> <min> <max>      a random integer in [min, max]
+//   samples <n>                   random draws per grid point (default 1)
+// Keys are config keys, e.g. maximum_armies or landFrequency.
+// Trials that only differ in simulation keys share one generated map.
+// The map is populated into a simulation once, and every trial runs a
+// copy-on-write fork of it whose memory comes from the arena of its
+// worker (see arena.h), so a trial's setup is a small fraction of its run.
+
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <future>
+#include <map>
+#include <memory>
+#include <sstream>
+#include "mapgen.h"
+#include "simulate.h"
+#include "mapstate.h"
+#include "arena.h"
+#include "workpool.h"
+#include "trace.h"
+using namespace std;
+
+typedef chrono::steady_clock sweepClock;
+
+// Config keys read by the map generator, a change in any of them needs a new map
+const char* generatorKeys[] = {"plains_character", "mountain_character", "forest_character", "ocean_character",
+	"landFrequency", "landAgentNum", "mountainFrequency", "mountainAgentNum", "forestFrequency", "forestAgentNum"};
+
+struct sweepSpec
+{
+	unsigned int x, y;
+	bool noiseMode;
+	vector <unsigned int> seeds;
+	vector <string> keys;		//Grid keys, then random keys
+	vector < vector <string> > grid;	//Values of each grid key
+	vector <long long> low, high;	//Range of each random key
+	int samples;
+};
+
+struct sweepTrial
+{
+	unsigned int seed;
+	vector <string> values;		//One per spec key
+	string config;			//Edited config text
+	string mapKey;			//Seed and generator settings
+};
+
+struct trialResult
+{
+	int turns;
+	int stop;	//stopAllTurns or the stop rule that ended the run
+	int cities[2], roads[2], armies[2];
+	long long destroyed;
+	int winner;
+	bool failed;	//The simulation rejected the config of the trial
+	bool mapReused;
+	double mapSeconds;
+	double setupSeconds;	//Fork of the populated map, config and starting cities
+	double simSeconds;
+};
+
+// A generated map and a simulation of it populated but not started
+struct preparedMap
+{
+	mapFile terrain;
+	stringbuf actions;	//Action list of start, which runs no turns
+	unique_ptr <simulate> start;
+};
+
+typedef shared_future< shared_ptr <preparedMap> > mapFuture;
+
+// Generated maps shared by the trials, dropped after their last trial
+struct mapCache
+{
+	mutex guard;
+	map <string, mapFuture> maps;
+	map <string, int> uses;
+};
+
+void printHelpMessage(ostream& out)
+{
+	out<<"Usage: civsweep [-j threads] [-o results] <spec-file>"<<endl<<endl;
+	out<<"Options:"<<endl;
+	out<<"-h     display this help message"<<endl;
+	out<<"-j     worker threads (default all cores)"<<endl;
+	out<<"-o     results file (default stdout), one CSV row per trial"<<endl;
+	out<<"--trace file   write a Chrome trace-event timeline of the trials"<<endl;
+	out<<"See the top of civsweep.cpp for the spec format."<<endl;
+}
+
+// Same mixing as terrainCreator::cellRandom, used for the random keys
+unsigned long long sweepRandom(unsigned long long a, unsigned long long b)
+{
+	unsigned long long z = a*0x9E3779B97F4A7C15ULL + b + 0x632BE59BD9B4E019ULL;
+	z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+// True if a config line sets key
+bool setsKey(const string& line, const string& key)
+{
+	if(line.compare(0, key.size(), key) != 0) return false;
+	return line.size() == key.size() || line[key.size()] == ' ' || line[key.size()] == '=';
+}
+
+// Value between the quotes of the line setting key, empty if there is none
+string configValue(const string& config, const string& key)
+{
+	istringstream in(config);
+	string line;
+	while(getline(in, line))
+	{
+		if(!setsKey(line, key)) continue;
+		size_t first = line.find('\'');
+		size_t last = line.rfind('\'');
+		if(first != string::npos && last > first) return line.substr(first + 1, last - first - 1);
+	}
+	return "";
+}
+
+// Copy of config with the lines of keys set to values
+string editConfig(const string& config, const vector <string>& keys, const vector <string>& values)
+{
+	istringstream in(config);
+	string line, out;
+	while(getline(in, line))
+	{
+		for(unsigned int k = 0; k < keys.size(); k++)
+		{
+			if(setsKey(line, keys[k])) line = keys[k] + " = '" + values[k] + "'";
+		}
+		out += line + "\n";
+	}
+	return out;
+}
+
+bool readSpec(const char* name, const string& config, sweepSpec& spec)
+{
+	ifstream in(name);
+	string line, word;
+	int lineNumber = 0;
+
+	spec.x = 100;
+	spec.y = 50;
+	spec.noiseMode = false;
+	spec.samples = 1;
+	if(!in.is_open())
+	{
+		cerr<<"civsweep: could not open "<<name<<endl;
+		return false;
+	}
+
+	vector <string> gridKeys, randomKeys;
+	while(getline(in, line))
+	{
+		lineNumber++;
+		if(line.find('#') != string::npos) line.erase(line.find('#'));
+		istringstream words(line);
+		vector <string> w;
+		while(words >> word) w.push_back(word);
+		if(w.empty()) continue;
+
+		bool good = true;
+		if(w[0] == "size" && w.size() == 3)
+		{
+			spec.x = atoi(w[1].c_str());
+			spec.y = atoi(w[2].c_str());
+		}
+		else if(w[0] == "mode" && w.size() == 2 && (w[1] == "agent" || w[1] == "noise"))
+		{
+			spec.noiseMode = w[1] == "noise";
+		}
+		else if(w[0] == "samples" && w.size() == 2)
+		{
+			spec.samples = atoi(w[1].c_str());
+		}
+		else if(w[0] == "seeds" && w.size() >= 2)
+		{
+			spec.seeds.clear();
+			for(unsigned int i = 1; i < w.size(); i++)
+			{
+				size_t dash = w[i].find('-');
+				unsigned int first = strtoul(w[i].c_str(), NULL, 10);
+				unsigned int last = dash == string::npos ? first : strtoul(w[i].c_str() + dash + 1, NULL, 10);
+				for(unsigned int s = first; s <= last; s++) spec.seeds.push_back(s);
+			}
+		}
+		else if(w[0] == "grid" && w.size() >= 3)
+		{
+			gridKeys.push_back(w[1]);
+			spec.grid.push_back(vector <string>(w.begin() + 2, w.end()));
+		}
+		else if(w[0] == "random" && w.size() == 4)
+		{
+			randomKeys.push_back(w[1]);
+			spec.low.push_back(atoll(w[2].c_str()));
+			spec.high.push_back(atoll(w[3].c_str()));
+			good = spec.low.back() <= spec.high.back();
+		}
+		else good = false;
+
+		if(!good || ((w[0] == "grid" || w[0] == "random") && configValue(config, w[1]).empty()))
+		{
+			cerr<<"civsweep: "<<name<<":"<<lineNumber<<": bad spec line or unknown config key"<<endl;
+			return false;
+		}
+	}
+
+	if(spec.seeds.empty()) spec.seeds.push_back(1);
+	if(spec.samples < 1 || spec.x == 0 || spec.y == 0)
+	{
+		cerr<<"civsweep: "<<name<<": samples and size must be positive"<<endl;
+		return false;
+	}
+	spec.keys = gridKeys;
+	spec.keys.insert(spec.keys.end(), randomKeys.begin(), randomKeys.end());
+	return true;
+}
+
+// Every seed x grid point x sample. Seeds vary slowest and generator
+// keys come before simulation keys in the grid, so the trials sharing a
+// map sit next to each other and land on the same worker.
+void buildTrials(const sweepSpec& spec, const string& config, vector <sweepTrial>& trials)
+{
+	size_t points = 1;
+	for(unsigned int g = 0; g < spec.grid.size(); g++) points *= spec.grid[g].size();
+
+	for(unsigned int s = 0; s < spec.seeds.size(); s++)
+	{
+		for(size_t p = 0; p < points; p++)
+		{
+			for(int r = 0; r < spec.samples; r++)
+			{
+				sweepTrial trial;
+				trial.seed = spec.seeds[s];
+				size_t rest = p;
+				for(int g = spec.grid.size() - 1; g >= 0; g--)
+				{
+					trial.values.insert(trial.values.begin(), spec.grid[g][rest % spec.grid[g].size()]);
+					rest /= spec.grid[g].size();
+				}
+				for(unsigned int k = 0; k < spec.low.size(); k++)
+				{
+					unsigned long long span = spec.high[k] - spec.low[k] + 1;
+					unsigned long long draw = sweepRandom(trials.size(), k) % span;
+					ostringstream value;
+					value<<spec.low[k] + (long long)draw;
+					trial.values.push_back(value.str());
+				}
+				trial.config = editConfig(config, spec.keys, trial.values);
+
+				ostringstream key;
+				key<<trial.seed;
+				for(unsigned int k = 0; k < sizeof(generatorKeys)/sizeof(generatorKeys[0]); k++)
+				{
+					key<<" "<<configValue(trial.config, generatorKeys[k]);
+				}
+				// populateMap lays the map out in memory once for all its trials
+				key<<" "<<configValue(trial.config, "grid_layout");
+				// The map's simulation takes the config of its first trial and
+				// forks keep its failure, a rejected neighbours value fails only
+				// the trials that have it
+				key<<" "<<configValue(trial.config, "neighbours");
+				trial.mapKey = key.str();
+				trials.push_back(trial);
+			}
+		}
+	}
+}
+
+// The map of a trial, generated by the first trial that asks for it.
+// Trials asking while it is made wait for it instead of making another.
+shared_ptr <preparedMap> trialMap(mapCache& cache, const sweepSpec& spec, const sweepTrial& trial, bool& reused)
+{
+	promise < shared_ptr <preparedMap> > made;
+	unique_lock <mutex> lock(cache.guard);
+	map <string, mapFuture>::iterator found = cache.maps.find(trial.mapKey);
+	if(found != cache.maps.end())
+	{
+		mapFuture waiting = found->second;
+		lock.unlock();
+		reused = true;
+		traceSpan span("wait map");
+		return waiting.get();
+	}
+	cache.maps[trial.mapKey] = made.get_future().share();
+	lock.unlock();
+	reused = false;
+
+	traceSpan span("generate map");
+	mapSettings settings;
+	istringstream config(trial.config);
+	shared_ptr <preparedMap> prepared(new preparedMap);
+	mapFile* terrain = &prepared->terrain;
+	parseConfig(&settings, config);
+	mapHeader(settings, spec.x, spec.y, trial.seed, spec.noiseMode ? mapNoise : mapAgent, *terrain);
+	if(spec.noiseMode)
+	{
+		noiseCreator map(spec.x, spec.y);
+		map.setSeed(trial.seed);
+		map.setThreads(1);
+		map.setTerrain(settings.oceanChar, settings.landChar, settings.mountainChar, settings.forestChar);
+		map.setFrequencies(settings.landAgentNum, settings.landFrequency, settings.mountainAgentNum,
+			settings.mountainFrequency, settings.forestAgentNum, settings.forestFrequency);
+		map.createMap();
+		terrain->setRows(map.printMap());
+	}
+	else
+	{
+		terrainCreator map(spec.x, spec.y);
+		vector <terrainStage> stages;
+		map.setSeed(trial.seed);
+		map.setThreads(1);
+		agentStages(settings, stages);
+		map.runStages(stages, NULL);
+		terrain->setRows(map.printMap());
+	}
+
+	istringstream simConfig(trial.config);
+	prepared->start.reset(new simulate(terrain->height, terrain->width, &prepared->actions));
+	prepared->start->parseConfig(simConfig);
+	prepared->start->populateMap(*terrain);
+	prepared->start->finish();
+	made.set_value(prepared);
+	return prepared;
+}
+
+void releaseMap(mapCache& cache, const string& key)
+{
+	lock_guard <mutex> lock(cache.guard);
+	if(--cache.uses[key] == 0)
+	{
+		cache.maps.erase(key);
+	}
+}
+
+void runTrial(const sweepSpec& spec, const sweepTrial& trial, mapCache& cache, gameArena& arena, trialResult& result)
+{
+	sweepClock::time_point start = sweepClock::now();
+	shared_ptr <preparedMap> prepared = trialMap(cache, spec, trial, result.mapReused);
+	const mapFile* terrain = &prepared->terrain;
+	sweepClock::time_point mapDone = sweepClock::now();
+
+	// The action list stays in memory and is replayed for the metrics.
+	// The last trial of this worker is gone, its arena memory is reused.
+	stringbuf actions;
+	arena.rewind();
+	{
+		traceSpan span("simulate");
+		simulate sim(*prepared->start, &actions, &arena);
+		istringstream config(trial.config);
+		sim.parseConfig(config);
+		sim.setSeed(trial.seed);
+		sim.runTo(0);
+		result.setupSeconds = chrono::duration<double>(sweepClock::now() - mapDone).count();
+		sim.runSim();
+		result.stop = sim.stopReason();
+		result.failed = sim.failed();
+	}
+	releaseMap(cache, trial.mapKey);
+
+	traceSpan span("replay");
+	string text = actions.str();
+	actionScanner scan(text.data(), text.data() + text.size());
+	mapState state(terrain->width, terrain->height);
+	int turns = -1;
+	while(replayTurn(scan, state) >= 0) turns++;
+
+	int color[2] = {atoi(configValue(trial.config, "player1_color").c_str()), atoi(configValue(trial.config, "player2_color").c_str())};
+	for(int p = 0; p < 2; p++)
+	{
+		int c = color[p] >= 0 && color[p] < maxPlayerColor ? color[p] : 0;
+		result.cities[p] = state.cities[c];
+		result.roads[p] = state.roads[c];
+		result.armies[p] = state.units[c];
+	}
+	result.turns = turns < 0 ? 0 : turns;
+	result.destroyed = state.destroyed;
+	result.winner = 0;
+	if(result.cities[0] != result.cities[1]) result.winner = result.cities[0] > result.cities[1] ? 1 : 2;
+	else if(result.armies[0] != result.armies[1]) result.winner = result.armies[0] > result.armies[1] ? 1 : 2;
+	result.mapSeconds = chrono::duration<double>(mapDone - start).count();
+	result.simSeconds = chrono::duration<double>(sweepClock::now() - mapDone).count();
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int threads = thread::hardware_concurrency();
+	string outName;
+	const char* traceName = NULL;
+	int arg = 1;
+
+	while(arg < argc && argv[arg][0] == '-')
+	{
+		if(strcmp(argv[arg],"-j") == 0 && arg+1 < argc)
+		{
+			threads = atoi(argv[arg+1]);
+			arg += 2;
+		}
+		else if(strcmp(argv[arg],"-o") == 0 && arg+1 < argc)
+		{
+			outName = argv[arg+1];
+			arg += 2;
+		}
+		else if(strcmp(argv[arg],"--trace") == 0 && arg+1 < argc)
+		{
+			traceName = argv[arg+1];
+			arg += 2;
+		}
+		else if(strcmp(argv[arg],"-h") == 0)
+		{
+			printHelpMessage(cout);
+			return 0;
+		}
+		else
+		{
+			printHelpMessage(cerr);
+			return 1;
+		}
+	}
+	if(arg + 1 != argc)
+	{
+		printHelpMessage(cerr);
+		return 1;
+	}
+
+	ifstream configFile("./config");
+	if(!configFile.is_open())
+	{
+		cerr<<"civsweep: could not open config"<<endl;
+		return 1;
+	}
+	stringstream configText;
+	configText<<configFile.rdbuf();
+	string config = configText.str();
+
+	sweepSpec spec;
+	vector <sweepTrial> trials;
+	if(!readSpec(argv[arg], config, spec))
+	{
+		return 1;
+	}
+	buildTrials(spec, config, trials);
+
+	mapCache cache;
+	for(size_t t = 0; t < trials.size(); t++)
+	{
+		cache.uses[trials[t].mapKey]++;
+	}
+
+	vector <trialResult> results(trials.size());
+	workPool pool(threads);
+	vector < unique_ptr <gameArena> > arenas(pool.size());
+	for(unsigned int w = 0; w < arenas.size(); w++)
+	{
+		arenas[w].reset(new gameArena());
+	}
+	sweepClock::time_point start = sweepClock::now();
+	if(traceName) traceStart(traceName);
+	pool.run(trials.size(), [&](size_t t, unsigned int worker)
+	{
+		traceThreadName("sweep worker");
+		traceSpan span("trial", "trial", t);
+		runTrial(spec, trials[t], cache, *arenas[worker], results[t]);
+	});
+	if(!traceStop())
+	{
+		cerr<<"civsweep: could not write "<<traceName<<endl;
+	}
+	double seconds = chrono::duration<double>(sweepClock::now() - start).count();
+
+	ofstream outFile;
+	if(!outName.empty())
+	{
+		outFile.open(outName.c_str());
+		if(!outFile.is_open())
+		{
+			cerr<<"civsweep: could not write "<<outName<<endl;
+			return 1;
+		}
+	}
+	ostream& out = outName.empty() ? cout : outFile;
+
+	int maps = 0;
+	int failed = 0;
+	double setupSeconds = 0;
+	out<<"trial,seed";
+	for(unsigned int k = 0; k < spec.keys.size(); k++) out<<","<<spec.keys[k];
+	// played_turns, not turns, which may be a spec key as well
+	out<<",played_turns,stop,p1_cities,p1_roads,p1_armies,p2_cities,p2_roads,p2_armies,destroyed,winner,map_reused,map_ms,setup_us,sim_ms"<<endl;
+	for(size_t t = 0; t < trials.size(); t++)
+	{
+		trialResult& r = results[t];
+		out<<t<<","<<trials[t].seed;
+		for(unsigned int k = 0; k < trials[t].values.size(); k++) out<<","<<trials[t].values[k];
+		out<<","<<r.turns<<","<<r.stop;
+		for(int p = 0; p < 2; p++) out<<","<<r.cities[p]<<","<<r.roads[p]<<","<<r.armies[p];
+		out<<","<<r.destroyed<<","<<r.winner<<","<<r.mapReused
+		   <<","<<(int)(r.mapSeconds*1000 + 0.5)<<","<<(int)(r.setupSeconds*1e6 + 0.5)
+		   <<","<<(int)(r.simSeconds*1000 + 0.5)<<endl;
+		if(!r.mapReused) maps++;
+		if(r.failed) failed++;
+		setupSeconds += r.setupSeconds;
+	}
+	size_t arenaPeak = 0;
+	for(unsigned int w = 0; w < arenas.size(); w++)
+	{
+		arenaPeak = max(arenaPeak, arenas[w]->highWater());
+	}
+
+	cerr<<"civsweep: "<<trials.size()<<" trials, "<<maps<<" maps, "<<pool.size()<<" threads, "
+	    <<pool.steals()<<" steals, "<<seconds<<"s"<<endl;
+	cerr<<"civsweep: trial setup "<<(trials.empty() ? 0 : setupSeconds/trials.size()*1e6)<<"us on average, worker arenas peaked at "
+	    <<arenaPeak/1024<<" KB"<<(arenas[0]->hugePages() ? " on huge pages" : "")<<endl;
+	if(failed > 0)
+	{
+		cerr<<"civsweep: "<<failed<<" trials failed, their rows are not results"<<endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,162 @@
+////////////////////////////////////////////////////////
+// File name: cowarray.h
+// Description: Header only copy-on-write array. The elements live in
+// chunks of about cowChunkBytes and copies of an array share them: a
+// copy costs one pointer per chunk, and a chunk is only duplicated the
+// first time one of its owners writes to it. simulate keeps its map
+// rows and its city, road and army lists in these, so forks of a run
+// share everything their branches have not changed since the fork.
+// Reads go through operator[], writes through edit(). An array and its
+// copies may be used on different threads, each array on one thread.
+// After setArena the chunks an array allocates come from a gameArena
+// (see arena.h) instead of the heap.
+//
+#ifndef COWARRAY_H
+#define COWARRAY_H
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include "arena.h"
+
+#define cowChunkBytes 1024	//Largest chunk, chunks hold a power of two elements
+
+template <class T>
+class cowArray
+{
+public:
+cowArray()
+{
+	shift = 0;
+	while(((size_t)2 << shift)*sizeof(T) <= cowChunkBytes) shift++;
+	mask = ((size_t)1 << shift) - 1;
+	length = 0;
+	copies = 0;
+	arena = NULL;
+}
+
+//Shares every chunk of other, the copy allocates from the heap
+cowArray(const cowArray& other)
+{
+	arena = NULL;
+	*this = other;
+}
+
+cowArray& operator=(const cowArray& other)
+{
+	owners = other.owners;
+	chunks = other.chunks;
+	shift = other.shift;
+	mask = other.mask;
+	length = other.length;
+	copies = 0;
+	return *this;
+}
+
+size_t size() const { return length; }
+bool empty() const { return length == 0; }
+const T& operator[](size_t i) const { return chunks[i >> shift][i & mask]; }
+const T& back() const { return (*this)[length - 1]; }
+
+//Element i for writing, its chunk is copied first if another array shares it
+T& edit(size_t i)
+{
+	size_t c = i >> shift;
+	if(owners[c].use_count() > 1)
+	{
+		std::shared_ptr<T> copy = newChunk(false);
+		std::copy(chunks[c], chunks[c] + mask + 1, copy.get());
+		owners[c] = copy;
+		chunks[c] = copy.get();
+		copies++;
+	}
+	else
+	{
+		// Pairs with the release of the last other owner so its reads
+		// of the chunk happen before these writes
+		std::atomic_thread_fence(std::memory_order_acquire);
+	}
+	return chunks[c][i & mask];
+}
+
+void push_back(const T& value)
+{
+	if(length == capacity())
+	{
+		addChunk();
+	}
+	edit(length++) = value;
+}
+
+void pop_back() { length--; }
+void clear() { length = 0; }
+
+//Allocates the chunks for n elements so growing up to n never allocates
+void reserve(size_t n)
+{
+	while(capacity() < n)
+	{
+		addChunk();
+	}
+}
+
+void resize(size_t n, const T& value = T())
+{
+	reserve(n);
+	while(length < n)
+	{
+		edit(length++) = value;
+	}
+	length = n;
+}
+
+size_t capacity() const { return chunks.size() << shift; }
+//Bytes held by chunks that another array shares and by chunks this one has alone
+void memoryUse(long long& shared, long long& owned) const
+{
+	for(size_t c = 0; c < owners.size(); c++)
+	{
+		(owners[c].use_count() > 1 ? shared : owned) += (mask + 1)*sizeof(T);
+	}
+}
+//Chunks edit had to copy since this array was made or assigned
+size_t copied() const { return copies; }
+//Chunks allocated from now on come from arena, NULL for the heap. The
+//arena must not be rewound while this array or a copy of it holds them.
+void setArena(gameArena* a)
+{
+	static_assert(std::is_trivially_destructible<T>::value, "arena chunks are never destroyed");
+	arena = a;
+}
+
+private:
+std::vector< std::shared_ptr<T> > owners;
+std::vector<T*> chunks;	//Same as owners, read without touching the counts
+size_t shift, mask;
+size_t length;
+size_t copies;
+gameArena* arena;
+
+//A chunk, its elements value initialized if clear is set. Arena chunks
+//and their use counts are given back by rewinding the arena.
+std::shared_ptr<T> newChunk(bool clear)
+{
+	if(arena)
+	{
+		T* chunk = (T*)arena->allocate((mask + 1)*sizeof(T), alignof(T));
+		if(clear) std::uninitialized_fill_n(chunk, mask + 1, T());
+		return std::shared_ptr<T>(chunk, [](T*) {}, arenaAllocator<T>(arena));
+	}
+	return std::shared_ptr<T>(clear ? new T[mask + 1]() : new T[mask + 1], std::default_delete<T[]>());
+}
+
+void addChunk()
+{
+	owners.push_back(newChunk(true));
+	chunks.push_back(owners.back().get());
+}
+};
+
+#endif
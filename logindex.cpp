@@ -0,0 +1,65 @@
+// logindex.cpp
+// Writes the side index of an action list so printmap can seek.
+// The index holds the byte offset of every turn and a keyframe of
+// the full city/road/unit state every K turns.
+
+#include <cstdlib>
+#include <cstring>
+#include "mapstate.h"
+using namespace std;
+
+void printHelpMessage(ostream& out)
+{
+	out<<"Usage: logindex [-k <turns>] [action-list] [index-file]"<<endl<<endl;
+	out<<"Options:"<<endl;
+	out<<"-h     display this help message"<<endl;
+	out<<"-k     turns between two keyframes (default 100)"<<endl;
+	out<<"The action list defaults to action_list.txt and the index to <action-list>.idx"<<endl;
+}
+
+int main(int argc, char* argv[])
+{
+	int interval = 100;
+	string logName = "action_list.txt";
+	string indexName;
+	int arg = 1;
+
+	while(arg < argc && argv[arg][0] == '-')
+	{
+		if(strcmp(argv[arg],"-k") == 0 && arg+1 < argc)
+		{
+			interval = atoi(argv[arg+1]);
+			arg += 2;
+		}
+		else if(strcmp(argv[arg],"-h") == 0)
+		{
+			printHelpMessage(cout);
+			return 0;
+		}
+		else
+		{
+			printHelpMessage(cerr);
+			return 1;
+		}
+	}
+
+	if(arg < argc) logName = argv[arg++];
+	if(arg < argc) indexName = argv[arg++];
+	else indexName = logName + ".idx";
+
+	if(interval <= 0)
+	{
+		cerr<<"logindex: keyframe interval must be greater than 0"<<endl;
+		return 1;
+	}
+
+	actionIndex index;
+	if(!index.build(logName.c_str(), indexName.c_str(), interval))
+	{
+		cerr<<"logindex: could not index "<<logName<<endl;
+		return 1;
+	}
+
+	cerr<<"logindex: "<<index.turns()<<" turns, "<<index.keyOffset.size()<<" keyframes"<<endl;
+	return 0;
+}
@@ -0,0 +1,106 @@
+// mapconvert.cpp
+// Converts maps between the text format and the binary map format.
+// The terrain legend of a text map is taken from ./config.
+
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include "mapfile.h"
+using namespace std;
+
+void printHelpMessage(ostream& out)
+{
+	out<<"Usage: mapconvert [-f text|raw|rle] <input-map> <output-map>"<<endl<<endl;
+	out<<"Options:"<<endl;
+	out<<"-h     display this help message"<<endl;
+	out<<"-f     output format, raw and rle are binary maps (default rle)"<<endl;
+	out<<"The input format is detected. A map of - is written to stdout."<<endl;
+}
+
+// Fills the legend slots from the *_character lines of the config file
+void readLegend(mapFile& map)
+{
+	ifstream config("./config");
+	string names[5] = {"ocean_character", "plains_character", "mountain_character", "forest_character", "river_character"};
+	int slots[5] = {legendOcean, legendPlains, legendMountain, legendForest, legendRiver};
+	string line;
+
+	while(getline(config, line))
+	{
+		for(int i = 0; i < 5; i++)
+		{
+			if(line.compare(0, names[i].size(), names[i]) != 0) continue;
+			int first = line.find_first_of(39);	//look for apostrophe
+			if(first >= 0 && first + 1 < (int)line.size()) map.legend[slots[i]] = line[first+1];
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	int format = mapRle;
+	int arg = 1;
+
+	while(arg < argc && argv[arg][0] == '-' && argv[arg][1] != 0)
+	{
+		if(strcmp(argv[arg],"-f") == 0 && arg+1 < argc)
+		{
+			string name = argv[arg+1];
+			if(name == "text") format = mapText;
+			else if(name == "raw") format = mapRaw;
+			else if(name == "rle") format = mapRle;
+			else
+			{
+				printHelpMessage(cerr);
+				return 1;
+			}
+			arg += 2;
+		}
+		else if(strcmp(argv[arg],"-h") == 0)
+		{
+			printHelpMessage(cout);
+			return 0;
+		}
+		else
+		{
+			printHelpMessage(cerr);
+			return 1;
+		}
+	}
+
+	if(arg + 2 != argc)
+	{
+		printHelpMessage(cerr);
+		return 1;
+	}
+
+	mapFile map;
+	if(!map.load(argv[arg]))
+	{
+		cerr<<"mapconvert: could not read "<<argv[arg]<<endl;
+		return 1;
+	}
+	if(map.encoding == mapText)
+	{
+		readLegend(map);
+	}
+
+	bool saved;
+	if(strcmp(argv[arg+1], "-") == 0)
+	{
+		saved = map.save(cout, format);
+	}
+	else
+	{
+		ofstream out(argv[arg+1], ios::binary);
+		saved = out.is_open() && map.save(out, format);
+	}
+	if(!saved)
+	{
+		cerr<<"mapconvert: could not write "<<argv[arg+1]<<endl;
+		return 1;
+	}
+
+	cerr<<"mapconvert: "<<map.width<<"x"<<map.height<<" map converted"<<endl;
+	return 0;
+}
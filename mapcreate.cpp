@@ -3,7 +3,12 @@
 #include <fstream>
 #include <string>
 #include <sstream>
-#include "terraincreator.h"
+#include <string.h>
+#include <chrono>
+#include <time.h>
+#include "mapgen.h"
+#include "trace.h"
+#include "perfcount.h"
 
 using namespace std;
 
@@ -11,7 +16,6 @@ using namespace std;
 #define usageError 1    //Indicate the program was called incorrectly
 
 void printHelpMessage(int coutType);
-void parseConfig(int* forestAgentNum, int* forestFrequency, char* forestChar, char* oceanChar,char* landChar,char* mountainChar,int* landFrequency,int* landAgentNum,int* mountainFrequency,int* mountainAgentNum);
 
 
 int main(int argc,char* argv[])
@@ -42,66 +46,155 @@ int main(int argc,char* argv[])
 
 
     unsigned int paramFlag = 0;  //Value to be incrementmented upon encountering a parameter flag
-
-
-    if(argc > 3)    //Check for more than 3 arguments (implies a parameter flag)
+    bool seedGiven = false;
+    unsigned int seed = 0;
+    unsigned int threads = 0;
+    long long memoryLimit = 256;    //Megabytes of band buffers in noise mode
+    int format = mapText;
+    const char* cacheDir = NULL;    //Stage cache of the agent generator
+    const char* traceName = NULL;   //Trace-event timeline of the run
+    bool perfCounters = false;      //Hardware counters per stage
+    bool noiseMode = false;
+
+
+    for(int i = 1; i < argc; i++)   //Parameter flags come before the dimensions
     {
-        for(int i = 0; i < argc; i++)
+        if(argv[i][0] != '-') break;
+
+        switch(argv[i][1])
         {
-            if(argv[i][0] == '-')
+        case 'h':
+            printHelpMessage(helpParam);
+            return 0;
+            break;
+        case 'i':
+            readFromStdin = true;
+            paramFlag++;
+            break;
+        case 's':
+            if(i + 1 >= argc)
             {
-                switch(argv[i][1])
-                {
-                case 'h':
-                    printHelpMessage(helpParam);
-                    paramFlag++;
-                    return 0;
-                    break;
-                case 'i':
-                    readFromStdin = true;
-                    paramFlag++;
-                    break;
-                default:
-                    printHelpMessage(usageError);
-                    return 1;
-                    break;
-                }
-
+                printHelpMessage(usageError);
+                return 1;
+            }
+            seed = strtoul(argv[++i], NULL, 10);
+            seedGiven = true;
+            paramFlag += 2;
+            break;
+        case '-':
+            if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            {
+                traceName = argv[++i];
+                paramFlag += 2;
+                break;
+            }
+            if(strcmp(argv[i], "--perf-counters") == 0)
+            {
+                perfCounters = true;
+                paramFlag++;
+                break;
+            }
+            if(strcmp(argv[i], "--mode") != 0 || i + 1 >= argc)
+            {
+                printHelpMessage(usageError);
+                return 1;
+            }
+            i++;
+            if(strcmp(argv[i], "noise") == 0) noiseMode = true;
+            else if(strcmp(argv[i], "agent") != 0)
+            {
+                printHelpMessage(usageError);
+                return 1;
             }
-            else break;
+            paramFlag += 2;
+            break;
+        case 'j':
+            if(i + 1 >= argc)
+            {
+                printHelpMessage(usageError);
+                return 1;
+            }
+            threads = atoi(argv[++i]);
+            paramFlag += 2;
+            break;
+        case 'c':
+            if(i + 1 >= argc)
+            {
+                printHelpMessage(usageError);
+                return 1;
+            }
+            cacheDir = argv[++i];
+            paramFlag += 2;
+            break;
+        case 'f':
+            if(i + 1 >= argc)
+            {
+                printHelpMessage(usageError);
+                return 1;
+            }
+            i++;
+            if(strcmp(argv[i], "text") == 0) format = mapText;
+            else if(strcmp(argv[i], "raw") == 0) format = mapRaw;
+            else if(strcmp(argv[i], "rle") == 0) format = mapRle;
+            else
+            {
+                printHelpMessage(usageError);
+                return 1;
+            }
+            paramFlag += 2;
+            break;
+        case 'm':
+            if(i + 1 >= argc || atoll(argv[i + 1]) <= 0)
+            {
+                printHelpMessage(usageError);
+                return 1;
+            }
+            memoryLimit = atoll(argv[++i]);
+            paramFlag += 2;
+            break;
+        default:
+            printHelpMessage(usageError);
+            return 1;
+            break;
         }
     }
-    else if(argc < 3)
+
+    if(argc < 3 + (int)paramFlag)
     {
         printHelpMessage(usageError);
         return 1;
     }
 
 
-    char oceanChar;
-    char landChar;
-    char mountainChar;
-    char forestChar;
-    int landFrequency;
-    int landAgentNum;
-    int mountainFrequency;
-    int mountainAgentNum;
-    int forestFrequency;
-    int forestAgentNum;
+    if(traceName)
+    {
+        traceStart(traceName);
+        traceThreadName("mapcreate");
+    }
+    if(perfCounters)
+    {
+        string error;
+        if(!perfStart(error))
+        {
+            cerr << "mapcreate: hardware counters unavailable (" << error << "), stages are only timed" << endl;
+        }
+    }
+
+    mapSettings settings;
 
     if(readFromStdin)
     {
-        cin >> oceanChar;
-        cin >> landChar;
-        cin >> mountainChar;
-        cin >> landFrequency;
-        cin >> landAgentNum;
-        cin >> mountainFrequency;
-        cin >> mountainAgentNum;
+        cin >> settings.oceanChar;
+        cin >> settings.landChar;
+        cin >> settings.mountainChar;
+        cin >> settings.landFrequency;
+        cin >> settings.landAgentNum;
+        cin >> settings.mountainFrequency;
+        cin >> settings.mountainAgentNum;
     }
     else
     {
-        parseConfig(&forestAgentNum, &forestFrequency, &forestChar,&oceanChar,&landChar,&mountainChar,&landFrequency,&landAgentNum,&mountainFrequency,&mountainAgentNum);
+        parseConfig(&settings);
     }
 
 
@@ -115,20 +208,74 @@ int main(int argc,char* argv[])
 
     //char map[(xSize+1)*(ySize+1)];
 
+    //The seed is kept in binary maps, so pick it here rather than in the generators
+    if(!seedGiven) seed = time(NULL);
+
+    mapFile output;
+    mapHeader(settings, xSize, ySize, seed, noiseMode ? mapNoise : mapAgent, output);
+    output.beginWrite(cout, format);
+
+    if(noiseMode)   //Heightmap generator, streamed out in bands so the map never has to fit in memory
+    {
+        noiseCreator map(xSize, ySize);
+        map.setSeed(seed);
+        if(threads > 0) map.setThreads(threads);
+        map.setTerrain(settings.oceanChar, settings.landChar, settings.mountainChar, settings.forestChar);
+        map.setFrequencies(settings.landAgentNum, settings.landFrequency, settings.mountainAgentNum, settings.mountainFrequency, settings.forestAgentNum, settings.forestFrequency);
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if(!map.streamMap(output, memoryLimit << 20))
+        {
+            cerr << "mapcreate: error writing the map" << endl;
+            return 1;
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        cerr << "mapcreate: noise mode, " << (double)xSize*ySize << " cells in " << seconds << "s ("
+             << (seconds > 0 ? xSize*(double)ySize/seconds : 0) << " cells/s)" << endl;
+        perfReport(cerr);
+        if(traceName && !traceStop())
+        {
+            cerr << "mapcreate: could not write " << traceName << endl;
+        }
+        return 0;
+    }
+
     terrainCreator map(xSize, ySize);
-    map.fillMap(oceanChar);
-    map.createFeature(landAgentNum, landChar, oceanChar, landFrequency);
-    map.smoothFeature(landChar, oceanChar);
-    map.smoothFeature(landChar, oceanChar);
-    map.createFeature(mountainAgentNum,  mountainChar, landChar, mountainFrequency);
-    map.smoothFeature(mountainChar, landChar);
-    map.createFeature(forestAgentNum,  forestChar, landChar, forestFrequency);
-    map.smoothFeature(forestChar, landChar);
+    map.setSeed(seed);
+    if(threads > 0) map.setThreads(threads);
 
+    //The generation chain, a stage cache lets reruns skip the stages whose inputs did not change
+    vector<terrainStage> stages;
+    agentStages(settings, stages);
 
-    cout << map.printMap();
+    unsigned int reused = map.runStages(stages, cacheDir);
+    if(cacheDir)
+    {
+        cerr << "mapcreate: " << reused << " of " << stages.size() << " stages from " << cacheDir;
+        if(reused > 0) cerr << " (up to " << stages[reused-1].name << ")";
+        cerr << endl;
+    }
 
 
+    bool written;
+    {
+        traceSpan span("write map");
+        output.writeRows(map.printMap(), ySize);
+        written = output.endWrite();
+    }
+    if(!written)
+    {
+        cerr << "mapcreate: error writing the map" << endl;
+        return 1;
+    }
+    perfReport(cerr);
+    if(traceName && !traceStop())
+    {
+        cerr << "mapcreate: could not write " << traceName << endl;
+    }
+    return 0;
+
 }
 
 //Function:
@@ -153,127 +300,32 @@ void printHelpMessage(int coutType)
 {
     if(coutType == 0)
     {
-        cout << "Usage: mapcreate [OPTION] <integer-x-dimension> <integer-y-dimension>." << endl << endl;
+        cout << "Usage: mapcreate [OPTION]... <integer-x-dimension> <integer-y-dimension>." << endl << endl;
         cout << "Options:" << endl;
         cout << "-h     display this help message" << endl;
         cout << "-i     read config from stdin" << endl;
+        cout << "-s     seed, the same seed and config give the same map" << endl;
+        cout << "-j     number of threads used for smoothing" << endl;
+        cout << "--mode agent|noise   terrain generator (default agent)" << endl;
+        cout << "-m     megabytes of map kept in memory in noise mode (default 256)" << endl;
+        cout << "-f     output format text|raw|rle, raw and rle are binary maps (default text)" << endl;
+        cout << "-c     stage cache directory, reruns reuse the stages whose settings did not change" << endl;
+        cout << "--trace file   write a Chrome trace-event timeline of the generator stages" << endl;
+        cout << "--perf-counters   print cycles, IPC and cache/branch misses per stage" << endl;
     }
     else
     {
-        cerr << "Usage: mapcreate [OPTION] <integer-x-dimension> <integer-y-dimension>." << endl << endl;
+        cerr << "Usage: mapcreate [OPTION]... <integer-x-dimension> <integer-y-dimension>." << endl << endl;
         cerr << "Options:" << endl;
         cerr << "-h     display this help message" << endl;
         cerr << "-i     read config from stdin" << endl;
+        cerr << "-s     seed, the same seed and config give the same map" << endl;
+        cerr << "-j     number of threads used for smoothing" << endl;
+        cerr << "--mode agent|noise   terrain generator (default agent)" << endl;
+        cerr << "-m     megabytes of map kept in memory in noise mode (default 256)" << endl;
+        cerr << "-f     output format text|raw|rle, raw and rle are binary maps (default text)" << endl;
+        cerr << "-c     stage cache directory, reruns reuse the stages whose settings did not change" << endl;
+        cerr << "--trace file   write a Chrome trace-event timeline of the generator stages" << endl;
+        cerr << "--perf-counters   print cycles, IPC and cache/branch misses per stage" << endl;
     }
 }
-
-
-//Function:
-//      parseConfig
-//
-//Description:
-//      Parses input data from the config file
-//
-//Preconditions:
-//      config file exists
-//
-//Arguments:
-//      char* oceanChar,char* landChar,char* mountainChar,int* landFrequency,int* landAgentNum,int* mountainFrequency,int* mountainAgentNum
-//
-//Postconditions:
-//
-//
-//Returns:
-//
-//
-void parseConfig(int* forestAgentNum, int* forestFrequency, char* forestChar, char* oceanChar,char* landChar,char* mountainChar,int* landFrequency,int* landAgentNum,int* mountainFrequency,int* mountainAgentNum)
-{
-
-    ifstream configFile ("./config");
-
-    if(configFile.fail())
-    {
-        cerr << "MapCreate: Error: Can't find config file.";
-    }
-
-
-    const int numParams = 11;
-    string configParams[numParams] =
-    {
-        "plains_character",
-        "mountain_character",
-        "forest_character",
-        "ocean_character",
-        "river_character",
-        "landFrequency",
-        "landAgentNum",
-        "mountainFrequency",
-        "mountainAgentNum",
-        "forestFrequency",
-        "forestAgentNum"
-    };
-
-    string line;
-    int lineLocation;
-    int lineEnd;
-
-
-    for(int i = 0; i < numParams;i++)
-    {		
-        if(configFile.eof()) break;
-
-        getline(configFile, line);
-
-        lineLocation = line.find(configParams[i]);
-
-        if(lineLocation >= 0)
-        {
-            lineLocation = line.find_first_of(39);   //look for apostrophe
-            lineEnd = line.find_last_of(39);
-            istringstream tempStream(line.substr(lineLocation+1, lineEnd-lineLocation-1));
-            switch(i)
-            {
-                case 0:
-                    tempStream >> (*landChar);
-                    break;
-                case 1:
-                    tempStream >> (*mountainChar);
-                    break;
-                case 2:
-                    tempStream >> (*forestChar);
-                    break;
-                case 3:
-                    tempStream >> (*oceanChar);
-                    break;
-                case 4:
-                    //river
-                    break;
-                case 5:
-                    tempStream >> (*landFrequency);
-                    break;
-                case 6:
-                    tempStream >> (*landAgentNum);
-                    break;
-                case 7:
-                    tempStream >> (*mountainFrequency);
-                    break;
-                case 8:
-                    tempStream >> (*mountainAgentNum);
-                    break;
-                case 9:
-                    tempStream >> (*forestFrequency);
-                    break;
-                case 10:
-                    tempStream >> (*forestAgentNum);
-                    break;
-
-                default:
-                    cerr << "MapCreate: Error: Something went wrong while parsing.";
-
-            }
-        } else i--;
-    }
-
-}
-
-
@@ -0,0 +1,267 @@
+////////////////////////////////////////////////////////
+// File name: mapfile.cpp
+// Description: Implementation file for the mapFile class
+//
+#include <cstring>
+#include "mapfile.h"
+
+static const char mapMagic[8] = {'C','I','V','M','A','P',0,0};
+
+// Header field offsets, see mapfile.h
+#define offsetVersion 8
+#define offsetWidth 12
+#define offsetHeight 16
+#define offsetEncoding 20
+#define offsetLegend 24
+#define offsetSeed 32
+#define offsetGenerator 36
+#define offsetParams 40
+
+mapFile::mapFile()
+{
+	width = 0;
+	height = 0;
+	encoding = mapText;
+	memset(legend, 0, sizeof(legend));
+	seed = 0;
+	generator = mapUnknown;
+	memset(params, 0, sizeof(params));
+	output = 0;
+	writeEncoding = mapText;
+	written = 0;
+}
+
+bool mapFile::load(const char* name)
+{
+	ifstream in(name, ios::binary);
+	char header[mapHeaderSize];
+
+	if(!in.is_open())
+	{
+		return false;
+	}
+
+	in.seekg(0, ios::end);
+	long long fileSize = in.tellg();
+	in.seekg(0);
+
+	if(fileSize >= mapHeaderSize)
+	{
+		in.read(header, mapHeaderSize);
+		if(in && memcmp(header, mapMagic, sizeof(mapMagic)) == 0)
+		{
+			return loadBinary(in, header, fileSize);
+		}
+		in.clear();
+		in.seekg(0);
+	}
+	return loadText(in);
+}
+
+// Every line is a row, the width is the longest line
+bool mapFile::loadText(ifstream& in)
+{
+	vector <string> rows;
+	string line;
+
+	while(getline(in, line))
+	{
+		if(!line.empty() && line[line.size()-1] == '\r') line.erase(line.size()-1);
+		if(line.empty()) continue;
+		rows.push_back(line);
+	}
+
+	width = 0;
+	height = rows.size();
+	for(int y = 0; y < height; y++)
+	{
+		if((int)rows[y].size() > width) width = rows[y].size();
+	}
+
+	terrain.assign((long long)width*height, ' ');
+	for(int y = 0; y < height; y++)
+	{
+		memcpy(&terrain[(long long)y*width], rows[y].data(), rows[y].size());
+	}
+	encoding = mapText;
+	return height > 0;
+}
+
+bool mapFile::loadBinary(ifstream& in, const char* header, long long fileSize)
+{
+	int version;
+
+	memcpy(&version, header + offsetVersion, sizeof(int));
+	memcpy(&width, header + offsetWidth, sizeof(int));
+	memcpy(&height, header + offsetHeight, sizeof(int));
+	memcpy(&encoding, header + offsetEncoding, sizeof(int));
+	memcpy(legend, header + offsetLegend, sizeof(legend));
+	memcpy(&seed, header + offsetSeed, sizeof(seed));
+	memcpy(&generator, header + offsetGenerator, sizeof(int));
+	memcpy(params, header + offsetParams, sizeof(params));
+
+	if(version != mapFileVersion || width < 0 || height < 0)
+	{
+		return false;
+	}
+
+	// The header is checked against the file size before the terrain is
+	// allocated, a corrupt size must not ask for more than the file holds
+	long long cells = (long long)width*height;
+	if(encoding == mapRaw)
+	{
+		if(fileSize < mapHeaderSize + cells) return false;
+		terrain.resize(cells);
+		if(cells > 0) in.read(&terrain[0], cells);
+		return (bool)in;
+	}
+
+	if(encoding != mapRle) return false;
+
+	// Each 2 byte run between the header and the table covers at most 255 cells
+	long long tableOffset = fileSize - (long long)(height + 1)*sizeof(long long);
+	if(tableOffset < mapHeaderSize) return false;
+	if(cells > 255*((tableOffset - mapHeaderSize)/2)) return false;
+	terrain.resize(cells);
+	rowOffset.resize(height + 1);
+	in.seekg(tableOffset);
+	in.read((char*)&rowOffset[0], rowOffset.size()*sizeof(long long));
+	if(!in) return false;
+
+	for(int y = 0; y < height; y++)
+	{
+		long long length = rowOffset[y+1] - rowOffset[y];
+		if(length < 0 || length % 2 != 0 || rowOffset[y+1] > tableOffset) return false;
+
+		runs.resize(length);
+		in.seekg(rowOffset[y]);
+		if(length > 0) in.read(&runs[0], length);
+		if(!in) return false;
+
+		char* row = &terrain[(long long)y*width];
+		long long x = 0;
+		for(long long r = 0; r < length; r += 2)
+		{
+			int count = (unsigned char)runs[r];
+			if(x + count > width) return false;
+			memset(row + x, runs[r+1], count);
+			x += count;
+		}
+		if(x != width) return false;
+	}
+	vector <long long>().swap(rowOffset);
+	vector <char>().swap(runs);
+	return true;
+}
+
+bool mapFile::beginWrite(ostream& out, int encoding)
+{
+	output = &out;
+	writeEncoding = encoding;
+	written = 0;
+	rowOffset.clear();
+	if(encoding == mapText)
+	{
+		return out.good();
+	}
+
+	char header[mapHeaderSize];
+	int version = mapFileVersion;
+	memset(header, 0, sizeof(header));
+	memcpy(header, mapMagic, sizeof(mapMagic));
+	memcpy(header + offsetVersion, &version, sizeof(int));
+	memcpy(header + offsetWidth, &width, sizeof(int));
+	memcpy(header + offsetHeight, &height, sizeof(int));
+	memcpy(header + offsetEncoding, &encoding, sizeof(int));
+	memcpy(header + offsetLegend, legend, sizeof(legend));
+	memcpy(header + offsetSeed, &seed, sizeof(seed));
+	memcpy(header + offsetGenerator, &generator, sizeof(int));
+	memcpy(header + offsetParams, params, sizeof(params));
+	out.write(header, sizeof(header));
+	written = sizeof(header);
+	return out.good();
+}
+
+// Rows come in the text layout mapcreate already builds, each row
+// followed by its newline
+void mapFile::writeRows(const char* rows, long long count)
+{
+	long long rowLength = (long long)width + 1;
+
+	if(writeEncoding == mapText)
+	{
+		output->write(rows, count*rowLength);
+		return;
+	}
+
+	for(long long y = 0; y < count; y++)
+	{
+		const char* row = rows + y*rowLength;
+		if(writeEncoding == mapRaw)
+		{
+			output->write(row, width);
+			written += width;
+			continue;
+		}
+
+		runs.clear();
+		for(int x = 0; x < width; )
+		{
+			int run = 1;
+			while(x + run < width && run < 255 && row[x + run] == row[x]) run++;
+			runs.push_back((char)run);
+			runs.push_back(row[x]);
+			x += run;
+		}
+		rowOffset.push_back(written);
+		if(!runs.empty()) output->write(&runs[0], runs.size());
+		written += runs.size();
+	}
+}
+
+bool mapFile::endWrite()
+{
+	if(writeEncoding == mapRle)
+	{
+		// The row table starts 8 byte aligned
+		char padding[8] = {0,0,0,0,0,0,0,0};
+		int extra = (8 - written % 8) % 8;
+		rowOffset.push_back(written);
+		output->write(padding, extra);
+		written += extra;
+		if(!rowOffset.empty())
+		{
+			output->write((const char*)&rowOffset[0], rowOffset.size()*sizeof(long long));
+		}
+		vector <long long>().swap(rowOffset);
+		vector <char>().swap(runs);
+	}
+	output->flush();
+	return output->good();
+}
+
+bool mapFile::save(ostream& out, int encoding)
+{
+	vector <char> row(width + 1, '\n');
+
+	if(!beginWrite(out, encoding))
+	{
+		return false;
+	}
+	for(int y = 0; y < height; y++)
+	{
+		if(width > 0) memcpy(&row[0], &terrain[(long long)y*width], width);
+		writeRows(&row[0], 1);
+	}
+	return endWrite();
+}
+
+void mapFile::setRows(const char* rows)
+{
+	terrain.resize((long long)width*height);
+	for(int y = 0; y < height; y++)
+	{
+		memcpy(&terrain[(long long)y*width], rows + (long long)y*(width + 1), width);
+	}
+	encoding = mapText;
+}
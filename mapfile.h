@@ -0,0 +1,103 @@
+////////////////////////////////////////////////////////
+// File name: mapfile.h
+// Description: Header file for the mapFile class, which reads and
+// writes maps in the text format (one line of terrain characters
+// per row) and in the binary map format below. Binary maps carry
+// their own size, terrain legend and the generator settings, so a
+// tool no longer needs the size on its command line.
+//
+// Binary layout (native byte order, 64 byte header):
+//   char magic[8]                 "CIVMAP\0\0"
+//   int  version                  mapFileVersion
+//   int  width, height
+//   int  encoding                 mapRaw or mapRle
+//   char legend[8]                ocean, plains, mountain, forest, river
+//                                 characters, 0 if unknown
+//   unsigned int seed
+//   int  generator                mapUnknown, mapAgent or mapNoise
+//   int  params[6]                landAgentNum, landFrequency,
+//                                 mountainAgentNum, mountainFrequency,
+//                                 forestAgentNum, forestFrequency
+// mapRaw: width*height terrain characters, row by row, from byte 64
+//   so a reader can map the file and index cells in place.
+// mapRle: every row as (count, character) byte pairs with counts of
+//   1-255, padded to 8 bytes, then a table of height+1 long long
+//   offsets to the start of each row (and the end of the last one)
+//   at the end of the file. The table goes last so a map can be
+//   written to a pipe as it is generated.
+//
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <string>
+
+using namespace std;
+
+#define mapFileVersion 1
+#define mapHeaderSize 64
+
+//Encodings of the cells
+#define mapText 0	//Not a binary map, one text line per row
+#define mapRaw 1	//One byte per cell
+#define mapRle 2	//Run length encoded rows
+
+//Generators that made the map
+#define mapUnknown 0
+#define mapAgent 1
+#define mapNoise 2
+
+//Legend slots
+#define legendOcean 0
+#define legendPlains 1
+#define legendMountain 2
+#define legendForest 3
+#define legendRiver 4
+#define legendSize 8
+
+//mapFile - terrain of a whole map plus the binary header fields
+class mapFile
+{
+public:
+mapFile();
+//Reads a text or binary map, the format is found from the first bytes
+bool load(const char* name);
+//Terrain character of column x, row y
+char at(int x, int y) const { return terrain[(long long)y*width + x]; }
+
+//Starts writing a map of width x height in the given encoding.
+//Header fields are taken from this object.
+bool beginWrite(ostream& out, int encoding);
+//Writes count rows of text, each width characters and a newline
+void writeRows(const char* rows, long long count);
+//Writes the row table of an mapRle map, returns false on write errors
+bool endWrite();
+//Writes the loaded terrain in the given encoding
+bool save(ostream& out, int encoding);
+//Copies height rows of text, each width characters and a newline,
+//into terrain
+void setRows(const char* rows);
+
+int width, height;
+int encoding;		//Encoding the map was loaded from
+char legend[legendSize];
+unsigned int seed;
+int generator;
+int params[6];
+//Terrain characters row by row, filled by load
+vector <char> terrain;
+
+private:
+bool loadText(ifstream& in);
+bool loadBinary(ifstream& in, const char* header, long long fileSize);
+
+ostream* output;
+int writeEncoding;
+long long written;	//Bytes written so far, pipes cannot tell
+vector <long long> rowOffset;
+vector <char> runs;
+};
+
+#endif
@@ -0,0 +1,215 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string.h>
+#include "mapgen.h"
+
+using namespace std;
+
+//Function:
+//      agentStages
+//
+//Description:
+//      Builds the agent generator chain: fill with ocean, land agents, two land
+//      smoothing passes, mountain agents and smoothing, forest agents and smoothing
+//
+//Preconditions:
+//      None
+//
+//Arguments:
+//      settings - terrain characters and agent settings
+//      stages - filled with the chain
+//
+//Postconditions:
+//      stages holds the chain for terrainCreator::runStages
+//
+//Returns:
+//      None
+//
+void agentStages(const mapSettings& settings, vector<terrainStage>& stages)
+{
+    terrainStage chain[] =
+    {
+        {"fill",            stageFill,    settings.oceanChar,    0,                  0,                                      0},
+        {"land",            stageFeature, settings.landChar,     settings.oceanChar, (unsigned int)settings.landAgentNum,     (unsigned int)settings.landFrequency},
+        {"land-smooth",     stageSmooth,  settings.landChar,     settings.oceanChar, 0,                                      0},
+        {"land-smooth",     stageSmooth,  settings.landChar,     settings.oceanChar, 0,                                      0},
+        {"mountains",       stageFeature, settings.mountainChar, settings.landChar,  (unsigned int)settings.mountainAgentNum, (unsigned int)settings.mountainFrequency},
+        {"mountain-smooth", stageSmooth,  settings.mountainChar, settings.landChar,  0,                                      0},
+        {"forests",         stageFeature, settings.forestChar,   settings.landChar,  (unsigned int)settings.forestAgentNum,   (unsigned int)settings.forestFrequency},
+        {"forest-smooth",   stageSmooth,  settings.forestChar,   settings.landChar,  0,                                      0}
+    };
+    stages.assign(chain, chain + sizeof(chain)/sizeof(chain[0]));
+}
+
+//Function:
+//      mapHeader
+//
+//Description:
+//      Fills the header fields of a binary map from the generator settings
+//
+//Preconditions:
+//      None
+//
+//Arguments:
+//      settings - terrain characters and agent settings
+//      x, y - map size
+//      seed - generator seed
+//      generator - mapAgent or mapNoise
+//      header - map to fill
+//
+//Postconditions:
+//      Size, legend, seed, generator and params of header are set
+//
+//Returns:
+//      None
+//
+void mapHeader(const mapSettings& settings, unsigned int x, unsigned int y, unsigned int seed, int generator, mapFile& header)
+{
+    header.width = x;
+    header.height = y;
+    header.legend[legendOcean] = settings.oceanChar;
+    header.legend[legendPlains] = settings.landChar;
+    header.legend[legendMountain] = settings.mountainChar;
+    header.legend[legendForest] = settings.forestChar;
+    header.seed = seed;
+    header.generator = generator;
+    int params[6] = {settings.landAgentNum, settings.landFrequency, settings.mountainAgentNum,
+                     settings.mountainFrequency, settings.forestAgentNum, settings.forestFrequency};
+    memcpy(header.params, params, sizeof(params));
+}
+
+//Function:
+//      parseConfig
+//
+//Description:
+//      Parses input data from the config file
+//
+//Preconditions:
+//      config file exists
+//
+//Arguments:
+//      mapSettings* settings - terrain characters and agent settings to fill
+//
+//Postconditions:
+//
+//
+//Returns:
+//
+//
+void parseConfig(mapSettings* settings)
+{
+
+    ifstream configFile ("./config");
+
+    if(configFile.fail())
+    {
+        cerr << "MapCreate: Error: Can't find config file.";
+    }
+
+    parseConfig(settings, configFile);
+}
+
+//Function:
+//      parseConfig
+//
+//Description:
+//      Parses input data from config text, lets callers feed an edited
+//      copy of the config without touching the file
+//
+//Preconditions:
+//      None
+//
+//Arguments:
+//      mapSettings* settings - terrain characters and agent settings to fill
+//      istream& configFile - config text
+//
+//Postconditions:
+//      Settings found in the text are set
+//
+//Returns:
+//      None
+//
+void parseConfig(mapSettings* settings, istream& configFile)
+{
+
+    const int numParams = 11;
+    string configParams[numParams] =
+    {
+        "plains_character",
+        "mountain_character",
+        "forest_character",
+        "ocean_character",
+        "river_character",
+        "landFrequency",
+        "landAgentNum",
+        "mountainFrequency",
+        "mountainAgentNum",
+        "forestFrequency",
+        "forestAgentNum"
+    };
+
+    string line;
+    int lineLocation;
+    int lineEnd;
+
+
+    for(int i = 0; i < numParams;i++)
+    {		
+        if(configFile.eof()) break;
+
+        getline(configFile, line);
+
+        lineLocation = line.find(configParams[i]);
+
+        if(lineLocation >= 0)
+        {
+            lineLocation = line.find_first_of(39);   //look for apostrophe
+            lineEnd = line.find_last_of(39);
+            istringstream tempStream(line.substr(lineLocation+1, lineEnd-lineLocation-1));
+            switch(i)
+            {
+                case 0:
+                    tempStream >> settings->landChar;
+                    break;
+                case 1:
+                    tempStream >> settings->mountainChar;
+                    break;
+                case 2:
+                    tempStream >> settings->forestChar;
+                    break;
+                case 3:
+                    tempStream >> settings->oceanChar;
+                    break;
+                case 4:
+                    //river
+                    break;
+                case 5:
+                    tempStream >> settings->landFrequency;
+                    break;
+                case 6:
+                    tempStream >> settings->landAgentNum;
+                    break;
+                case 7:
+                    tempStream >> settings->mountainFrequency;
+                    break;
+                case 8:
+                    tempStream >> settings->mountainAgentNum;
+                    break;
+                case 9:
+                    tempStream >> settings->forestFrequency;
+                    break;
+                case 10:
+                    tempStream >> settings->forestAgentNum;
+                    break;
+
+                default:
+                    cerr << "MapCreate: Error: Something went wrong while parsing.";
+
+            }
+        } else i--;
+    }
+
+}
+
+
@@ -0,0 +1,37 @@
+////////////////////////////////////////////////////////
+// File name: mapgen.h
+// Description: Generator settings shared by mapcreate and civsim.
+// Reads the terrain characters and agent settings from the config
+// file and turns them into the agent generator's stage chain and
+// the header of a binary map.
+//
+#ifndef MAPGEN_H
+#define MAPGEN_H
+
+#include <vector>
+#include <istream>
+#include "terraincreator.h"
+#include "noisecreator.h"
+#include "mapfile.h"
+
+//mapSettings - generator part of the config file
+struct mapSettings
+{
+    char oceanChar;
+    char landChar;
+    char mountainChar;
+    char forestChar;
+    int landFrequency;
+    int landAgentNum;
+    int mountainFrequency;
+    int mountainAgentNum;
+    int forestFrequency;
+    int forestAgentNum;
+};
+
+void parseConfig(mapSettings* settings);
+void parseConfig(mapSettings* settings, std::istream& configFile);
+void agentStages(const mapSettings& settings, std::vector<terrainStage>& stages);
+void mapHeader(const mapSettings& settings, unsigned int x, unsigned int y, unsigned int seed, int generator, mapFile& header);
+
+#endif
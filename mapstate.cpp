@@ -0,0 +1,450 @@
+////////////////////////////////////////////////////////
+// File name: mapstate.cpp
+// Description: Implementation file for the mapState and actionIndex classes
+//
+#include <cstring>
+#include <cstdlib>
+#include "mapstate.h"
+
+// Index file layout (native byte order):
+//   char magic[8]                 "CIVIDX2\n"
+//   int  interval, turns, keys
+//   int  width, height            area every record of the log lies in
+//   long long tableOffset         where the two offset tables start
+//   keyframes                     one after another
+//   long long turnOffset[turns]
+//   long long keyOffset[keys]
+static const char indexMagic[8] = {'C','I','V','I','D','X','2','\n'};
+
+// One occupied cell of a keyframe
+struct keyCell
+{
+	int x;
+	int y;
+	int color;
+	int type;
+};
+
+mapState::mapState(int sizeX, int sizeY)
+{
+	width = sizeX;
+	height = sizeY;
+	destroyed = 0;
+	outside = 0;
+	cityRoad.resize(width*height);
+	unit.resize(width*height);
+	cityRoadColor.resize(width*height);
+	unitColor.resize(width*height);
+	clear();
+}
+
+// Empties both layers and resets all counters
+void mapState::clear()
+{
+	memset(cityRoad.data(), 0, cityRoad.size());
+	memset(unit.data(), 0, unit.size());
+	memset(cityRoadColor.data(), 0, cityRoadColor.size()*sizeof(int));
+	memset(unitColor.data(), 0, unitColor.size()*sizeof(int));
+	memset(cities, 0, sizeof(cities));
+	memset(roads, 0, sizeof(roads));
+	memset(units, 0, sizeof(units));
+}
+
+void mapState::count(int* total, int color, int n)
+{
+	if(color >= 0 && color < maxPlayerColor)
+	{
+		total[color] += n;
+	}
+}
+
+bool mapState::inside(int x, int y)
+{
+	return x >= 0 && y >= 0 && x < width && y < height;
+}
+
+// Applies one record of the action list (see actionlistformat).
+// Turn records are not actions, false is returned for them so the
+// caller can tell where a turn ends.
+bool mapState::apply(const actionRecord& rec)
+{
+	int from, to;
+	switch(rec.action)
+	{
+		case turnRecord:
+		return false;
+
+		case moveRecord:
+		if(!inside(rec.x,rec.y) || !inside(rec.newX,rec.newY))
+		{
+			outside++;
+			break;
+		}
+		from = rec.y*width + rec.x;
+		to = rec.newY*width + rec.newX;
+		unit[to] = unit[from];
+		unitColor[to] = unitColor[from];
+		unit[from] = 0;
+		unitColor[from] = 0;
+		break;
+
+		case colorRecord:
+		if(!inside(rec.x,rec.y))
+		{
+			outside++;
+			break;
+		}
+		to = rec.y*width + rec.x;
+		if(rec.layer == 1)
+		{
+			if(cityRoad[to] == 'R')
+			{
+				count(roads, cityRoadColor[to], -1);
+				count(roads, rec.color, 1);
+			}
+			else if(cityRoad[to] == 'C')
+			{
+				count(cities, cityRoadColor[to], -1);
+				count(cities, rec.color, 1);
+			}
+			cityRoadColor[to] = rec.color;
+		}
+		else if(rec.layer == 2)
+		{
+			if(unit[to])
+			{
+				count(units, unitColor[to], -1);
+				count(units, rec.color, 1);
+			}
+			unitColor[to] = rec.color;
+		}
+		break;
+
+		case createRecord:
+		if(!inside(rec.x,rec.y))
+		{
+			outside++;
+			break;
+		}
+		to = rec.y*width + rec.x;
+		if(rec.layer == 1)
+		{
+			if(rec.object == cityObject)
+			{
+				cityRoad[to] = 'C';
+				count(cities, rec.color, 1);
+			}
+			else if(rec.object == roadObject)
+			{
+				cityRoad[to] = 'R';
+				count(roads, rec.color, 1);
+			}
+			cityRoadColor[to] = rec.color;
+		}
+		else if(rec.layer == 2)
+		{
+			unit[to] = 'U';
+			unitColor[to] = rec.color;
+			count(units, rec.color, 1);
+		}
+		break;
+
+		case destroyRecord:
+		destroyed++;
+		if(!inside(rec.x,rec.y))
+		{
+			outside++;
+			break;
+		}
+		to = rec.y*width + rec.x;
+		if(rec.layer == 1)
+		{
+			if(cityRoad[to] == 'R') count(roads, cityRoadColor[to], -1);
+			else if(cityRoad[to] == 'C') count(cities, cityRoadColor[to], -1);
+			cityRoad[to] = 0;
+			cityRoadColor[to] = 0;
+		}
+		else if(rec.layer == 2)
+		{
+			if(unit[to]) count(units, unitColor[to], -1);
+			unit[to] = 0;
+			unitColor[to] = 0;
+		}
+		break;
+	}
+	return true;
+}
+
+// Writes the occupied cells of both layers and the per color totals.
+// Keyframes are sparse so their size follows the number of entities,
+// not the size of the map.
+void mapState::writeKeyframe(ostream& out)
+{
+	vector <keyCell> cells;
+	keyCell temp;
+	int layerSize[2];
+
+	for(int layer = 0; layer < 2; layer++)
+	{
+		vector <char>& type = layer == 0 ? cityRoad : unit;
+		vector <int>& color = layer == 0 ? cityRoadColor : unitColor;
+		layerSize[layer] = 0;
+		for(int i = 0; i < width*height; i++)
+		{
+			if(type[i])
+			{
+				temp.x = i % width;
+				temp.y = i / width;
+				temp.color = color[i];
+				temp.type = type[i];
+				cells.push_back(temp);
+				layerSize[layer]++;
+			}
+		}
+	}
+
+	out.write((const char*)cities, sizeof(cities));
+	out.write((const char*)roads, sizeof(roads));
+	out.write((const char*)units, sizeof(units));
+	out.write((const char*)layerSize, sizeof(layerSize));
+	if(!cells.empty())
+	{
+		out.write((const char*)&cells[0], cells.size()*sizeof(keyCell));
+	}
+}
+
+// Restores a state written by writeKeyframe
+void mapState::readKeyframe(istream& in)
+{
+	int layerSize[2];
+	keyCell temp;
+
+	clear();
+	in.read((char*)cities, sizeof(cities));
+	in.read((char*)roads, sizeof(roads));
+	in.read((char*)units, sizeof(units));
+	in.read((char*)layerSize, sizeof(layerSize));
+
+	for(int layer = 0; layer < 2; layer++)
+	{
+		for(int i = 0; i < layerSize[layer] && in; i++)
+		{
+			in.read((char*)&temp, sizeof(keyCell));
+			if(!inside(temp.x,temp.y))
+			{
+				outside++;
+				continue;
+			}
+			if(layer == 0)
+			{
+				cityRoad[temp.y*width + temp.x] = temp.type;
+				cityRoadColor[temp.y*width + temp.x] = temp.color;
+			}
+			else
+			{
+				unit[temp.y*width + temp.x] = temp.type;
+				unitColor[temp.y*width + temp.x] = temp.color;
+			}
+		}
+	}
+}
+
+// Reads a turn record and every action up to the next turn record.
+int replayTurn(actionScanner& log, mapState& state)
+{
+	actionRecord rec;
+
+	// Skips anything before the turn record
+	do
+	{
+		if(!log.next(rec))
+		{
+			return -1;
+		}
+	} while(rec.action != turnRecord);
+
+	// Actions end at the next turn record, which is left in the log
+	int turn = rec.turn;
+	while(!log.atTurn() && log.next(rec))
+	{
+		state.apply(rec);
+	}
+	return turn;
+}
+
+actionIndex::actionIndex()
+{
+	interval = 0;
+	width = 0;
+	height = 0;
+}
+
+int actionIndex::turns()
+{
+	return turnOffset.size();
+}
+
+void growArea(const actionRecord& rec, int& width, int& height)
+{
+	if(rec.action != moveRecord && rec.action != colorRecord && rec.action != createRecord && rec.action != destroyRecord)
+	{
+		return;
+	}
+	if(rec.x >= width) width = rec.x + 1;
+	if(rec.y >= height) height = rec.y + 1;
+	if(rec.action == moveRecord)
+	{
+		if(rec.newX >= width) width = rec.newX + 1;
+		if(rec.newY >= height) height = rec.newY + 1;
+	}
+}
+
+// Scans the action list twice: once for the area its records lie in,
+// then replaying it into a mapState of that size and dumping that state
+// at the start of every interval-th turn.
+bool actionIndex::build(const char* logName, const char* indexName, int interval)
+{
+	actionLog log;
+	ofstream out(indexName, ios::binary);
+	actionRecord rec;
+	long long offset;
+	int header[5] = {0, 0, 0, 0, 0};
+	long long tableOffset = 0;
+
+	if(!log.open(logName) || !out.is_open() || interval <= 0)
+	{
+		return false;
+	}
+
+	width = 1;
+	height = 1;
+	actionScanner area(log.begin(), log.end());
+	while(area.next(rec))
+	{
+		growArea(rec, width, height);
+	}
+	mapState state(width, height);
+
+	this->interval = interval;
+	fileName = indexName;
+	turnOffset.clear();
+	keyOffset.clear();
+
+	// Header is written again once the totals are known
+	out.write(indexMagic, sizeof(indexMagic));
+	out.write((const char*)header, sizeof(header));
+	out.write((const char*)&tableOffset, sizeof(tableOffset));
+
+	actionScanner scan(log.begin(), log.end());
+	offset = scan.tell();
+	while(scan.next(rec))
+	{
+		if(!state.apply(rec))
+		{
+			if(turnOffset.size() % interval == 0)
+			{
+				keyOffset.push_back(out.tellp());
+				state.writeKeyframe(out);
+			}
+			turnOffset.push_back(offset);
+		}
+		offset = scan.tell();
+	}
+
+	tableOffset = out.tellp();
+	if(!turnOffset.empty())
+	{
+		out.write((const char*)&turnOffset[0], turnOffset.size()*sizeof(long long));
+	}
+	if(!keyOffset.empty())
+	{
+		out.write((const char*)&keyOffset[0], keyOffset.size()*sizeof(long long));
+	}
+
+	header[0] = interval;
+	header[1] = turnOffset.size();
+	header[2] = keyOffset.size();
+	header[3] = width;
+	header[4] = height;
+	out.seekp(sizeof(indexMagic));
+	out.write((const char*)header, sizeof(header));
+	out.write((const char*)&tableOffset, sizeof(tableOffset));
+	return out.good();
+}
+
+// Loads the offset tables, keyframes stay on disk until needed
+bool actionIndex::load(const char* indexName)
+{
+	ifstream in(indexName, ios::binary);
+	char magic[8];
+	int header[5] = {0, 0, 0, 0, 0};
+	long long tableOffset;
+
+	if(!in.is_open())
+	{
+		return false;
+	}
+
+	in.read(magic, sizeof(magic));
+	in.read((char*)header, sizeof(header));
+	in.read((char*)&tableOffset, sizeof(tableOffset));
+	// Older indexes lack the size and have to be built again
+	if(!in || memcmp(magic, indexMagic, sizeof(magic)) != 0 || header[0] <= 0 || header[3] <= 0 || header[4] <= 0)
+	{
+		return false;
+	}
+
+	interval = header[0];
+	width = header[3];
+	height = header[4];
+	turnOffset.resize(header[1]);
+	keyOffset.resize(header[2]);
+	in.seekg(tableOffset);
+	if(!turnOffset.empty())
+	{
+		in.read((char*)&turnOffset[0], turnOffset.size()*sizeof(long long));
+	}
+	if(!keyOffset.empty())
+	{
+		in.read((char*)&keyOffset[0], keyOffset.size()*sizeof(long long));
+	}
+	fileName = indexName;
+	return in.good();
+}
+
+int actionIndex::seek(int turn, actionScanner& log, mapState& state)
+{
+	if(turn < 0 || turn >= turns() || keyOffset.empty())
+	{
+		return -1;
+	}
+
+	unsigned int key = turn / interval;
+	if(key >= keyOffset.size())
+	{
+		key = keyOffset.size() - 1;
+	}
+	keyframe(key, state);
+
+	log.seek(turnOffset[key*interval]);
+
+	// The keyframe is taken before its turn line so that turn is replayed too
+	int replayed;
+	do
+	{
+		replayed = replayTurn(log, state);
+	} while(replayed >= 0 && replayed < turn);
+	return replayed;
+}
+
+bool actionIndex::keyframe(int key, mapState& state)
+{
+	if(key < 0 || key >= (int)keyOffset.size())
+	{
+		return false;
+	}
+	ifstream in(fileName.c_str(), ios::binary);
+	in.seekg(keyOffset[key]);
+	state.readKeyframe(in);
+	return in.good();
+}
@@ -0,0 +1,101 @@
+////////////////////////////////////////////////////////
+// File name: mapstate.h
+// Description: Header file for the mapState and actionIndex classes.
+// mapState holds the city/road and unit layers that are rebuilt
+// from the action list. actionIndex is the side index of an action
+// list (turn number -> byte offset, plus full-state keyframes every
+// K turns) which lets a viewer jump to any turn by restoring the
+// nearest keyframe and replaying at most K turns.
+//
+#ifndef MAPSTATE_H
+#define MAPSTATE_H
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <string>
+#include "actionlog.h"
+
+using namespace std;
+
+#define maxPlayerColor 16	// Colors are 0-7, leave room for the bold set
+
+//mapState - contents of the city/road and unit layers at one point of a run
+class mapState
+{
+public:
+//Constructor-requires the size of the map that will be replayed,
+//records outside it are only counted (see outside)
+mapState(int sizeX, int sizeY);
+//Empties both layers and resets all counters
+void clear();
+//Applies one record of the action list, returns false for turn records
+bool apply(const actionRecord& rec);
+//Writes the full state in the keyframe format
+void writeKeyframe(ostream& out);
+//Restores the full state from the keyframe format
+void readKeyframe(istream& in);
+
+int width, height;
+//Layer 1, 'C' for a city, 'R' for a road, 0 for nothing
+vector <char> cityRoad;
+//Layer 2, 'U' for an army, 0 for nothing
+vector <char> unit;
+//Owner colors of both layers
+vector <int> cityRoadColor;
+vector <int> unitColor;
+//Totals per player color
+int cities[maxPlayerColor];
+int roads[maxPlayerColor];
+int units[maxPlayerColor];
+//Destroy actions applied so far, not part of a keyframe
+long long destroyed;
+//Records and keyframe cells that fell outside the state and were left
+//out, a sign that the state is smaller than the map of the run
+long long outside;
+
+private:
+//Adds n to one of the per color totals
+void count(int* total, int color, int n);
+//Checks that a position is inside the replayed area
+bool inside(int x, int y);
+};
+
+//actionIndex - turn offsets and keyframes of one action list
+class actionIndex
+{
+public:
+actionIndex();
+//Scans an action list and writes its index file.
+//A keyframe is stored every interval turns, of a state just large
+//enough for every record of the log.
+bool build(const char* logName, const char* indexName, int interval);
+//Reads the turn offsets and keyframe directory of an index file
+bool load(const char* indexName);
+//Rebuilds the state at the end of turn from the closest keyframe,
+//replaying at most interval turns. log is left at the next turn line.
+//Returns turn or -1 if the turn is not indexed.
+int seek(int turn, actionScanner& log, mapState& state);
+//Restores keyframe key, the state before the turn line key*interval.
+//Returns false if there is no such keyframe.
+bool keyframe(int key, mapState& state);
+//Number of turn lines in the action list
+int turns();
+
+int interval; //Turns between two keyframes
+int width, height; //Size of the keyframes, every record of the log lies inside
+vector <long long> turnOffset; //Byte offset of each turn line
+vector <long long> keyOffset; //Offset of each keyframe in the index file
+
+private:
+string fileName;
+};
+
+//Grows width and height to take in the cells rec touches
+void growArea(const actionRecord& rec, int& width, int& height);
+
+//Reads one turn line and all of its actions from log into state.
+//Returns the turn number or -1 at the end of the log.
+int replayTurn(actionScanner& log, mapState& state);
+
+#endif
@@ -0,0 +1,465 @@
+////////////////////////////////////////////////////////
+// File name: mapview.cpp
+// Description: Renderer shared by printmap and civsim. Draws the
+// terrain of a map with the city/road and unit layers of a mapState
+// on top, in the colors set in the config file, through curses or
+// an ansiScreen.
+//
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <curses.h>
+#include "mapview.h"
+using namespace std;
+
+// Display settings from the config file
+int player1Color, player2Color;
+char landChar, mountainChar, forestChar, oceanChar, riverChar;
+int landColor, mountainColor, forestColor, oceanColor, riverColor;
+int landBGColor, mountainBGColor, forestBGColor, oceanBGColor, riverBGColor;
+char soundEnable;
+// ANSI terminal, NULL when curses draws
+ansiScreen* screen = NULL;
+
+void colorText(char input) {
+	if (input == landChar) {
+		attron(COLOR_PAIR(50));
+		addch(input);
+		attroff(COLOR_PAIR(50));
+	} else if (input == mountainChar) {
+		attron(COLOR_PAIR(51));
+		addch(input);
+		attroff(COLOR_PAIR(51));
+	} else if (input == forestChar) {
+		attron(COLOR_PAIR(52));
+		addch(input);
+		attroff(COLOR_PAIR(52));
+	} else if (input == oceanChar) {
+		attron(COLOR_PAIR(53));
+		addch(input);
+		attroff(COLOR_PAIR(53));
+	} else if (input == riverChar) {
+		attron(COLOR_PAIR(54));
+		addch(input);
+		attroff(COLOR_PAIR(54));
+	} else {
+		cout<<"?";
+	}
+}
+
+void colorObject(char input, int color, char BGChar) {
+	if (BGChar == mountainChar) {
+		color += 10;
+	} else if (BGChar == forestChar) {
+		color += 20;
+	} else if (BGChar == oceanChar) {
+		color += 30;
+	} else if (BGChar == riverChar) {
+		color += 40;
+	}
+	attron(COLOR_PAIR(color));
+	addch(input | A_BOLD);
+	attroff(COLOR_PAIR(color));
+}
+
+void addCount(int count) {
+	addch((int)(count/100) + '0');
+	addch((int)((count%100)/10) + '0');
+	addch(((count%100)%10) + '0');
+}
+
+// Background color of a terrain character
+int terrainBG(char input) {
+	if (input == mountainChar) return mountainBGColor;
+	if (input == forestChar) return forestBGColor;
+	if (input == oceanChar) return oceanBGColor;
+	if (input == riverChar) return riverBGColor;
+	return landBGColor;
+}
+
+// drawFrame for the ANSI terminal, the colors are the ones of the curses pairs
+void drawAnsiFrame(const mapFile& terrain, mapState& state, int turn) {
+	char line[128];
+	int headerBG[2];
+	int colors[2] = {player1Color, player2Color};
+	for (int p = 0; p < 2; p++) headerBG[p] = colors[p] == COLOR_WHITE ? COLOR_BLACK : COLOR_WHITE;
+	
+	screen->move(0, 0);
+	snprintf(line, sizeof(line), "Player 1 Cities: %03d Roads: %03d Units: %03d", state.cities[player1Color] % 1000,
+		state.roads[player1Color] % 1000, state.units[player1Color] % 1000);
+	screen->text(line, player1Color, headerBG[0], false);
+	snprintf(line, sizeof(line), "  Player 2 Cities: %03d Roads: %03d Units: %03d", state.cities[player2Color] % 1000,
+		state.roads[player2Color] % 1000, state.units[player2Color] % 1000);
+	screen->text(line, player2Color, headerBG[1], false);
+	screen->clearToEnd();
+	
+	int x, y;
+	for (y = 0; y < terrain.height; y++) {
+		for (x = 0; x < terrain.width; x++) {
+			char temp = terrain.at(x,y);
+			int cell = y*state.width + x;
+			bool inside = x < state.width && y < state.height;
+			if (inside && state.unit[cell]) {
+				screen->put(x, y+1, state.unit[cell], state.unitColor[cell] % 8, terrainBG(temp), true);
+			} else if (inside && state.cityRoad[cell]) {
+				screen->put(x, y+1, state.cityRoad[cell], state.cityRoadColor[cell] % 8, terrainBG(temp), true);
+			} else if (temp == landChar) {
+				screen->put(x, y+1, temp, landColor, landBGColor, false);
+			} else if (temp == mountainChar) {
+				screen->put(x, y+1, temp, mountainColor, mountainBGColor, false);
+			} else if (temp == forestChar) {
+				screen->put(x, y+1, temp, forestColor, forestBGColor, false);
+			} else if (temp == oceanChar) {
+				screen->put(x, y+1, temp, oceanColor, oceanBGColor, false);
+			} else if (temp == riverChar) {
+				screen->put(x, y+1, temp, riverColor, riverBGColor, false);
+			} else {
+				screen->put(x, y+1, '?', ansiDefaultColor, ansiDefaultColor, false);
+			}
+		}
+	}
+	
+	screen->move(0, y+1);
+	screen->clearToEnd();
+	snprintf(line, sizeof(line), "Turn %d  ", turn);
+	screen->text(line, ansiDefaultColor, ansiDefaultColor, false);
+}
+
+// Draws the terrain with the city/road and unit layers on top of it
+// followed by the start of a status line, the caller adds the rest and refreshes
+void drawFrame(const mapFile& terrain, mapState& state, int turn) {
+	if (screen) {
+		drawAnsiFrame(terrain, state, turn);
+		return;
+	}
+	move(0,0);
+	attron(COLOR_PAIR(player1Color+100));
+	addstr("Player 1 Cities: ");
+	addCount(state.cities[player1Color]);
+	addstr(" Roads: ");
+	addCount(state.roads[player1Color]);
+	addstr(" Units: ");
+	addCount(state.units[player1Color]);
+	attroff(COLOR_PAIR(player1Color+100));
+	
+	attron(COLOR_PAIR(player2Color+100));
+	addstr("  Player 2 Cities: ");
+	addCount(state.cities[player2Color]);
+	addstr(" Roads: ");
+	addCount(state.roads[player2Color]);
+	addstr(" Units: ");
+	addCount(state.units[player2Color]);
+	addch('\n');
+	attroff(COLOR_PAIR(player2Color+100));
+	
+	int x, y;
+	for (y = 0; y < terrain.height; y++) {
+		move(y+1,0);
+		for (x = 0; x < terrain.width; x++) {
+			char temp = terrain.at(x,y);
+			int cell = y*state.width + x;
+			if (x < state.width && y < state.height && state.unit[cell]) {
+				colorObject(state.unit[cell], state.unitColor[cell], temp);
+			} else if (x < state.width && y < state.height && state.cityRoad[cell]) {
+				colorObject(state.cityRoad[cell], state.cityRoadColor[cell], temp);
+			} else {
+				colorText(temp);
+			}
+		}
+	}
+	
+	move(y+1,0);
+	clrtoeol();
+	printw("Turn %d  ", turn);
+}
+
+// Reads the display settings. A binary map's legend replaces the
+// terrain characters of the config.
+// Returns false if the config file cannot be read.
+bool readDisplayConfig(const mapFile& terrain) {
+	ifstream config("./config");
+	
+	string configParams[18] = {
+		"player1_color",
+		"player2_color",
+        "plains_character",
+		"plains_color",
+		"plains_BG_color",
+        "mountain_character",
+		"mountain_color",
+		"mountain_BG_color",
+        "forest_character",
+		"forest_color",
+		"forest_BG_color",
+        "ocean_character",
+		"ocean_color",
+		"ocean_BG_color",
+        "river_character",
+		"river_color",
+		"river_BG_color",
+        "sound_enable"
+    };
+	
+	for (int i = 0; i < 18;i++) {
+        if(config.eof()) break;
+        
+		string line;
+        getline(config, line);
+		
+		int lineLocation;
+		int lineEnd;
+        
+        lineLocation = line.find(configParams[i]);
+        
+        if(lineLocation >= 0) {
+            lineLocation = line.find_first_of(39);   //look for apostrophe
+            lineEnd = line.find_last_of(39);
+            istringstream tempStream(line.substr(lineLocation+1, lineEnd-lineLocation-1));
+            switch(i) {
+                case 0:
+                    tempStream >> player1Color;
+                    break;
+                case 1:
+                    tempStream >> player2Color;
+                    break;
+                case 2:
+                    tempStream >> landChar;
+                    break;
+                case 3:
+                    tempStream >> landColor;
+                    break;
+                case 4:
+                    tempStream >> landBGColor;
+                    break;
+                case 5:
+                    tempStream >> mountainChar;
+                    break;
+                case 6:
+                    tempStream >> mountainColor;
+                    break;
+                case 7:
+                    tempStream >> mountainBGColor;
+                    break;
+                case 8:
+                    tempStream >> forestChar;
+                    break;
+                case 9:
+                    tempStream >> forestColor;
+                    break;
+                case 10:
+                    tempStream >> forestBGColor;
+                    break;
+                case 11:
+                    tempStream >> oceanChar;
+                    break;
+                case 12:
+                    tempStream >> oceanColor;
+                    break;
+                case 13:
+                    tempStream >> oceanBGColor;
+                    break;
+                case 14:
+                    tempStream >> riverChar;
+                    break;
+                case 15:
+                    tempStream >> riverColor;
+                    break;
+                case 16:
+                    tempStream >> riverBGColor;
+                    break;
+                case 17:
+                    tempStream >> soundEnable;
+                    break;
+                default:
+                    cerr << "MapCreate: Error: Something went wrong while parsing.";
+            }
+        } else i--;
+    }
+  	
+	char* legend[legendSize] = {&oceanChar, &landChar, &mountainChar, &forestChar, &riverChar};
+	for (int i = 0; i < legendSize; i++) {
+		if (legend[i] && terrain.legend[i]) *legend[i] = terrain.legend[i];
+	}
+	return !config.fail();
+}
+
+// Reads the display settings, starts curses and sets up the color pairs,
+// or the ANSI terminal if ansi is set.
+// Returns false if the config file cannot be read.
+bool startView(const mapFile& terrain, bool ansi) {
+	bool configRead = readDisplayConfig(terrain);
+	
+	if (ansi) {
+		screen = new ansiScreen;
+		screen->start();
+		return configRead;
+	}
+	
+	initscr();
+	
+	start_color();			/* Start color 			*/
+  	
+  	init_pair(0, COLOR_BLACK, landBGColor);
+    init_pair(1, COLOR_RED, landBGColor);
+    init_pair(2, COLOR_GREEN, landBGColor);
+    init_pair(3, COLOR_YELLOW, landBGColor);
+    init_pair(4, COLOR_BLUE, landBGColor);
+    init_pair(5, COLOR_MAGENTA, landBGColor);
+    init_pair(6, COLOR_CYAN, landBGColor);
+    init_pair(7, COLOR_WHITE, landBGColor);
+    
+    init_pair(10, COLOR_BLACK, mountainBGColor);
+    init_pair(11, COLOR_RED, mountainBGColor);
+    init_pair(12, COLOR_GREEN, mountainBGColor);
+    init_pair(13, COLOR_YELLOW, mountainBGColor);
+    init_pair(14, COLOR_BLUE, mountainBGColor);
+    init_pair(15, COLOR_MAGENTA, mountainBGColor);
+    init_pair(16, COLOR_CYAN, mountainBGColor);
+    init_pair(17, COLOR_WHITE, mountainBGColor);
+    
+    init_pair(20, COLOR_BLACK, forestBGColor);
+    init_pair(21, COLOR_RED, forestBGColor);
+    init_pair(22, COLOR_GREEN, forestBGColor);
+    init_pair(23, COLOR_YELLOW, forestBGColor);
+    init_pair(24, COLOR_BLUE, forestBGColor);
+    init_pair(25, COLOR_MAGENTA, forestBGColor);
+    init_pair(26, COLOR_CYAN, forestBGColor);
+    init_pair(27, COLOR_WHITE, forestBGColor);
+    
+    init_pair(30, COLOR_BLACK, oceanBGColor);
+    init_pair(31, COLOR_RED, oceanBGColor);
+    init_pair(32, COLOR_GREEN, oceanBGColor);
+    init_pair(33, COLOR_YELLOW, oceanBGColor);
+    init_pair(34, COLOR_BLUE, oceanBGColor);
+    init_pair(35, COLOR_MAGENTA, oceanBGColor);
+    init_pair(36, COLOR_CYAN, oceanBGColor);
+    init_pair(37, COLOR_WHITE, oceanBGColor);
+    
+    init_pair(40, COLOR_BLACK, riverBGColor);
+    init_pair(41, COLOR_RED, riverBGColor);
+    init_pair(42, COLOR_GREEN, riverBGColor);
+    init_pair(43, COLOR_YELLOW, riverBGColor);
+    init_pair(44, COLOR_BLUE, riverBGColor);
+    init_pair(45, COLOR_MAGENTA, riverBGColor);
+    init_pair(46, COLOR_CYAN, riverBGColor);
+    init_pair(47, COLOR_WHITE, riverBGColor);
+    
+    init_pair(50, landColor, landBGColor);
+  	init_pair(51, mountainColor, mountainBGColor);
+  	init_pair(52, forestColor, forestBGColor);
+  	init_pair(53, oceanColor, oceanBGColor);
+  	init_pair(54, riverColor, riverBGColor);
+  	
+  	init_pair(100, COLOR_BLACK, COLOR_WHITE);
+  	init_pair(101, COLOR_RED, COLOR_WHITE);
+  	init_pair(102, COLOR_GREEN, COLOR_WHITE);
+  	init_pair(103, COLOR_YELLOW, COLOR_WHITE);
+  	init_pair(104, COLOR_BLUE, COLOR_WHITE);
+  	init_pair(105, COLOR_MAGENTA, COLOR_WHITE);
+  	init_pair(106, COLOR_CYAN, COLOR_WHITE);
+  	init_pair(107, COLOR_WHITE, COLOR_BLACK);
+	
+	keypad(stdscr, TRUE);
+	noecho();
+	return configRead;
+}
+
+// True if the config asks for a beep when a unit is destroyed
+bool soundOn() {
+	return soundEnable == 'Y' || soundEnable == 'y';
+}
+
+// Adds text to the status line and shows the frame
+void showStatus(const char* text) {
+	if (screen) {
+		screen->text(text, ansiDefaultColor, ansiDefaultColor, false);
+		screen->present();
+		return;
+	}
+	printw("%s", text);
+	refresh();
+}
+
+void viewBeep() {
+	if (!soundOn()) return;
+	if (screen) screen->beep();
+	else beep();
+}
+
+// Waits up to milliseconds for a key, forever if negative
+int waitKey(int milliseconds) {
+	if (screen) return screen->readKey(milliseconds);
+	timeout(milliseconds);
+	int key = getch();
+	switch (key) {
+		case ERR: return viewNoKey;
+		case KEY_LEFT: return viewKeyLeft;
+		case KEY_RIGHT: return viewKeyRight;
+		case KEY_HOME: return viewKeyHome;
+		case KEY_END: return viewKeyEnd;
+	}
+	return key;
+}
+
+// Asks for a number on the last line of the terminal
+int promptNumber(const char* prompt) {
+	char input[16];
+	if (screen) {
+		int length = 0;
+		int key = 0;
+		while (key != '\n' && key != '\r') {
+			input[length] = 0;
+			screen->move(0, screen->height-1);
+			screen->clearToEnd();
+			screen->text(prompt, ansiDefaultColor, ansiDefaultColor, false);
+			screen->text(input, ansiDefaultColor, ansiDefaultColor, false);
+			screen->present();
+			key = screen->readKey(-1);
+			if ((key == 127 || key == 8) && length > 0) length--;
+			else if (key >= '0' && key <= '9' && length < (int)sizeof(input)-1) input[length++] = key;
+		}
+		input[length] = 0;
+		screen->move(0, screen->height-1);
+		screen->clearToEnd();
+	} else {
+		int y, x;
+		getmaxyx(stdscr, y, x);
+		move(y-1, 0);
+		clrtoeol();
+		printw("%s", prompt);
+		echo();
+		timeout(-1);
+		getnstr(input, sizeof(input)-1);
+		noecho();
+		move(y-1, 0);
+		clrtoeol();
+	}
+	if (input[0] < '0' || input[0] > '9') return -1;
+	return atoi(input);
+}
+
+// Gives the terminal back
+void stopView() {
+	if (screen) {
+		screen->end();
+		delete screen;
+		screen = NULL;
+	} else {
+		endwin();
+	}
+}
+
+// Gives the terminal back and prints the final totals of both players
+void endView(mapState& state) {
+	stopView();
+	printTotals(state);
+}
+
+void printTotals(mapState& state) {
+	cout<<"Player 1 [Cities: "<<state.cities[player1Color]<<"][Roads: "<<state.roads[player1Color]<<"][Units: "<<
+	state.units[player1Color]<<"]"<<endl<<"Player 2 [Cities: "<<state.cities[player2Color]<<"][Roads: "<<
+	state.roads[player2Color]<<"][Units: "<<state.units[player2Color]<<"]"<<endl;
+}
@@ -0,0 +1,49 @@
+////////////////////////////////////////////////////////
+// File name: mapview.h
+// Description: Header file for the map renderer used by printmap and
+// civsim. startView reads the display settings from the config file
+// and sets up the terminal, drawFrame draws one turn and endView
+// restores the terminal and prints the final totals. The terminal is
+// driven by curses, or with ansi set by an ansiScreen, which only
+// sends the cells that changed since the last frame.
+//
+#ifndef MAPVIEW_H
+#define MAPVIEW_H
+
+#include "mapstate.h"
+#include "mapfile.h"
+#include "ansiscreen.h"
+
+//Keys of waitKey besides plain characters
+#define viewNoKey ansiNoKey
+#define viewKeyLeft ansiKeyLeft
+#define viewKeyRight ansiKeyRight
+#define viewKeyHome ansiKeyHome
+#define viewKeyEnd ansiKeyEnd
+
+//Reads the display settings, false if the config is missing
+bool readDisplayConfig(const mapFile& terrain);
+//Reads the display settings and takes over the terminal, with curses
+//or as an ANSI terminal. False if the config is missing.
+bool startView(const mapFile& terrain, bool ansi = false);
+//Draws the map, both layers and the player totals, then starts the
+//status line with the turn number. The caller finishes it and refreshes.
+void drawFrame(const mapFile& terrain, mapState& state, int turn);
+//True if the config asks for a beep when a unit is destroyed
+bool soundOn();
+//Adds text to the status line and shows the frame
+void showStatus(const char* text);
+//Beeps if the config asks for sound
+void viewBeep();
+//Waits up to milliseconds for a key (forever if negative), viewNoKey if none came
+int waitKey(int milliseconds);
+//Asks for a number on the last line, -1 if none was typed
+int promptNumber(const char* prompt);
+//Gives the terminal back
+void stopView();
+//Gives the terminal back and prints the final totals of both players
+void endView(mapState& state);
+//Prints the final totals of both players
+void printTotals(mapState& state);
+
+#endif
@@ -0,0 +1,582 @@
+#include <math.h>
+#include <time.h>
+#include "noisecreator.h"
+#include "trace.h"
+#include "perfcount.h"
+
+
+using namespace std;
+
+//Share of the agent steps that end up as new terrain. Agent walks only step onto
+//subChar cells and box themselves in quickly, so most steps are lost. Fitted on
+//maps made by the agent generator with the default config.
+static const double landYield = 0.15;
+static const double featureYield = 0.08;
+
+//Function:
+//     noiseCreator (constructor)
+//
+//Description:
+//      Initializes noise map creation data, no map memory is taken until
+//      createMap or streamMap
+//
+//Preconditions:
+//      None
+//
+//Arguments:
+//      unsigned int x - longways map dimension
+//      unsigned int y - heightways map dimension
+//
+//Postconditions:
+//      Creation variables initialized
+//
+//Returns:
+//      None
+//
+noiseCreator::noiseCreator(unsigned int x, unsigned int y)
+{
+    m_map_x = x;
+    m_map_y = y;
+    m_map = 0;
+    m_bandBuffer = 0;
+    m_bandTop = 0;
+
+    m_oceanChar = '~';
+    m_landChar = 'L';
+    m_mountainChar = '^';
+    m_forestChar = '*';
+    m_landRatio = 0.5;
+    m_mountainRatio = 0.2;
+    m_forestRatio = 0.2;
+
+    m_seed = time(NULL);
+    m_threads = std::thread::hardware_concurrency();
+    if(m_threads == 0) m_threads = 1;
+}
+
+//Function:
+//     noiseCreator (destructor)
+//
+//Description:
+//      Deletes map allocated with 'new'
+//
+//Preconditions:
+//      Constructor was called
+//
+//Arguments:
+//      None
+//
+//Postconditions:
+//      Memory free, no leaks
+//
+//Returns:
+//      None
+//
+noiseCreator::~noiseCreator()
+{
+    delete [] m_map;
+}
+
+void noiseCreator::setSeed(unsigned int seed)
+{
+    m_seed = seed;
+}
+
+void noiseCreator::setThreads(unsigned int threads)
+{
+    m_threads = threads > 0 ? threads : 1;
+}
+
+void noiseCreator::setTerrain(char oceanChar, char landChar, char mountainChar, char forestChar)
+{
+    m_oceanChar = oceanChar;
+    m_landChar = landChar;
+    m_mountainChar = mountainChar;
+    m_forestChar = forestChar;
+}
+
+//Function:
+//     setFrequencies
+//
+//Description:
+//      Turns the agent generator's config values into terrain ratios, so both
+//      generators give comparable amounts of land, mountain and forest. An agent
+//      feature covers 1 - exp(-agents * life * yield / available cells) of the cells
+//      it may grow on, mountains and forests grow on land.
+//
+//Preconditions:
+//      None
+//
+//Arguments:
+//      Agent counts and frequencies (average agent life is half the frequency)
+//
+//Postconditions:
+//      m_landRatio, m_mountainRatio and m_forestRatio are set
+//
+//Returns:
+//      None
+//
+void noiseCreator::setFrequencies(int landAgentNum, int landFrequency, int mountainAgentNum, int mountainFrequency, int forestAgentNum, int forestFrequency)
+{
+    double cells = (double)m_map_x*m_map_y;
+    if(cells <= 0) return;
+
+    m_landRatio = 1 - exp(-(double)landAgentNum*landFrequency/2*landYield/cells);
+
+    double landCells = m_landRatio*cells;
+    if(landCells < 1) landCells = 1;
+    m_mountainRatio = 1 - exp(-(double)mountainAgentNum*mountainFrequency/2*featureYield/landCells);
+
+    double plainsCells = landCells*(1 - m_mountainRatio);
+    if(plainsCells < 1) plainsCells = 1;
+    m_forestRatio = (1 - m_mountainRatio)*(1 - exp(-(double)forestAgentNum*forestFrequency/2*featureYield/plainsCells));
+}
+
+//Lattice value hash, noiseLanes lattice columns of one lattice row at once
+static inline noiseFloat latticeValue(noiseUint xi, unsigned int yi, unsigned int salt)
+{
+    noiseUint h = (xi*0x27d4eb2dU) ^ (yi*0x165667b1U + salt);
+    h ^= h >> 15;
+    h *= 0x2c1b3c6dU;
+    h ^= h >> 12;
+    h *= 0x297a2d39U;
+    h ^= h >> 15;
+    return __builtin_convertvector(h >> 8, noiseFloat) * (1.0f/16777216.0f);
+}
+
+//Function:
+//     noiseRow
+//
+//Description:
+//      Fractal value noise of one map row: noiseOctaves octaves, each twice the
+//      frequency and half the amplitude of the one before. The kernel works on
+//      noiseLanes cells at a time with GCC vector types, which become SSE/AVX
+//      instructions on x86.
+//
+//Preconditions:
+//      out holds m_map_x rounded up to noiseLanes floats
+//
+//Arguments:
+//      unsigned int y - map row
+//      unsigned int salt - separates the height map from the moisture map
+//      float* out - noise values in [0,1)
+//
+//Postconditions:
+//      out is filled
+//
+//Returns:
+//      None
+//
+void noiseCreator::noiseRow(unsigned int y, unsigned int salt, float* out)
+{
+    unsigned int width = (m_map_x + noiseLanes - 1) / noiseLanes * noiseLanes;
+    float amplitude = 1.0f;
+    float total = 0.0f;
+    noiseFloat lane;
+
+    for(int i = 0; i < noiseLanes; i++) lane[i] = i;
+    memset(out, 0, width*sizeof(float));
+
+    for(int octave = 0; octave < noiseOctaves; octave++)
+    {
+        float frequency = (float)(1 << octave) / noisePeriod;
+        unsigned int octaveSalt = salt + m_seed*0x9E3779B9U + octave*0x85EBCA6BU;
+
+        float fy = y*frequency;
+        unsigned int yi = (unsigned int)fy;
+        float ty = fy - yi;
+        float v = ty*ty*(3 - 2*ty);
+
+        for(unsigned int x = 0; x < width; x += noiseLanes)
+        {
+            noiseFloat fx = (lane + (float)x)*frequency;
+            noiseInt xi = __builtin_convertvector(fx, noiseInt);
+            noiseFloat tx = fx - __builtin_convertvector(xi, noiseFloat);
+            noiseFloat u = tx*tx*(3.0f - 2.0f*tx);
+            noiseUint ux = (noiseUint)xi;
+
+            noiseFloat a = latticeValue(ux, yi, octaveSalt);
+            noiseFloat b = latticeValue(ux + 1, yi, octaveSalt);
+            noiseFloat c = latticeValue(ux, yi + 1, octaveSalt);
+            noiseFloat d = latticeValue(ux + 1, yi + 1, octaveSalt);
+
+            noiseFloat top = a + (b - a)*u;
+            noiseFloat bottom = c + (d - c)*u;
+            noiseFloat value;
+            memcpy(&value, out + x, sizeof(value));
+            value += (top + (bottom - top)*v)*amplitude;
+            memcpy(out + x, &value, sizeof(value));
+        }
+
+        total += amplitude;
+        amplitude *= 0.5f;
+    }
+
+    for(unsigned int x = 0; x < width; x++) out[x] /= total;
+}
+
+//Function:
+//     findThresholds
+//
+//Description:
+//      Places the ocean, mountain and forest levels at the quantiles of the height
+//      and moisture maps that give the wanted ratios. Histograms are built from
+//      evenly spaced sample rows so this stays cheap on huge maps.
+//
+//Preconditions:
+//      setFrequencies was called if the config ratios are wanted
+//
+//Arguments:
+//      None
+//
+//Postconditions:
+//      m_oceanLevel, m_mountainLevel and m_forestLevel are set
+//
+//Returns:
+//      None
+//
+void noiseCreator::findThresholds()
+{
+    unsigned int width = (m_map_x + noiseLanes - 1) / noiseLanes * noiseLanes;
+    vector<float> height(width), moisture(width);
+    vector<double> heights(noiseBins, 0), plainsMoisture(noiseBins, 0);
+    unsigned int stride = m_map_y / 1024 + 1;
+    double samples = 0;
+    double plainsSamples = 0;
+
+    for(unsigned int y = 0; y < m_map_y; y += stride)
+    {
+        noiseRow(y, 0, &height[0]);
+        for(unsigned int x = 0; x < m_map_x; x++) heights[(int)(height[x]*noiseBins)]++;
+        samples += m_map_x;
+    }
+
+    double wanted[2] = {1 - m_landRatio, 1 - m_landRatio*m_mountainRatio};
+    float* level[2] = {&m_oceanLevel, &m_mountainLevel};
+    for(int t = 0; t < 2; t++)
+    {
+        *level[t] = quantile(heights, wanted[t]*samples);
+    }
+
+    //Forest level from the moisture of the sampled cells that are neither ocean nor mountain
+    for(unsigned int y = 0; y < m_map_y; y += stride)
+    {
+        noiseRow(y, 0, &height[0]);
+        noiseRow(y, 1, &moisture[0]);
+        for(unsigned int x = 0; x < m_map_x; x++)
+        {
+            if(height[x] < m_oceanLevel || height[x] >= m_mountainLevel) continue;
+            plainsMoisture[(int)(moisture[x]*noiseBins)]++;
+            plainsSamples++;
+        }
+    }
+
+    double forestShare = m_mountainRatio < 1 ? m_forestRatio/(1 - m_mountainRatio) : 0;
+    m_forestLevel = quantile(plainsMoisture, (1 - forestShare)*plainsSamples);
+}
+
+//Function:
+//     quantile
+//
+//Description:
+//      Finds the value with (about) below samples of a histogram under it
+//
+//Preconditions:
+//      histogram has noiseBins bins over [0,1)
+//
+//Arguments:
+//      histogram - sample counts per bin
+//      below - number of samples wanted under the returned value
+//
+//Postconditions:
+//      None
+//
+//Returns:
+//      Lower edge of the first bin that would go over below
+//
+float noiseCreator::quantile(const vector<double>& histogram, double below)
+{
+    double counted = 0;
+    int bin = 0;
+    while(bin < noiseBins && counted + histogram[bin] <= below)
+    {
+        counted += histogram[bin];
+        bin++;
+    }
+    return (float)bin / noiseBins;
+}
+
+//Function:
+//     classifyRows
+//
+//Description:
+//      Computes the height and moisture of rows first, first + step... of a run
+//      of count map rows and writes their terrain characters and newlines
+//
+//Preconditions:
+//      findThresholds was called
+//
+//Arguments:
+//      rows - buffer row of map row top
+//      top - map row of the first buffer row
+//      count - rows in the run
+//      first, step - rows handled by this call
+//
+//Postconditions:
+//      Those rows of the buffer are filled
+//
+//Returns:
+//      None
+//
+void noiseCreator::classifyRows(char* rows, long long top, long long count, unsigned int first, unsigned int step)
+{
+    traceSpan span("classify rows", "first", first);
+    unsigned int width = (m_map_x + noiseLanes - 1) / noiseLanes * noiseLanes;
+    long long rowLength = m_map_x + 1;
+    vector<float> height(width), moisture(width);
+
+    for(long long i = first; i < count; i += step)
+    {
+        char* row = rows + i*rowLength;
+        noiseRow(top + i, 0, &height[0]);
+        noiseRow(top + i, 1, &moisture[0]);
+
+        for(unsigned int x = 0; x < m_map_x; x++)
+        {
+            if(height[x] < m_oceanLevel) row[x] = m_oceanChar;
+            else if(height[x] >= m_mountainLevel) row[x] = m_mountainChar;
+            else if(moisture[x] >= m_forestLevel) row[x] = m_forestChar;
+            else row[x] = m_landChar;
+        }
+        row[m_map_x] = '\n';
+    }
+}
+
+//Function:
+//     smoothRows
+//
+//Description:
+//      One smoothing pass over rows first, first + step... of a run of count map
+//      rows. The passes follow the agent generator: land over ocean twice, then
+//      mountain and forest over land once. Cells draw their random values from
+//      their map location, so a row comes out the same in whichever band it is.
+//
+//Preconditions:
+//      source has a readable row above and below the run
+//
+//Arguments:
+//      source - buffer row of map row top before the pass
+//      dest - buffer row of map row top after the pass
+//      top - map row of the first buffer row
+//      count - rows in the run
+//      first, step - rows handled by this call
+//      pass - smoothing pass, 0 to noiseSmoothPasses - 1
+//
+//Postconditions:
+//      Those rows of dest are filled
+//
+//Returns:
+//      None
+//
+void noiseCreator::smoothRows(const char* source, char* dest, long long top, long long count, unsigned int first, unsigned int step, int pass)
+{
+    traceSpan span("smooth rows", "pass", pass);
+    const char featureChar[noiseSmoothPasses] = {m_landChar, m_landChar, m_mountainChar, m_forestChar};
+    const char subChar[noiseSmoothPasses] = {m_oceanChar, m_oceanChar, m_landChar, m_landChar};
+    unsigned long long passKey = ((unsigned long long)m_seed << 32) | pass;
+    long long rowLength = m_map_x + 1;
+    vector<unsigned char> weight(rowLength + 16);
+
+    for(long long i = first; i < count; i += step)
+    {
+        memcpy(dest + i*rowLength, source + i*rowLength, rowLength);
+        terrainCreator::smoothRow(source + i*rowLength, rowLength, dest + i*rowLength, &weight[0],
+                                  featureChar[pass], subChar[pass], passKey, (top + i)*rowLength);
+    }
+}
+
+//Function:
+//     createBand
+//
+//Description:
+//      Builds map rows firstRow to lastRow. Every smoothing pass reads the rows
+//      next to a cell, so a wrong row at the edge of the buffer spoils one more
+//      row per pass. The band is therefore built with noiseSmoothPasses halo rows
+//      on each side (fewer at the edges of the map, where newline rows stand in
+//      for the outside as in terrainCreator::smoothFeature) and the halo is
+//      thrown away. Rows are dealt out round robin to m_threads threads.
+//
+//Preconditions:
+//      findThresholds was called, firstRow < lastRow <= map height
+//
+//Arguments:
+//      firstRow, lastRow - map rows of the band, lastRow not included
+//
+//Postconditions:
+//      m_band[m_bandBuffer] holds map rows m_bandTop... behind one newline row
+//
+//Returns:
+//      None
+//
+void noiseCreator::createBand(long long firstRow, long long lastRow)
+{
+    traceSpan span("band", "row", firstRow);
+    perfSection counters("noise band", (lastRow - firstRow)*m_map_x);
+    long long rowLength = m_map_x + 1;
+    long long top = firstRow > noiseSmoothPasses ? firstRow - noiseSmoothPasses : 0;
+    long long bottom = lastRow + noiseSmoothPasses < m_map_y ? lastRow + noiseSmoothPasses : m_map_y;
+    long long count = bottom - top;
+    unsigned int threads = m_threads < count ? m_threads : count;
+    vector<thread> workers;
+
+    for(int b = 0; b < 2; b++)
+    {
+        m_band[b].resize((count + 2)*rowLength);
+        memset(&m_band[b][0], '\n', rowLength);
+        memset(&m_band[b][(count + 1)*rowLength], '\n', rowLength);
+    }
+
+    for(unsigned int t = 1; t < threads; t++)
+    {
+        workers.push_back(thread(&noiseCreator::classifyRows, this, &m_band[0][rowLength], top, count, t, threads));
+    }
+    classifyRows(&m_band[0][rowLength], top, count, 0, threads);
+    for(unsigned int t = 0; t < workers.size(); t++)
+    {
+        workers[t].join();
+    }
+
+    int current = 0;
+    for(int pass = 0; pass < noiseSmoothPasses; pass++)
+    {
+        const char* source = &m_band[current][rowLength];
+        char* dest = &m_band[1 - current][rowLength];
+
+        workers.clear();
+        for(unsigned int t = 1; t < threads; t++)
+        {
+            workers.push_back(thread(&noiseCreator::smoothRows, this, source, dest, top, count, t, threads, pass));
+        }
+        smoothRows(source, dest, top, count, 0, threads, pass);
+        for(unsigned int t = 0; t < workers.size(); t++)
+        {
+            workers[t].join();
+        }
+        current = 1 - current;
+    }
+
+    m_bandBuffer = current;
+    m_bandTop = top;
+}
+
+//Function:
+//     streamMap
+//
+//Description:
+//      Builds the map band by band and writes each band as soon as it is done,
+//      so maps far bigger than memory can be made. The two band buffers are
+//      sized to fit in memoryLimit bytes; the noise rows of the halo are
+//      computed twice, which costs 2*noiseSmoothPasses rows per band.
+//
+//Preconditions:
+//      Constructor was called
+//
+//Arguments:
+//      out - map writer, beginWrite was called
+//      memoryLimit - bytes the band buffers may take
+//
+//Postconditions:
+//      The whole map is written to out and endWrite called, band buffers are freed
+//
+//Returns:
+//      False if writing to out failed
+//
+bool noiseCreator::streamMap(mapFile& out, long long memoryLimit)
+{
+    if(m_map_x == 0 || m_map_y == 0) return out.endWrite();
+
+    long long rowLength = m_map_x + 1;
+    long long bandRows = memoryLimit / (2*rowLength) - 2*noiseSmoothPasses - 2;
+    if(bandRows < 1) bandRows = 1;
+
+    findThresholds();
+
+    for(long long first = 0; first < m_map_y; first += bandRows)
+    {
+        long long last = first + bandRows < m_map_y ? first + bandRows : m_map_y;
+        createBand(first, last);
+        traceSpan span("write band", "row", first);
+        out.writeRows(&m_band[m_bandBuffer][(first - m_bandTop + 1)*rowLength], last - first);
+    }
+
+    for(int b = 0; b < 2; b++)
+    {
+        vector<char>().swap(m_band[b]);
+    }
+    return out.endWrite();
+}
+
+//Function:
+//     createMap
+//
+//Description:
+//      Builds the whole map in memory as a single band
+//
+//Preconditions:
+//      Constructor was called
+//
+//Arguments:
+//      None
+//
+//Postconditions:
+//      Map array holds the terrain, newlines and the final NULL
+//
+//Returns:
+//      None
+//
+void noiseCreator::createMap()
+{
+    long long mapSize = (long long)(m_map_x+1)*m_map_y;
+
+    delete [] m_map;
+    m_map = new char[mapSize+1];
+    for(long long j = m_map_x; j < mapSize; j += m_map_x + 1)
+    {
+        m_map[j] = '\n';
+    }
+    m_map[mapSize] = '\0';
+
+    if(m_map_x == 0 || m_map_y == 0) return;
+
+    findThresholds();
+    createBand(0, m_map_y);
+    memcpy(m_map, &m_band[m_bandBuffer][m_map_x + 1], mapSize);
+
+    for(int b = 0; b < 2; b++)
+    {
+        vector<char>().swap(m_band[b]);
+    }
+}
+
+//Function:
+//     printMap
+//
+//Description:
+//      Returns pointer to map array
+//
+//Preconditions:
+//      createMap was called
+//
+//Arguments:
+//      None
+//
+//Postconditions:
+//      None
+//
+//Returns:
+//      Pointer to map array
+//
+char* noiseCreator::printMap()
+{
+    return m_map;
+}
@@ -0,0 +1,69 @@
+#ifndef NOISECREATOR_H
+#define NOISECREATOR_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include "terraincreator.h"
+#include "mapfile.h"
+
+#define noisePeriod 64      //Cells between lattice points of the first octave
+#define noiseOctaves 5      //Octaves summed into the height and moisture maps
+#define noiseLanes 4        //Cells evaluated together by the noise kernel
+#define noiseBins 4096      //Histogram bins used to place the terrain thresholds
+#define noiseSmoothPasses 4 //Smoothing passes, also the halo rows a band needs on each side
+
+typedef float noiseFloat __attribute__((vector_size(noiseLanes*sizeof(float))));
+typedef int noiseInt __attribute__((vector_size(noiseLanes*sizeof(int))));
+typedef unsigned int noiseUint __attribute__((vector_size(noiseLanes*sizeof(int))));
+
+class noiseCreator
+{
+public:
+    noiseCreator(unsigned int x, unsigned int y);
+    ~noiseCreator();
+
+    void setSeed(unsigned int seed);
+    void setThreads(unsigned int threads);
+    void setTerrain(char oceanChar, char landChar, char mountainChar, char forestChar);
+    void setFrequencies(int landAgentNum, int landFrequency, int mountainAgentNum, int mountainFrequency, int forestAgentNum, int forestFrequency);
+
+    void createMap();
+    bool streamMap(mapFile& out, long long memoryLimit);
+    void createBand(long long firstRow, long long lastRow);
+    void noiseRow(unsigned int y, unsigned int salt, float* out);
+    void classifyRows(char* rows, long long top, long long count, unsigned int first, unsigned int step);
+    void smoothRows(const char* source, char* dest, long long top, long long count, unsigned int first, unsigned int step, int pass);
+    void findThresholds();
+    float quantile(const std::vector<double>& histogram, double below);
+
+    char* printMap();
+
+private:
+    char* m_map;                //Hold the map plus newlines on the edge, only made by createMap
+    unsigned int m_map_x;       //Hold the map's x dimension
+    unsigned int m_map_y;       //Hold the map's y dimension
+
+    char m_oceanChar;
+    char m_landChar;
+    char m_mountainChar;
+    char m_forestChar;
+
+    double m_landRatio;         //Share of the map that is not ocean
+    double m_mountainRatio;     //Share of the land that is mountain
+    double m_forestRatio;       //Share of the land that is forest
+
+    float m_oceanLevel;         //Heights below are ocean
+    float m_mountainLevel;      //Heights at or above are mountain
+    float m_forestLevel;        //Moisture at or above is forest
+
+    std::vector<char> m_band[2];    //Double buffered band, halo rows and a newline row above and below
+    int m_bandBuffer;               //Buffer holding the finished band
+    long long m_bandTop;            //Map row of the first halo row of the band
+
+    unsigned int m_seed;
+    unsigned int m_threads;
+};
+
+#endif
@@ -0,0 +1,206 @@
+////////////////////////////////////////////////////////
+// File name: perfcount.cpp
+// Description: Implementation of the per phase performance counters
+//
+#include "perfcount.h"
+#include "allocount.h"
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <iomanip>
+#include <mutex>
+using namespace std;
+
+bool perfEnabled = false;
+
+// Totals of one phase
+struct perfPhase
+{
+	const char* name;
+	long long calls;
+	long long entities;
+	double seconds;
+	long long counts[perfValueCount];
+	long long quietCalls;	//Calls without a heap allocation
+};
+
+static int counterFd[perfEventCount] = {-1, -1, -1, -1, -1};
+static perfPhase phases[perfMaxPhases];
+static int phaseCount = 0;
+static mutex phaseGuard;
+
+static const char* counterName[perfEventCount] = {"cycles", "instr", "L1d miss", "LLC miss", "br miss"};
+static const char* perEntityName[perfEventCount] = {"", "", "L1d/ent", "LLC/ent", "br/ent"};
+
+// Type and config of every counter
+static void counterEvent(int counter, perf_event_attr& attr)
+{
+	attr.type = PERF_TYPE_HARDWARE;
+	switch(counter)
+	{
+	case perfCycles:
+		attr.config = PERF_COUNT_HW_CPU_CYCLES;
+		break;
+	case perfInstructions:
+		attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+		break;
+	case perfL1Misses:
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		break;
+	case perfLLCMisses:
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		break;
+	case perfBranchMisses:
+		attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+		break;
+	}
+}
+
+// Current value of a counter, scaled up if the kernel had to share the
+// hardware between more counters than it has
+static long long readCounter(int fd)
+{
+	unsigned long long data[3];	//Value, time enabled, time running
+	if(fd < 0 || read(fd, data, sizeof(data)) != sizeof(data) || data[2] == 0)
+	{
+		return 0;
+	}
+	if(data[2] < data[1])
+	{
+		return (long long)((double)data[0]*data[1]/data[2]);
+	}
+	return data[0];
+}
+
+bool perfStart(string& error)
+{
+	int opened = 0;
+	for(int c = 0; c < perfEventCount; c++)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		counterEvent(c, attr);
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.inherit = 1;	//Threads started later count too, once they are joined
+		counterFd[c] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if(counterFd[c] >= 0) opened++;
+		else if(error.empty()) error = strerror(errno);
+	}
+	perfEnabled = true;
+	return opened > 0;
+}
+
+void perfTrackAllocations()
+{
+	allocTracking = true;
+	perfEnabled = true;
+}
+
+int perfBegin(const char* phase, long long values[])
+{
+	int slot;
+	{
+		lock_guard <mutex> lock(phaseGuard);
+		for(slot = 0; slot < phaseCount; slot++)
+		{
+			if(phases[slot].name == phase || strcmp(phases[slot].name, phase) == 0) break;
+		}
+		if(slot == phaseCount)
+		{
+			if(phaseCount == perfMaxPhases) return -1;
+			memset(&phases[slot], 0, sizeof(perfPhase));
+			phases[slot].name = phase;
+			phaseCount++;
+		}
+	}
+	for(int c = 0; c < perfEventCount; c++)
+	{
+		values[c] = readCounter(counterFd[c]);
+	}
+	allocCounts(values[perfAllocs], values[perfAllocBytes]);
+	return slot;
+}
+
+void perfEnd(int phase, long long entities, const long long values[],
+	chrono::steady_clock::time_point start)
+{
+	long long now[perfValueCount];
+	allocCounts(now[perfAllocs], now[perfAllocBytes]);
+	for(int c = 0; c < perfEventCount; c++)
+	{
+		now[c] = readCounter(counterFd[c]);
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	lock_guard <mutex> lock(phaseGuard);
+	perfPhase& p = phases[phase];
+	p.calls++;
+	p.entities += entities;
+	p.seconds += seconds;
+	for(int c = 0; c < perfValueCount; c++)
+	{
+		p.counts[c] += now[c] - values[c];
+	}
+	if(now[perfAllocs] == values[perfAllocs]) p.quietCalls++;
+}
+
+void perfReport(ostream& out)
+{
+	if(!perfEnabled) return;
+	perfEnabled = false;
+	bool allocs = allocTracking;
+	allocTracking = false;
+
+	out<<left<<setw(16)<<"phase"<<right<<setw(8)<<"calls"<<setw(12)<<"entities"<<setw(10)<<"ms"<<setw(10)<<"ns/ent";
+	for(int c = 0; c < perfEventCount; c++)
+	{
+		if(counterFd[c] >= 0) out<<setw(12)<<counterName[c];
+	}
+	if(counterFd[perfCycles] >= 0 && counterFd[perfInstructions] >= 0) out<<setw(7)<<"IPC";
+	for(int c = perfL1Misses; c < perfEventCount; c++)
+	{
+		if(counterFd[c] >= 0) out<<setw(10)<<perEntityName[c];
+	}
+	if(allocs) out<<setw(10)<<"allocs"<<setw(12)<<"bytes"<<setw(13)<<"allocs/call"<<setw(12)<<"zero calls";
+	out<<endl;
+
+	out<<fixed;
+	for(int p = 0; p < phaseCount; p++)
+	{
+		perfPhase& phase = phases[p];
+		double entities = phase.entities > 0 ? phase.entities : 1;
+		out<<left<<setw(16)<<phase.name<<right<<setw(8)<<phase.calls<<setw(12)<<phase.entities
+		   <<setw(10)<<setprecision(2)<<phase.seconds*1000<<setw(10)<<setprecision(1)<<phase.seconds*1e9/entities;
+		for(int c = 0; c < perfEventCount; c++)
+		{
+			if(counterFd[c] >= 0) out<<setw(12)<<phase.counts[c];
+		}
+		if(counterFd[perfCycles] >= 0 && counterFd[perfInstructions] >= 0)
+		{
+			out<<setw(7)<<setprecision(2)<<(phase.counts[perfCycles] > 0 ? (double)phase.counts[perfInstructions]/phase.counts[perfCycles] : 0.0);
+		}
+		for(int c = perfL1Misses; c < perfEventCount; c++)
+		{
+			if(counterFd[c] >= 0) out<<setw(10)<<setprecision(3)<<phase.counts[c]/entities;
+		}
+		if(allocs)
+		{
+			out<<setw(10)<<phase.counts[perfAllocs]<<setw(12)<<phase.counts[perfAllocBytes]
+			   <<setw(13)<<setprecision(2)<<(double)phase.counts[perfAllocs]/phase.calls<<setw(12)<<phase.quietCalls;
+		}
+		out<<endl;
+	}
+
+	for(int c = 0; c < perfEventCount; c++)
+	{
+		if(counterFd[c] >= 0) close(counterFd[c]);
+		counterFd[c] = -1;
+	}
+	phaseCount = 0;
+}
@@ -0,0 +1,75 @@
+////////////////////////////////////////////////////////
+// File name: perfcount.h
+// Description: Hardware performance counters per phase, read through
+// perf_event_open. A perfSection adds the cycles, instructions, L1 data
+// and last level cache misses and branch misses of a block of code to
+// the totals of its phase, along with the time taken and the number of
+// entities (cells, cities, armies) the block worked on. perfReport
+// prints IPC and misses per entity for every phase. Counters the
+// kernel or a container does not allow are left out of the report,
+// the phases are still timed. With perfTrackAllocations the report
+// also gives the heap allocations of every phase (see allocount.h).
+//
+#ifndef PERFCOUNT_H
+#define PERFCOUNT_H
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#define perfCycles 0
+#define perfInstructions 1
+#define perfL1Misses 2
+#define perfLLCMisses 3
+#define perfBranchMisses 4
+#define perfEventCount 5
+#define perfAllocs 5		//Allocation count and bytes follow the counters
+#define perfAllocBytes 6
+#define perfValueCount 7
+#define perfMaxPhases 32	//Phases past this are not counted
+
+//True between perfStart and perfReport
+extern bool perfEnabled;
+
+//Opens the counters for the calling thread and the threads it starts
+//from then on. Returns false with the reason in error if no hardware
+//counter could be opened, the phases are timed either way.
+bool perfStart(std::string& error);
+//Counts the heap allocations of every phase, with or without perfStart
+void perfTrackAllocations();
+//Prints the totals of every phase and closes the counters
+void perfReport(std::ostream& out);
+//Out of line halves of perfSection
+int perfBegin(const char* phase, long long values[]);
+void perfEnd(int phase, long long entities, const long long values[],
+	std::chrono::steady_clock::time_point start);
+
+//perfSection - counts from its construction to its destruction
+class perfSection
+{
+public:
+//phase must outlive perfReport (a literal)
+perfSection(const char* phase, long long sectionEntities)
+{
+	slot = -1;
+	if(perfEnabled)
+	{
+		entities = sectionEntities;
+		slot = perfBegin(phase, values);
+		start = std::chrono::steady_clock::now();
+	}
+}
+
+~perfSection()
+{
+	if(slot >= 0) perfEnd(slot, entities, values, start);
+}
+
+private:
+int slot;
+long long entities;
+long long values[perfValueCount];
+std::chrono::steady_clock::time_point start;
+};
+
+#endif
@@ -0,0 +1,270 @@
+////////////////////////////////////////////////////////
+// File name: replay.cpp
+// Description: Implementation file for the replayEngine class
+//
+#include <algorithm>
+#include <climits>
+#include <future>
+#include <string>
+#include "replay.h"
+using namespace std;
+
+replayEngine::replayEngine(unsigned int threads)
+	: pool(threads > 0 ? threads : max(thread::hardware_concurrency(), 1u))
+{
+	indexed = false;
+	width = 0;
+	height = 0;
+	records = 0;
+	bytes = 0;
+}
+
+bool replayEngine::open(const char* logName, const char* indexName)
+{
+	if(!log.open(logName))
+	{
+		return false;
+	}
+	string name = indexName ? indexName : string(logName) + ".idx";
+	indexed = index.load(name.c_str()) && index.turns() > 0 && !index.keyOffset.empty();
+	if(indexed)
+	{
+		// An index of another log would send replays to the wrong lines
+		long long last = index.turnOffset.back();
+		indexed = last < log.size() && (unsigned char)(log.begin()[last] - '0') <= 9;
+	}
+	width = indexed ? index.width : 0;
+	height = indexed ? index.height : 0;
+	return true;
+}
+
+// The keyframe at or before the end of turn, i.e. before the turn line of
+// turn + 1, and the offset of the first turn line it has not seen
+long long replayEngine::startOf(int turn, mapState& state)
+{
+	int key = min((turn + 1)/index.interval, (int)index.keyOffset.size() - 1);
+	index.keyframe(key, state);
+	return index.turnOffset[key*index.interval];
+}
+
+void replayEngine::decodeBatch(long long& next, long long end, recordBatch& batch)
+{
+	vector<long long> cuts(1, next);
+	while(next < end && cuts.size() <= pool.size())
+	{
+		// Chunks end after a newline so no line is split between two of them
+		long long cut = min(next + replayChunkBytes, end);
+		if(cut < end)
+		{
+			const char* newline = (const char*)memchr(log.begin() + cut - 1, '\n', end - cut + 1);
+			cut = newline ? newline + 1 - log.begin() : end;
+		}
+		bytes += cut - next;
+		next = cut;
+		cuts.push_back(cut);
+	}
+
+	// Vectors are kept between batches so their capacity is reused
+	batch.resize(cuts.size() - 1);
+	pool.run(batch.size(), [&](size_t chunk, unsigned int)
+	{
+		vector<actionRecord>& out = batch[chunk];
+		actionScanner scan(log.begin() + cuts[chunk], log.begin() + cuts[chunk + 1]);
+		actionRecord rec;
+		out.clear();
+		while(scan.next(rec))
+		{
+			out.push_back(rec);
+		}
+	});
+}
+
+// Applies records until a turn line past the last of turns. At every turn
+// line the targets it passed are handed to reached with the state as it
+// was just before the line.
+bool replayEngine::applyBatch(const recordBatch& batch, const vector<int>& turns, size_t& target,
+                              mapState& state, int& lastTurn, function<void(size_t)> reached)
+{
+	for(size_t chunk = 0; chunk < batch.size(); chunk++)
+	{
+		const vector<actionRecord>& recs = batch[chunk];
+		for(size_t i = 0; i < recs.size(); i++)
+		{
+			if(recs[i].action == turnRecord)
+			{
+				while(target < turns.size() && turns[target] < recs[i].turn)
+				{
+					reached(target++);
+				}
+				if(target == turns.size())
+				{
+					return false;
+				}
+				lastTurn = recs[i].turn;
+				continue;
+			}
+			state.apply(recs[i]);
+			records++;
+		}
+	}
+	return true;
+}
+
+// Replays the log from start to end into state. One batch is decoded on
+// the workers while the one before it is applied here, the records are
+// applied in log order. turns must be in ascending order; returns how
+// many of them were reached.
+size_t replayEngine::replayRange(long long start, long long end, const vector<int>& turns,
+                                 mapState& state, int lastTurn, function<void(size_t)> reached)
+{
+	recordBatch batches[2];
+	long long next = start;
+	size_t target = 0;
+	int current = 0;
+
+	decodeBatch(next, end, batches[current]);
+	while(!batches[current].empty())
+	{
+		future<void> ahead;
+		bool more = next < end;
+		if(more)
+		{
+			recordBatch& batch = batches[1 - current];
+			ahead = async(launch::async, [this, &next, end, &batch]() { decodeBatch(next, end, batch); });
+		}
+		else
+		{
+			batches[1 - current].clear();
+		}
+
+		bool going = applyBatch(batches[current], turns, target, state, lastTurn, reached);
+		if(more)
+		{
+			ahead.wait();
+		}
+		if(!going)
+		{
+			return target;
+		}
+		current = 1 - current;
+	}
+
+	// The end of the log also ends the last turn
+	while(target < turns.size() && turns[target] <= lastTurn)
+	{
+		reached(target++);
+	}
+	return target;
+}
+
+bool replayEngine::stateAt(int turn, mapState& state)
+{
+	vector<int> turns(1, turn);
+	records = 0;
+	bytes = 0;
+	if(turn < 0)
+	{
+		return false;
+	}
+
+	if(indexed)
+	{
+		if(turn >= index.turns())
+		{
+			return false;
+		}
+		long long start = startOf(turn, state);
+		long long end = turn + 1 < index.turns() ? index.turnOffset[turn + 1] : log.size();
+		// The range ends with turn, so it is reached at the end of the range
+		return replayRange(start, end, turns, state, turn, [](size_t) {}) == 1;
+	}
+
+	state.clear();
+	return replayRange(0, log.size(), turns, state, -1, [](size_t) {}) == 1;
+}
+
+void replayEngine::statesAt(const vector<int>& turns, int width, int height,
+                            function<void(size_t, const mapState&)> visit)
+{
+	records = 0;
+	bytes = 0;
+
+	if(indexed)
+	{
+		// Each turn from its own keyframe, the ranges are at most one
+		// keyframe interval long so they are replayed without batches
+		vector<long long> taskRecords(turns.size(), 0), taskBytes(turns.size(), 0);
+		pool.run(turns.size(), [&](size_t task, unsigned int)
+		{
+			int turn = turns[task];
+			if(turn < 0 || turn >= index.turns())
+			{
+				return;
+			}
+			mapState state(width, height);
+			long long start = startOf(turn, state);
+			long long end = turn + 1 < index.turns() ? index.turnOffset[turn + 1] : log.size();
+			actionScanner scan(log.begin() + start, log.begin() + end);
+			actionRecord rec;
+			while(scan.next(rec))
+			{
+				if(state.apply(rec)) taskRecords[task]++;
+			}
+			taskBytes[task] = end - start;
+			visit(task, state);
+		});
+		for(size_t i = 0; i < turns.size(); i++)
+		{
+			records += taskRecords[i];
+			bytes += taskBytes[i];
+		}
+		return;
+	}
+
+	// One pass over the log, stopping at each turn in order
+	vector<size_t> order(turns.size());
+	for(size_t i = 0; i < order.size(); i++)
+	{
+		order[i] = i;
+	}
+	stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return turns[a] < turns[b]; });
+	vector<int> sorted;
+	for(size_t i = 0; i < order.size(); i++)
+	{
+		if(turns[order[i]] >= 0)
+		{
+			sorted.push_back(turns[order[i]]);
+		}
+	}
+	size_t skipped = order.size() - sorted.size();
+
+	mapState state(width, height);
+	replayRange(0, log.size(), sorted, state, -1, [&](size_t target)
+	{
+		visit(order[skipped + target], state);
+	});
+}
+
+void replayEngine::entities(const mapState& state, vector<replayUnit>& cities,
+                            vector<replayUnit>& roads, vector<replayUnit>& armies)
+{
+	replayUnit temp;
+	cities.clear();
+	roads.clear();
+	armies.clear();
+	for(int i = 0; i < state.width*state.height; i++)
+	{
+		temp.x = i % state.width;
+		temp.y = i / state.width;
+		if(state.cityRoad[i])
+		{
+			temp.color = state.cityRoadColor[i];
+			(state.cityRoad[i] == 'C' ? cities : roads).push_back(temp);
+		}
+		if(state.unit[i])
+		{
+			temp.color = state.unitColor[i];
+			armies.push_back(temp);
+		}
+	}
+}
@@ -0,0 +1,82 @@
+////////////////////////////////////////////////////////
+// File name: replay.h
+// Description: Header file for the replayEngine class, which rebuilds
+// the state of a run (ownership grids, totals and the lists of cities,
+// roads and armies simulate kept) at any turn of its action list.
+// The log is cut into chunks at line ends. Worker threads decode chunks
+// into arrays of records while the calling thread applies the chunks
+// decoded before them, in log order, so records are applied exactly as
+// a plain replay would and the text parsing runs off the apply loop.
+// With a logindex index a replay starts at the keyframe before the turn
+// and stops at the next turn line, and several turns are rebuilt at
+// once from keyframes of their own, one turn per thread.
+//
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <functional>
+#include <vector>
+#include "actionlog.h"
+#include "mapstate.h"
+#include "workpool.h"
+
+#define replayChunkBytes (1 << 20)	//Text decoded by one task
+
+//replayUnit - a city, road or army of a rebuilt state, in log coordinates
+struct replayUnit
+{
+int x;
+int y;
+int color;
+};
+
+//replayEngine - state of a run at any turn of its action list
+class replayEngine
+{
+public:
+//threads 0 uses every core
+replayEngine(unsigned int threads = 0);
+//Maps the action list and loads indexName, <logName>.idx if that is
+//NULL. A missing index is not an error, replays then start at the top.
+bool open(const char* logName, const char* indexName = NULL);
+//Rebuilds the state at the end of turn into state, which must already
+//have the size of the map. Returns false if the log has no such turn.
+bool stateAt(int turn, mapState& state);
+//Rebuilds the state at the end of each of turns in a state of width x
+//height and calls visit(position in turns, state) with it; records past
+//that area are counted in the state's outside. With an index the turns are
+//rebuilt on several threads and visit may be called from any of them;
+//without one the log is read once, in order of turn. Turns the log
+//does not have are not visited.
+void statesAt(const std::vector<int>& turns, int width, int height,
+              std::function<void(size_t, const mapState&)> visit);
+//Lists the cities, roads and armies of a state, row by row
+static void entities(const mapState& state, std::vector<replayUnit>& cities,
+                     std::vector<replayUnit>& roads, std::vector<replayUnit>& armies);
+
+bool indexed;		//An index was loaded
+int width, height;	//Area of the records of the log from its index, 0 without one
+long long records;	//Records applied by the last stateAt or statesAt
+long long bytes;	//Bytes of log decoded by them
+
+private:
+//Batch of chunks decoded together
+typedef std::vector< std::vector<actionRecord> > recordBatch;
+
+//Offset where the replay of turn starts, the state there goes into state
+long long startOf(int turn, mapState& state);
+//Cuts up to one chunk per worker from next on and decodes them
+void decodeBatch(long long& next, long long end, recordBatch& batch);
+//Applies a batch, returns false at the turn line past the last of turns
+bool applyBatch(const recordBatch& batch, const std::vector<int>& turns, size_t& target,
+                mapState& state, int& lastTurn, std::function<void(size_t)> reached);
+//Replays the log from start to end, calls reached(i) once turns[i] ends
+size_t replayRange(long long start, long long end, const std::vector<int>& turns,
+                   mapState& state, int lastTurn, std::function<void(size_t)> reached);
+
+actionLog log;
+actionIndex index;
+workPool pool;
+};
+
+#endif
@@ -5,21 +5,46 @@
 // Description: Implementation file for the simulate class
 // Date: 12/11/13
 //
+#include <algorithm>
 #include "simulate.h"
+#include "trace.h"
+#include "perfcount.h"
 // Simulation construction:
 // Requires the mapsize to be used in advance.
 // Constructor alone does not setup simulation
 // as it requires the runSim method to set up/run the rest
-simulate::simulate(int mapsizeX, int mapsizeY)
+simulate::simulate(int mapsizeX, int mapsizeY, streambuf* actions, bool directIO)
 {
+	bool opened = true;
 	currentTurn = 0; // Turn 0 = setup
 	simfail = 0;
+	started = false;
+	neighbours = vonNeumannGrid;
+	wrapEdges = 0;
+	gridLayout = rowLayout;
+	sortTurns = 0;
+	openSpaces = 0;
 	numPlayers = 2;
-	output.open("action_list.txt"); // Output of all simulation actions
-					// to be used in another part of the program
+	hash = 0;
+	stableTurns = 0;
+	cycleTurns = 0;
+	repeats = 0;
+	ownerChanged = 0;
+	stopped = stopAllTurns;
+	setSeed(1);
+	if(actions == NULL)
+	{
+		// Output of all simulation actions
+		// to be used in another part of the program
+		opened = actionList.open("action_list.txt", directIO);
+	}
+	else
+	{
+		actionList.open(actions);
+	}
 	// Prints an error if the action list cannot be opened
 	// this means the simulation has failed
-	if(!output.is_open())
+	if(!opened)
 	{
 		numTurns = 0;
 		simfail = 1;
@@ -35,69 +60,235 @@ simulate::simulate(int mapsizeX, int mapsizeY)
 	}
 	else
 	{
-		// Establishes a 2D vector to hold the map
+		// Establishes the map with a closed border round it, so no
+		// neighbour of a space is off the map. populateMap lays it out
+		// again once the config has chosen the layout.
 		mapX = mapsizeX;
 		mapY = mapsizeY;
-		map.resize(mapX);
-		
-		for(int i = 0; i<mapX; i++)
+		layOut();
+	}
+}
+
+// Builds the offset tables of the layout and closes every cell.
+// With mortonLayout the map is cut into gridTile x gridTile tiles, one
+// after another along the rows of tiles; inside a tile a cell's index
+// interleaves the bits of its row and column, so the spaces above and
+// below one are mostly in the same or the next cache line, not a whole
+// map row away.
+void simulate::layOut()
+{
+	// Spreads three bits apart to bits 0, 2 and 4
+	static const int spread[gridTile] = {0, 1, 4, 5, 16, 17, 20, 21};
+	int rows = mapX + 2, columns = mapY + 2;
+	int tilesPerRow = (columns + gridTile - 1)/gridTile;
+	size_t cells;
+
+	rowOffset.resize(rows);
+	columnOffset.resize(columns);
+	if(gridLayout == mortonLayout)
+	{
+		for(int x = 0; x < rows; x++)
 		{
-			map[i].resize(mapY);
+			rowOffset[x] = (x/gridTile)*tilesPerRow*gridTile*gridTile + (spread[x % gridTile] << 1);
 		}
+		for(int y = 0; y < columns; y++)
+		{
+			columnOffset[y] = (y/gridTile)*gridTile*gridTile + spread[y % gridTile];
+		}
+		cells = (size_t)((rows + gridTile - 1)/gridTile)*tilesPerRow*gridTile*gridTile;
+	}
+	else
+	{
+		for(int x = 0; x < rows; x++)
+		{
+			rowOffset[x] = x*columns;
+		}
+		for(int y = 0; y < columns; y++)
+		{
+			columnOffset[y] = y;
+		}
+		cells = (size_t)rows*columns;
+	}
+
+	mapNode border = {false, 0, false, 0};
+	map.resize(cells);
+	for(size_t i = 0; i < cells; i++)
+	{
+		map.edit(i) = border;
 	}
 }
 
-// Reads in the simulation map from a map file
-void simulate::populateMap(ifstream& mapFile)
+// Fork construction:
+// Copies everything but the action list from parent. The map and the
+// unit lists are copy-on-write arrays, copying them only shares their
+// chunks with parent.
+simulate::simulate(const simulate& parent, streambuf* actions, gameArena* arena)
+	: mapX(parent.mapX), mapY(parent.mapY), map(parent.map),
+	  rowOffset(parent.rowOffset), columnOffset(parent.columnOffset),
+	  city(parent.city), road(parent.road), army(parent.army), settle(parent.settle)
 {
-	char mapChar;
-	string read;
-	bool end = false;
-	int x = 0;
-	int y = 0;
-	// Reads until the end of the file or
-	// when it goes beyond the number of rows
-	// specified with mapX, whatever comes first.
-	while(!mapFile.eof() && x!=mapX)
-	{
-		getline(mapFile,read);
-
-		// Parses each line until up to the max
-		// number of columns or mapY.
-		// Sets up each piece of the map with
-		// a terrain character which is read
-		// from this file, as well as, no starting army
-		// and cities/roads, this will be done later.
+	currentTurn = parent.currentTurn;
+	numTurns = parent.numTurns;
+	numPlayers = parent.numPlayers;
+	maxArmies = parent.maxArmies;
+	p1armies = parent.p1armies;
+	p2armies = parent.p2armies;
+	total_cities = parent.total_cities;
+	plains = parent.plains;
+	mountain = parent.mountain;
+	forest = parent.forest;
+	ocean = parent.ocean;
+	river = parent.river;
+	p1Color = parent.p1Color;
+	p2Color = parent.p2Color;
+	simfail = parent.simfail;
+	started = parent.started;
+	neighbours = parent.neighbours;
+	wrapEdges = parent.wrapEdges;
+	gridLayout = parent.gridLayout;
+	sortTurns = parent.sortTurns;
+	openSpaces = parent.openSpaces;
+	sortScratch.reserve(parent.sortScratch.capacity());
+	hash = parent.hash;
+	stableTurns = parent.stableTurns;
+	cycleTurns = parent.cycleTurns;
+	repeats = parent.repeats;
+	ownerChanged = parent.ownerChanged;
+	turnHashes = parent.turnHashes;
+	stopped = parent.stopped;
+
+	// The random state points into randomState, the copy has to point into its own
+	memcpy(randomState, parent.randomState, sizeof(randomState));
+	randomData = parent.randomData;
+	randomData.fptr = (int32_t*)((char*)randomState + ((const char*)parent.randomData.fptr - parent.randomState));
+	randomData.rptr = (int32_t*)((char*)randomState + ((const char*)parent.randomData.rptr - parent.randomState));
+	randomData.state = (int32_t*)((char*)randomState + ((const char*)parent.randomData.state - parent.randomState));
+	randomData.end_ptr = (int32_t*)((char*)randomState + ((const char*)parent.randomData.end_ptr - parent.randomState));
+
+	if(arena)
+	{
+		map.setArena(arena);
+		city.setArena(arena);
+		road.setArena(arena);
+		army.setArena(arena);
+		settle.setArena(arena);
+	}
+	adjacent.reserve(maxNeighbours);
+	actionList.open(actions);
+}
+
+// Copies the simulation map from a loaded map file
+void simulate::populateMap(const mapFile& terrain)
+{
+	char* legend[legendSize] = {&ocean, &plains, &mountain, &forest, &river};
+
+	// Binary maps know their own terrain characters
+	for(int i = 0; i < legendSize; i++)
+	{
+		if(legend[i] && terrain.legend[i])
+		{
+			*legend[i] = terrain.legend[i];
+		}
+	}
+
+	layOut();
+
+	// Rows are map rows and columns are map columns, anything past the
+	// edge of the file is left as an unknown terrain.
+	// Sets up each piece of the map with
+	// a terrain character which is read
+	// from this file, as well as, no starting army
+	// and cities/roads, this will be done later.
+	// A suitable starting location will be a plains or forest.
+	settle = cowArray<coord>();
+	openSpaces = 0;
+	for(int x = 0; x < mapX; x++)
+	{
 		for(int i = 0; i < mapY; i++)
 		{
-			mapChar = read[i];
-			map[x][i].terrain = mapChar;
-			map[x][i].unit = false;
-			map[x][i].city = 0;
+			mapNode& node = editCell(x,i);
+			node.terrain = (x < terrain.height && i < terrain.width) ? terrain.at(i,x) : 0;
+			node.open = node.terrain != ocean && node.terrain != mountain;
+			node.unit = false;
+			node.city = 0;
+			openSpaces += node.open;
+			if(node.terrain == plains || node.terrain == forest)
+			{
+				coord space = {x, i};
+				settle.push_back(space);
+			}
 		}
-		x++;
 	}
 }
 
 // Connects all the parts of the simulation as well as completes set up.
 void simulate::runSim()
 {
-	setup(); // Places starting cities on map
+	runTo(numTurns);
+	finish();
+}
+
+// Runs the turns up to turn, setting the map up first if that has not
+// been done. A fork continues from the turn of its parent.
+bool simulate::runTo(int turn)
+{
+	// A failed simulation, for one a config parseConfig rejected, does not run
+	if(simfail)
+	{
+		return false;
+	}
+	if(!started)
+	{
+		started = true;
+		traceSpan span("setup");
+		perfSection counters("setup", (long long)mapX*mapY);
+		setup(); // Places starting cities on map
+		endTurn();
+		p1armies = 0; // Number of armies generated by player 1
+		p2armies = 0; // Number of armies generated by player 2
+	}
+
+	// The topology is fixed for the run, each one has turns compiled for it
+	if(neighbours == mooreGrid)
+	{
+		if(wrapEdges) runTurns< gridTopology<moore, wrappedEdges> >(turn);
+		else runTurns< gridTopology<moore, boundedEdges> >(turn);
+	}
+	else if(neighbours == hexGrid)
+	{
+		if(wrapEdges) runTurns< gridTopology<hexagonal, wrappedEdges> >(turn);
+		else runTurns< gridTopology<hexagonal, boundedEdges> >(turn);
+	}
+	else
+	{
+		if(wrapEdges) runTurns< gridTopology<vonNeumann, wrappedEdges> >(turn);
+		else runTurns< gridTopology<vonNeumann, boundedEdges> >(turn);
+	}
+	return currentTurn < numTurns && stopped == stopAllTurns && !simfail;
+}
+
+template <class Topology>
+void simulate::runTurns(int turn)
+{
 	int color; // Represents the current player
 		   // which is used to distinguish who's turn it is
-	p1armies = 0; // Number of armies generated by player 1
-	p2armies = 0; // Number of armies generated by player 2
 
-	// Runs through all the turns of the simulation which is specified in the config
-	// file.
-	for(int i = 0; i<numTurns; i++)
+	// Runs through the turns of the simulation which is specified in the config
+	// file, a stop rule ends the run for good.
+	while(currentTurn < turn && currentTurn < numTurns && stopped == stopAllTurns)
 	{
 		if(simfail)
 		{
 			break;
 		}
 		currentTurn++;
-		output<<i+1<<endl;
+		traceSpan turnSpan("turn", "turn", currentTurn);
+		perfSection turnCounters("turn", city.size() + road.size() + army.size());
+		actionList.turn(currentTurn);
+		if(sortTurns > 0 && currentTurn % sortTurns == 0)
+		{
+			sortUnits();
+		}
 
 		// Determines who's turn it is
 		// then allows each player to act one after the other
@@ -111,23 +302,159 @@ void simulate::runSim()
 			{
 				color = p2Color;
 			}
-			simCities(color);
-			simArmies(color);
+			traceSpan playerSpan("player", "color", color);
+			{
+				traceSpan span("cities");
+				perfSection counters("cities", city.size() + road.size());
+				simCities<Topology>(color);
+			}
+			traceSpan span("armies");
+			perfSection counters("armies", army.size());
+			simArmies<Topology>(color);
+		}
+		if(endTurn())
+		{
+			break;
 		}
 	}
 }
 
+// Waits for the writer thread to finish the action list
+void simulate::finish()
+{
+	if(!actionList.close())
+	{
+		printError(3);
+	}
+}
+
+int simulate::count(int object, int color)
+{
+	cowArray <simUnit>& units = object == 1 ? city : object == 2 ? road : army;
+	int total = 0;
+	for(unsigned int i = 0; i < units.size(); i++)
+	{
+		if(units[i].color == color)
+		{
+			total++;
+		}
+	}
+	return total;
+}
+
+// Units act in the order of their lists. Sorted by where their cells
+// are in memory, a pass over a list walks the map in that order too.
+// Units only move one space a turn, so the lists stay close to sorted
+// between sorts. Only elements that moved are written, forks keep
+// sharing the rest.
+void simulate::sortUnits()
+{
+	cowArray <simUnit>* lists[3] = {&city, &road, &army};
+	for(int l = 0; l < 3; l++)
+	{
+		cowArray <simUnit>& units = *lists[l];
+		sortScratch.clear();
+		for(unsigned int i = 0; i < units.size(); i++)
+		{
+			sortScratch.push_back(units[i]);
+		}
+		sort(sortScratch.begin(), sortScratch.end(), [this](const simUnit& a, const simUnit& b)
+		{
+			return rowOffset[a.x+1] + columnOffset[a.y+1] < rowOffset[b.x+1] + columnOffset[b.y+1];
+		});
+		for(unsigned int i = 0; i < units.size(); i++)
+		{
+			if(units[i].x != sortScratch[i].x || units[i].y != sortScratch[i].y)
+			{
+				units.edit(i) = sortScratch[i];
+			}
+		}
+	}
+}
+
+void simulate::memoryUse(long long& shared, long long& owned)
+{
+	shared = 0;
+	owned = 0;
+	map.memoryUse(shared, owned);
+	city.memoryUse(shared, owned);
+	road.memoryUse(shared, owned);
+	army.memoryUse(shared, owned);
+}
+
+// One splitmix64 step
+static unsigned long long splitMix(unsigned long long key)
+{
+	key += 0x9E3779B97F4A7C15ULL;
+	key = (key ^ (key >> 30))*0xBF58476D1CE4E5B9ULL;
+	key = (key ^ (key >> 27))*0x94D049BB133111EBULL;
+	return key ^ (key >> 31);
+}
+
+// Splitmix64 of the object, color and position stands in for a table
+// of random keys, which would take 48 bytes for every cell of the map.
+// Each coordinate goes through a mixing step of its own so no size of
+// map makes two cells share a packed value.
+unsigned long long simulate::zobristKey(int object, int x, int y, int color)
+{
+	unsigned long long key = splitMix((unsigned int)x);
+	key = splitMix(key + (unsigned int)y);
+	return splitMix(key + ((unsigned int)object << 8 | (color & 255)));
+}
+
+// Ends a turn: writes the state hash and applies the stop rules.
+// Returns true if the run is over.
+bool simulate::endTurn()
+{
+	actionRecord rec;
+	rec.action = hashRecord;
+	rec.hash = hash;
+	actionList.add(rec);
+
+	if(stableTurns > 0 && currentTurn - ownerChanged >= stableTurns)
+	{
+		stopped = stopStable;
+		return true;
+	}
+	if(cycleTurns > 0)
+	{
+		// Turns without an action repeat the turn before them while cities
+		// wait to build, so a cycle is only taken for one once the states
+		// keep repeating for a whole window
+		bool seen = false;
+		for(unsigned int t = 0; t < turnHashes.size(); t++)
+		{
+			seen = seen || turnHashes[t] == hash;
+		}
+		repeats = seen ? repeats + 1 : 0;
+		if(repeats >= cycleTurns)
+		{
+			stopped = stopCycle;
+			return true;
+		}
+		if((int)turnHashes.size() < cycleTurns)
+		{
+			turnHashes.push_back(hash);
+		}
+		else
+		{
+			turnHashes[currentTurn % cycleTurns] = hash;
+		}
+	}
+	return false;
+}
+
 // Simulates the actions of each army.
 // Armies will try and destroy other armies
 // first then try and take over cities/roads in that order.
 // If they do none of those things, they will move to a new location.
 // Armies can move through all terrain except for mountains and ocean.
 // The player input determines which player is acting and which one is not.
+template <class Topology>
 void simulate::simArmies(int player)
 {
 	int x,y;
 	int x1,y1;
-	vector <coord> adjacent;
 	int enemy;
 	bool destr = false;
 	int random;
@@ -147,7 +474,7 @@ void simulate::simArmies(int player)
 			x = army[i].x;
 			y = army[i].y;
 			adjacent.erase(adjacent.begin(),adjacent.end());
-			findAdjacent(x,y,adjacent);
+			findAdjacent<Topology>(x,y,adjacent);
 			// Will destroy an adjacent enemy army
 			for(unsigned int j = 0; j<adjacent.size();j++)
 			{
@@ -219,11 +546,11 @@ void simulate::simArmies(int player)
 				{
 					break;
 				}
-				random = rand() % adjacent.size();
+				random = nextRandom() % adjacent.size();
 				x1 = adjacent[random].x;
 				y1 = adjacent[random].y;
 
-				if(map[x1][y1].unit == false && (map[x1][y1].city == 0 || map[x1][y1].city == 2))
+				if(cell(x1,y1).unit == false && (cell(x1,y1).city == 0 || cell(x1,y1).city == 2))
 				{
 					moveUnit(x,y,x1,y1);
 					break;
@@ -240,13 +567,13 @@ void simulate::simArmies(int player)
 // Once roads have expanded into all available adjacent spaces, then each road piece will start
 // to have connecting branches of their own.
 // The player input determines which player is acting and which one is not.
+template <class Topology>
 void simulate::simCities(int player)
 {
 	int x,y;
 	int x1,y1;
 	int cityl;
 	int built = 0;
-	vector <coord> adjacent;
 	// Performs actions for each city in the simulation.
 	for(unsigned int i = 0;i<city.size();i++)
 	{
@@ -258,7 +585,7 @@ void simulate::simCities(int player)
 
 			// Creates an army in the city if one isn't already there
 			// and if 5 turns have passed.
-			if(map[x][y].unit == false && currentTurn % 5 == 0)
+			if(cell(x,y).unit == false && currentTurn % 5 == 0)
 			{
 				if(player == p1Color && p1armies<maxArmies)
 				{
@@ -275,13 +602,13 @@ void simulate::simCities(int player)
 			if(currentTurn % 3 == 0)
 			{
 				adjacent.erase(adjacent.begin(),adjacent.end());
-				findAdjacent(x,y,adjacent);
+				findAdjacent<Topology>(x,y,adjacent);
 				for(unsigned int k = 0; k<adjacent.size();k++)
 				{
 					x1 = adjacent[k].x;
 					y1 = adjacent[k].y;
-					cityl = map[x1][y1].city;
-					if((map[x1][y1].unit != true) && cityl == 0)
+					cityl = cell(x1,y1).city;
+					if((cell(x1,y1).unit != true) && cityl == 0)
 					{
 						x1 = adjacent[k].x;
 						y1 = adjacent[k].y;
@@ -310,13 +637,13 @@ void simulate::simCities(int player)
 				x = road[l].x;
 				y = road[l].y;
 				adjacent.erase(adjacent.begin(),adjacent.end());
-				findAdjacent(x,y,adjacent);
+				findAdjacent<Topology>(x,y,adjacent);
 				for(unsigned int k = 0; k<adjacent.size();k++)
 				{
 					x1 = adjacent[k].x;
 					y1 = adjacent[k].y;
-					cityl = map[x1][y1].city;
-					if((map[x1][y1].unit != true) && cityl == 0)
+					cityl = cell(x1,y1).city;
+					if((cell(x1,y1).unit != true) && cityl == 0)
 					{
 						create(2,x1,y1,player);
 						built++;
@@ -331,252 +658,36 @@ void simulate::simCities(int player)
 // Finds all adjacent spaces to a unit (road/city/army).
 // Ignores mountains and oceans.
 // Adds suitable locations to the provided vector.
+// Every neighbour in the table of the topology is looked at and kept
+// if it is open; spaces past a bounded edge are the closed border, so
+// there are no edge or corner cases.
+template <class Topology>
 void simulate::findAdjacent(int x, int y,vector<coord>&adj)
 {
-	// Special cases
-	bool trCorner = false; // top right corner case
-	bool tlCorner = false; // top left corner case
-	bool brCorner = false; // bottom right corner case	
-	bool blCorner = false; // bottom left corner case
-	bool rEdge = false; // right edge case
-	bool lEdge = false; // left edge case
-	bool tEdge = false; // top edge case
-	bool bEdge = false; // bottom edge case
-	coord temp;
-
-	// Determines it the inputed coordinate is a special case 
-	// or not.
-	if(x == mapX-1 && y == mapY-1)
-	{
-		brCorner = true;
-	}
-	else if(x == 0 && y == 0)
-	{
-		tlCorner = true;
-	}
-	else if(x == mapX-1 && y == 0)
-	{
-		blCorner = true;
-	}
-	else if(x == 0 && y == mapY-1)
-	{
-		trCorner = true;
-	}
-	else if(x == mapX-1)
-	{
-		bEdge = true;
-	}
-	else if(x == 0)
-	{
-		tEdge = true;
-	}
-	else if(y == mapY - 1)
-	{
-		rEdge = true;
-	}
-	else if(y == 0)
-	{
-		lEdge = true;
-	}
+	typedef typename Topology::neighbours neighbourhood;
+	const gridOffset* table = neighbourhood::table(x, y, mapX, mapY);
+	coord found[neighbourhood::count];
+	int kept = 0;
 
-	// Handles all cases, both special and not so special.
-	// Generates adjacent space coordinates and stores them in the vector.
-	// Minimum generated will be 2, while the max is 4.
-	if(brCorner)
+	for(int i = 0; i < neighbourhood::count; i++)
 	{
-		if(map[x-1][y].terrain != ocean && map[x-1][y].terrain != mountain)
-		{
-			temp.y = y;
-			temp.x = x-1;
-			adj.push_back(temp);
-		}
-
-		if(map[x][y-1].terrain != ocean && map[x][y-1].terrain != mountain)
-		{
-			temp.y = y-1;
-			temp.x = x;
-			adj.push_back(temp);
-		}
-	}
-	else if(blCorner)
-	{
-		if(map[x-1][y].terrain != ocean && map[x-1][y].terrain != mountain)
-		{
-			temp.y = y;
-			temp.x = x-1;
-			adj.push_back(temp);
-		}
-
-		if(map[x][y+1].terrain != ocean && map[x][y+1].terrain != mountain)
-		{
-			temp.y = y+1;
-			temp.x = x;
-			adj.push_back(temp);
-		}
-	}
-	else if(trCorner)
-	{
-		if(map[x][y-1].terrain != ocean && map[x][y-1].terrain != mountain)
-		{
-			temp.y = y-1;
-			temp.x = x;
-			adj.push_back(temp);
-		}
-
-		if(map[x+1][y].terrain != ocean && map[x+1][y].terrain != mountain)
-		{
-			temp.y = y;
-			temp.x = x+1;
-			adj.push_back(temp);
-		}
-	}
-	else if(tlCorner)
-	{
-		if(map[x][y+1].terrain != ocean && map[x][y+1].terrain != mountain)
-		{
-			temp.y = y+1;
-			temp.x = x;
-			adj.push_back(temp);
-		}
-
-		if(map[x+1][y].terrain != ocean && map[x+1][y].terrain != mountain)
-		{
-			temp.y = y;
-			temp.x = x+1;
-			adj.push_back(temp);
-		}
-	}
-	else if(bEdge)
-	{
-		if(map[x][y+1].terrain != ocean && map[x][y+1].terrain != mountain)
-		{
-			temp.y = y+1;
-			temp.x = x;
-			adj.push_back(temp);
-		}
-
-		if(map[x][y-1].terrain != ocean && map[x][y-1].terrain != mountain)
-		{
-			temp.y = y-1;
-			temp.x = x;
-			adj.push_back(temp);
-		}
-
-		if(map[x-1][y].terrain != ocean && map[x-1][y].terrain != mountain)
-		{
-			temp.y = y;
-			temp.x = x-1;
-			adj.push_back(temp);
-		}
-	}
-	else if(tEdge)
-	{
-		if(map[x][y+1].terrain != ocean && map[x][y+1].terrain != mountain)
-		{
-			temp.y = y+1;
-			temp.x = x;
-			adj.push_back(temp);
-		}
-
-		if(map[x][y-1].terrain != ocean && map[x][y-1].terrain != mountain)
-		{
-			temp.y = y-1;
-			temp.x = x;
-			adj.push_back(temp);
-		}
-
-		if(map[x+1][y].terrain != ocean && map[x+1][y].terrain != mountain)
-		{
-			temp.y = y;
-			temp.x = x+1;
-			adj.push_back(temp);
-		}
-	}
-	else if(rEdge)
-	{
-		if(map[x-1][y].terrain != ocean && map[x-1][y].terrain != mountain)
-		{
-			temp.y = y;
-			temp.x = x-1;
-			adj.push_back(temp);
-		}
-
-		if(map[x][y-1].terrain != ocean && map[x][y-1].terrain != mountain)
-		{
-			temp.y = y-1;
-			temp.x = x;
-			adj.push_back(temp);
-		}
-
-		if(map[x+1][y].terrain != ocean && map[x+1][y].terrain != mountain)
-		{
-			temp.y = y;
-			temp.x = x+1;
-			adj.push_back(temp);
-		}
-	}
-	else if(lEdge)
-	{
-		if(map[x-1][y].terrain != ocean && map[x-1][y].terrain != mountain)
-		{
-			temp.y = y;
-			temp.x = x-1;
-			adj.push_back(temp);
-		}
-
-		if(map[x][y+1].terrain != ocean && map[x][y+1].terrain != mountain)
-		{
-			temp.y = y+1;
-			temp.x = x;
-			adj.push_back(temp);
-		}
-
-		if(map[x+1][y].terrain != ocean && map[x+1][y].terrain != mountain)
-		{
-			temp.y = y;
-			temp.x = x+1;
-			adj.push_back(temp);
-		}
-	}
-	else
-	{
-		if(map[x-1][y].terrain != ocean && map[x-1][y].terrain != mountain)
-		{
-			temp.y = y;
-			temp.x = x-1;
-			adj.push_back(temp);
-		}
-
-		if(map[x][y+1].terrain != ocean && map[x][y+1].terrain != mountain)
-		{
-			temp.y = y+1;
-			temp.x = x;
-			adj.push_back(temp);
-		}
-
-		if(map[x][y-1].terrain != ocean && map[x][y-1].terrain != mountain)
-		{
-			temp.y = y-1;
-			temp.x = x;
-			adj.push_back(temp);
-		}
-
-		if(map[x+1][y].terrain != ocean && map[x+1][y].terrain != mountain)
-		{
-			temp.y = y;
-			temp.x = x+1;
-			adj.push_back(temp);
-		}
+		coord temp;
+		temp.x = x + table[i].dx;
+		temp.y = y + table[i].dy;
+		Topology::edges::fold(temp.x, temp.y, mapX, mapY);
+		found[kept] = temp;
+		kept += cell(temp.x, temp.y).open;
 	}
+	adj.insert(adj.end(), found, found + kept);
 }
 // Parses the config file for needed variables in class.
-void simulate::parseConfig(ifstream& config)
+void simulate::parseConfig(istream& config)
 {
 	string read;
 	size_t pos;
 	int position = 0;
 	int start,end;
-	const int numParams = 10;
+	const int numParams = 16;
 	// All paramters, will look for this exact string in the file.
 	string params[numParams] = {"turns","maximum_armies",
 						"cities_per_player",
@@ -586,13 +697,20 @@ void simulate::parseConfig(ifstream& config)
 						"mountain_character",
 						"forest_character",
 						"ocean_character",
-						"river_character"};
+						"river_character",
+						"stop_when_stable",
+						"stop_on_cycle",
+						"neighbours",
+						"wrap_edges",
+						"grid_layout",
+						"sort_units"};
+	string temp;
+	stringstream s;
 	// Reads each line in the file
 	while(!config.eof())
 	{
 		getline(config,read);
-		string temp;
-		stringstream s;
+		s.clear();
 
 		for(int i = 0; i<numParams; i++)
 		{
@@ -667,12 +785,90 @@ void simulate::parseConfig(ifstream& config)
 					case(9):
 					river = read[start+1];
 					break;
+
+					case(10):
+					pos = read.find_last_of("'");
+					end = pos;
+					temp = read.substr(start+1,end-1);
+					s.str(temp);
+					s>>stableTurns;
+					break;
+
+					case(11):
+					pos = read.find_last_of("'");
+					end = pos;
+					temp = read.substr(start+1,end-1);
+					s.str(temp);
+					s>>cycleTurns;
+					break;
+
+					case(12):
+					pos = read.find_last_of("'");
+					end = pos;
+					temp = read.substr(start+1,end-1);
+					s.str(temp);
+					s>>neighbours;
+					if(neighbours != vonNeumannGrid && neighbours != hexGrid && neighbours != mooreGrid)
+					{
+						printError(4);
+						simfail = 1;
+					}
+					break;
+
+					case(13):
+					pos = read.find_last_of("'");
+					end = pos;
+					temp = read.substr(start+1,end-1);
+					s.str(temp);
+					s>>wrapEdges;
+					break;
+
+					case(14):
+					pos = read.find_last_of("'");
+					temp = read.substr(start+1,pos-start-1);
+					if(temp == "rows")
+					{
+						gridLayout = rowLayout;
+					}
+					else if(temp == "morton")
+					{
+						gridLayout = mortonLayout;
+					}
+					else
+					{
+						printError(5);
+						simfail = 1;
+					}
+					break;
+
+					case(15):
+					pos = read.find_last_of("'");
+					end = pos;
+					temp = read.substr(start+1,end-1);
+					s.str(temp);
+					s>>sortTurns;
+					break;
 				}
 			}
 		}
 	}
 }
 
+// Starts the random sequence over from seed
+void simulate::setSeed(unsigned int seed)
+{
+	memset(&randomData, 0, sizeof(randomData));
+	initstate_r(seed, randomState, sizeof(randomState), &randomData);
+}
+
+// Next random number, 0 to RAND_MAX
+int simulate::nextRandom()
+{
+	int32_t value;
+	random_r(&randomData, &value);
+	return value;
+}
+
 // Prints off errors encountered during the simulation to cerr
 void simulate::printError(int errorNum)
 {
@@ -682,6 +878,12 @@ void simulate::printError(int errorNum)
 		break;
 		case 2: cerr<<"simulate: X and Y coordinates of map must be greater than 0, simulation failed!\n";
 		break;
+		case 3: cerr<<"simulate: Could not write the action list!\n";
+		break;
+		case 4: cerr<<"simulate: neighbours must be 4, 6 or 8, simulation failed!\n";
+		break;
+		case 5: cerr<<"simulate: grid_layout must be rows or morton, simulation failed!\n";
+		break;
 		default: cerr<<"simulate: unknown error, simulation failed!\n";
 		break;
 	}
@@ -691,28 +893,11 @@ void simulate::printError(int errorNum)
 // This is established in the config file.
 void simulate::setup()
 {
-	output<<"0"<<endl;
-	char ter;
-	coord temp;
-	vector <coord> settle;
+	actionList.turn(0);
 	int random,color;
 	int x,y;
-	// Stores all suitable starting locations in an array.
-	// A suitable location will be a plains or forest.
-	for(int i = 0;i<mapX;i++)
-	{
-		for(int j = 0;j<mapY;j++)
-		{
-			ter = map[i][j].terrain;
-			if(ter == plains || ter == forest)
-			{
-				temp.x = i;
-				temp.y = j;
-				settle.push_back(temp);
-			}
-		}
-	}
-	
+	int open = openSpaces; // Spaces a road or army can take
+	// The suitable starting locations were stored by populateMap
 	if(settle.size() <= 0 || (settle.size() < (numPlayers*total_cities)))
 	{
 		cerr<<"simulate: map could not store all cities, simulation failed!\n";
@@ -720,6 +905,17 @@ void simulate::setup()
 	}
 	else
 	{
+		// Units never outgrow these, so no turn has to grow a vector.
+		// Roads and armies each hold a space that is not mountain or ocean.
+		city.reserve(numPlayers*total_cities);
+		road.reserve(open);
+		army.reserve(numPlayers*maxArmies < open ? numPlayers*maxArmies : open);
+		adjacent.reserve(maxNeighbours);
+		if(sortTurns > 0)
+		{
+			sortScratch.reserve(road.capacity() > army.capacity() ? road.capacity() : army.capacity());
+		}
+		turnHashes.reserve(cycleTurns > 0 ? cycleTurns : 0);
 		// Places x starting cities for each player.
 		// x represents the total_cities variable.
 		// Chooses the starting locations randomly
@@ -736,16 +932,18 @@ void simulate::setup()
 
 			for(int k = 0; k<total_cities; k++)
 			{
-				random = rand() % settle.size();	
+				random = nextRandom() % settle.size();	
 				x = settle[random].x;
 				y = settle[random].y;
 				create(1,x,y,color);
-				settle[random].x = settle.back().x;
-				settle[random].y = settle.back().y;
+				coord last = settle.back();
+				settle.edit(random) = last;
 				settle.pop_back();
 			}
 		}
 	}
+	// Forks started from here on have no use for it
+	settle = cowArray<coord>();
 }
 
 // Moves a unit from an old coordinate to a new one.
@@ -755,11 +953,19 @@ void simulate::setup()
 void simulate::moveUnit(int x_old, int y_old, int x, int y)
 {
 	int arraySpot = findArmy(x_old,y_old);
-	army[arraySpot].x = x;
-	army[arraySpot].y = y;
-	output<<"M "<<y_old<<" "<<x_old<<" "<<y<<" "<<x<<endl;
-	map[x_old][y_old].unit = false;
-	map[x][y].unit = true;
+	simUnit& moved = army.edit(arraySpot);
+	moved.x = x;
+	moved.y = y;
+	hash ^= zobristKey(3,x_old,y_old,moved.color) ^ zobristKey(3,x,y,moved.color);
+	actionRecord rec;
+	rec.action = moveRecord;
+	rec.x = y_old;
+	rec.y = x_old;
+	rec.newX = y;
+	rec.newY = x;
+	actionList.add(rec);
+	editCell(x_old,y_old).unit = false;
+	editCell(x,y).unit = true;
 }
 
 // Changes the color of an object at a given coordinate.
@@ -775,21 +981,34 @@ void simulate::color(int object, int x, int y, int color)
 		case 1:
 		layer = 1;
 		spot = findCity(x,y);
-		city[spot].color = color;
+		hash ^= zobristKey(1,x,y,city[spot].color) ^ zobristKey(1,x,y,color);
+		city.edit(spot).color = color;
 		break;
 		case 2:
 		layer = 1;
 		spot = findRoad(x,y);
-		road[spot].color = color;
+		hash ^= zobristKey(2,x,y,road[spot].color) ^ zobristKey(2,x,y,color);
+		road.edit(spot).color = color;
 		break;
 		case 3:
 		layer = 2;
 		spot = findArmy(x,y);
-		army[spot].color = color;
+		hash ^= zobristKey(3,x,y,army[spot].color) ^ zobristKey(3,x,y,color);
+		army.edit(spot).color = color;
 		break;
 	}
+	if(layer == 1)
+	{
+		ownerChanged = currentTurn;
+	}
 
-	output<<"L "<<layer<<" "<<y<<" "<<x<<" "<<color<<endl;
+	actionRecord rec;
+	rec.action = colorRecord;
+	rec.layer = layer;
+	rec.x = y;
+	rec.y = x;
+	rec.color = color;
+	actionList.add(rec);
 }
 
 // Destroys a unit (road/city/army) at a given location.
@@ -803,35 +1022,38 @@ void simulate::destroy(int layer, int x, int y)
 	switch(layer)
 	{
 		case 1:
-		if(map[x][y].city == 1)
+		ownerChanged = currentTurn;
+		if(cell(x,y).city == 1)
 		{
 			spot = findCity(x,y);
-			city[spot].x = city.back().x;
-			city[spot].y = city.back().y;
-			city[spot].color = city.back().color;
+			hash ^= zobristKey(1,x,y,city[spot].color);
+			city.edit(spot) = city.back();
 			city.pop_back();
 		}
 		else
 		{
 			spot = findRoad(x,y);
-			road[spot].x = road.back().x;
-			road[spot].y = road.back().y;
-			road[spot].color = road.back().color;
+			hash ^= zobristKey(2,x,y,road[spot].color);
+			road.edit(spot) = road.back();
 			road.pop_back();
 		}
-		map[x][y].city = 0;
+		editCell(x,y).city = 0;
 		break;
 
 		case 2:
 			spot = findArmy(x,y);
-			army[spot].x = army.back().x;
-			army[spot].y = army.back().y;
-			army[spot].color = army.back().color;
+			hash ^= zobristKey(3,x,y,army[spot].color);
+			army.edit(spot) = army.back();
 			army.pop_back();
-			map[x][y].unit = false;
+			editCell(x,y).unit = false;
 		break;
 	}
-	output<<"D "<<layer<<" "<<y<<" "<<x<<endl;
+	actionRecord rec;
+	rec.action = destroyRecord;
+	rec.layer = layer;
+	rec.x = y;
+	rec.y = x;
+	actionList.add(rec);
 }
 
 // Will find an army unit at the given coordinate inside of the army vector.
@@ -894,15 +1116,15 @@ int simulate::findRoad(int x, int y)
 // This method updates all appopriate variables/vectors to make this happen.
 void simulate::create(int object, int x, int y, int color)
 {
-	string type;
+	char type = 0;
 	simUnit temp;
 	int layer;
 
 	switch(object)
 	{
 		case 1:
-		type = "city";
-		map[x][y].city = 1;
+		type = cityObject;
+		editCell(x,y).city = 1;
 		temp.color = color;
 		temp.x = x;
 		temp.y = y;
@@ -910,8 +1132,8 @@ void simulate::create(int object, int x, int y, int color)
 		city.push_back(temp);
 		break;
 		case 2:
-		type = "road";
-		map[x][y].city = 2;
+		type = roadObject;
+		editCell(x,y).city = 2;
 		temp.color = color;
 		temp.x = x;
 		temp.y = y;
@@ -919,8 +1141,8 @@ void simulate::create(int object, int x, int y, int color)
 		road.push_back(temp);
 		break;
 		case 3:
-		type = "army";
-		map[x][y].unit = true;
+		type = armyObject;
+		editCell(x,y).unit = true;
 		temp.color = color;
 		temp.x = x;
 		temp.y = y;
@@ -929,6 +1151,19 @@ void simulate::create(int object, int x, int y, int color)
 		break;
 	}
 
-	output<<"C "<<layer<<" "<<y<<" "<<x<<" "<<color<<" "<<type<<endl;
+	hash ^= zobristKey(object,x,y,color);
+	if(object != 3)
+	{
+		ownerChanged = currentTurn;
+	}
+
+	actionRecord rec;
+	rec.action = createRecord;
+	rec.layer = layer;
+	rec.x = y;
+	rec.y = x;
+	rec.color = color;
+	rec.object = type;
+	actionList.add(rec);
 }
 
@@ -6,20 +6,39 @@
 // Date: 12/11/13
 //
 #include <stdlib.h>
+#include <string.h>
 #include <iomanip>
 #include <fstream>
 #include <iostream>
 #include <vector> //STL vector header file
 #include <string>
 #include <sstream> 
+#include "mapfile.h"
+#include "actionwriter.h"
+#include "cowarray.h"
+#include "topology.h"
 
 using namespace std;
+
+//Orders of the map cells in memory, see the grid_layout config key
+#define rowLayout 0	//Row after row
+#define mortonLayout 1	//gridTile x gridTile tiles row after row, the cells
+			//of a tile in Z (Morton) order
+#define gridTile 8
+
+//Why a run ended, see stopReason
+#define stopAllTurns 0	//Every turn of the config was run
+#define stopStable 1	//No city or road changed owner for stop_when_stable turns
+#define stopCycle 2	//For stop_on_cycle turns in a row the state repeated one of
+			//the stop_on_cycle turns before it
+
 //Represents each space on the map which contains
 // a unit, terrain, and a city or road.
 struct mapNode
 {
 bool unit;
 char terrain;
+bool open;//Armies and roads may enter, false for ocean, mountain and the border
 int city;
 };
 
@@ -46,16 +65,58 @@ class simulate
 public:
 // size of map, mapX is number of columns, mapY is number of rows
 int mapX, mapY;
-//Represents simulation map
-vector < vector <mapNode> > map;
-//Constructor-requires size of map
-simulate(int mapsizeX, int mapsizeY);
-//Creates a map based on output from map generation
-void populateMap(ifstream& map);
+//Represents simulation map, copy-on-write so forks share it. A border
+//of closed cells runs round it. The cells are in the order of the grid
+//layout, read them through cell().
+cowArray <mapNode> map;
+//Space x,y of the map, -1 and the map size are the border. Both layouts
+//split the index of a cell into a part for its row and one for its column.
+const mapNode& cell(int x, int y) { return map[rowOffset[x+1] + columnOffset[y+1]]; }
+//Constructor-requires size of map, the action list goes to
+//action_list.txt unless another stream buffer is given.
+//directIO writes action_list.txt past the page cache.
+simulate(int mapsizeX, int mapsizeY, streambuf* actions = NULL, bool directIO = false);
+//Forks parent: the branch starts at parent's turn with its map, units,
+//config and random sequence and writes the turns it runs to actions.
+//The map and unit lists are shared until one of the two changes them,
+//so a fork costs a pointer per 1KB chunk. Change the branch with
+//parseConfig (e.g. maximum_armies) or setSeed before running it.
+//With an arena the chunks the branch copies or adds come from it, so
+//batches of games forked from one populated map allocate nothing from
+//the heap for their map and units; rewind the arena once it is gone.
+simulate(const simulate& parent, streambuf* actions, gameArena* arena = NULL);
+//Creates a map based on output from map generation, after parseConfig;
+//a binary map's legend replaces the terrain characters of the config
+void populateMap(const mapFile& terrain);
 //Populates all the required constants of the class
-void parseConfig(ifstream& config);
+void parseConfig(istream& config);
+//Seeds the random choices of the simulation, 1 unless set
+void setSeed(unsigned int seed);
 //Runs the simulation to completion
 void runSim();
+//Sets up the map on the first call, then runs turns until turn is done.
+//Returns false once the run is over (last turn, stop rule or failure).
+bool runTo(int turn);
+//Waits until the whole action list is written, call once after runTo
+void finish();
+//Write and stall times of the action list once runSim is done
+const actionWriter& actionStats() { return actionList; }
+//Streams the action list to the clients of server, set before runSim
+void watch(spectatorServer* server) { actionList.watch(server); }
+//Zobrist hash of the city/road owners and army positions, kept up to
+//date by create, destroy, color and moveUnit and written to the action
+//list at the end of every turn. The terrain is not part of it.
+unsigned long long stateHash() { return hash; }
+//stopAllTurns, stopStable or stopCycle once runSim is done
+int stopReason() { return stopped; }
+//Turns run, fewer than the config asks for if a stop rule ended the run
+int turnsRun() { return currentTurn; }
+//True once the simulation has failed, its error is already printed
+bool failed() { return simfail; }
+//Number of cities (1), roads (2) or armies (3) of color
+int count(int object, int color);
+//Bytes of the map and unit lists shared with forks and bytes held alone
+void memoryUse(long long& shared, long long& owned);
 
 private:
 int currentTurn,numTurns; //Keeps track of current turn, and total turns
@@ -66,16 +127,57 @@ int total_cities;//Total of cities that each player has
 char plains, mountain, forest, ocean, river;//Representation of terrain types
 int p1Color;//Color code which represents player1
 int p2Color;//Color code which represents player2
-ofstream output;//Output file that action list is written to
+actionWriter actionList;//Writes the action list on a thread of its own
 bool simfail;
+bool started;//setup has run
+int neighbours;//vonNeumannGrid, hexGrid or mooreGrid
+int wrapEdges;//1 if the map wraps round at its edges
+int gridLayout;//rowLayout or mortonLayout
+int sortTurns;//Turns between sorts of the unit lists into layout order, 0 for never
+vector <int> rowOffset, columnOffset;//Index of a cell is the sum of the two
+vector <simUnit> sortScratch;//Unit list being sorted
+//Lays the map out in gridLayout, every cell a border cell
+void layOut();
+//Sorts the cities, roads and armies into the order of their cells in memory
+void sortUnits();
+unsigned long long hash;//Zobrist hash of the state
+int stableTurns;//Turns without an owner change that end the run, 0 for never
+int cycleTurns;//Turns searched for a repeated state, 0 for never
+int repeats;//Turns in a row whose state was in turnHashes
+int ownerChanged;//Last turn a city or road was created, destroyed or recolored
+vector <unsigned long long> turnHashes;//Hashes at the end of the last cycleTurns turns
+int stopped;
+//Key of one object (1 city, 2 road, 3 army) of color at x,y
+unsigned long long zobristKey(int object, int x, int y, int color);
+//Writes the hash of the turn and checks the stop rules, returns true
+//if the run should end
+bool endTurn();
+//Random sequence of this simulation, the same numbers rand() gives after
+//srand() but kept per object so several simulations can run on threads
+struct random_data randomData;
+char randomState[128];
+int nextRandom();
+//Space x,y of the map for writing
+mapNode& editCell(int x, int y) { return map.edit(rowOffset[x+1] + columnOffset[y+1]); }
 //Will find all adjacent spaces on the map at the given position
-void findAdjacent(int x, int y,vector<coord>&adj);
+template <class Topology> void findAdjacent(int x, int y,vector<coord>&adj);
+//Runs turns up to turn with the adjacency of Topology
+template <class Topology> void runTurns(int turn);
 //Represents all city units
-vector <simUnit> city;
+cowArray <simUnit> city;
 //Represents all road units
-vector <simUnit> road;
+cowArray <simUnit> road;
 //Represents all armies
-vector <simUnit> army;
+cowArray <simUnit> army;
+//Adjacent spaces of the unit being simulated, a member so that
+//turns reuse its memory instead of allocating
+vector <coord> adjacent;
+//Plains and forest spaces, where setup may place a starting city, and
+//the spaces a road or army can take; both found by populateMap so that
+//forks of a populated map do not search it again. setup takes its picks
+//out of settle, copying only the chunks it changes.
+cowArray <coord> settle;
+int openSpaces;
 //Sets up the map with initial cities
 void setup();
 //Moves a unit from one place to another
@@ -89,9 +191,9 @@ void color(int object, int x, int y, int color);
 //Chooses the actions of each simulation unit (army,city,road)
 void simTurn();
 //Simulates all city/road actions
-void simCities(int player);
+template <class Topology> void simCities(int player);
 //Simulates all army actions
-void simArmies(int player);
+template <class Topology> void simArmies(int player);
 //Prints error messages from simulation
 void printError(int errorNum);
 //Allows city at a specific coordinate to be found in city vector
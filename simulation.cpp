@@ -2,53 +2,156 @@
 // Client code for simulation class
 
 #include "simulate.h"
+#include "trace.h"
+#include "perfcount.h"
+#include "spectator.h"
 using namespace std;
 
 int main(int argc, char* argv[])
 {
-	unsigned int x,y;
-	ifstream input;
-	
-	// Ensures that there are enough arguments in the command line
-	if(argc < 3)
+	unsigned int x = 0,y = 0;
+	mapFile terrain;
+	bool loaded = false;
+	const char* traceName = NULL;
+	bool perfCounters = false;
+	bool directIO = false;
+	const char* serveName = NULL;
+	spectatorServer spectators;
+	int arg = 1;
+
+	// --trace <file> writes a trace-event timeline of the turns,
+	// --perf-counters prints hardware counters per phase at the end,
+	// --alloc-stats adds the heap allocations of every phase to it,
+	// --direct-io writes the action list past the page cache,
+	// --serve <socket> streams the run to printmap --connect viewers
+	while(arg < argc && strncmp(argv[arg], "--", 2) == 0)
 	{
-		cerr<<"simulation: Not enough arguments, simulation  failed!\n";
+		if(strcmp(argv[arg], "--trace") == 0 && arg + 1 < argc)
+		{
+			traceName = argv[arg+1];
+			arg += 2;
+		}
+		else if(strcmp(argv[arg], "--perf-counters") == 0)
+		{
+			perfCounters = true;
+			arg++;
+		}
+		else if(strcmp(argv[arg], "--alloc-stats") == 0)
+		{
+			perfTrackAllocations();
+			arg++;
+		}
+		else if(strcmp(argv[arg], "--direct-io") == 0)
+		{
+			directIO = true;
+			arg++;
+		}
+		else if(strcmp(argv[arg], "--serve") == 0 && arg + 1 < argc)
+		{
+			serveName = argv[arg+1];
+			arg += 2;
+		}
+		else break;
 	}
-	else
+	if(traceName)
 	{
-		input.open(argv[1]);
-		x = atoi(argv[2]);
-		y = atoi(argv[3]);
+		traceStart(traceName);
+		traceThreadName("simulation");
 	}
-
-	// Begins a new simulation if the correct paramters were recieved
-	simulate X(x,y);
-
-	// Simulation is over if the map file can't load, otherwise, the map is built
-	// in simulation.
-	if(!input.is_open())
+	if(perfCounters)
 	{
-		cerr<<"simulation: Could not open map file, simulation failed!\n";
+		string error;
+		if(!perfStart(error))
+		{
+			cerr<<"simulation: hardware counters unavailable ("<<error<<"), phases are only timed\n";
+		}
+	}
+	
+	// Ensures that there are enough arguments in the command line.
+	// The map size comes from the map file unless it is given.
+	if(argc < arg + 1)
+	{
+		cerr<<"simulation: Not enough arguments, simulation  failed!\n";
 	}
 	else
 	{
-		X.populateMap(input);
+		loaded = terrain.load(argv[arg]);
+		x = terrain.height;
+		y = terrain.width;
+		if(argc > arg + 2)
+		{
+			x = atoi(argv[arg+1]);
+			y = atoi(argv[arg+2]);
+		}
 	}
 
+	// Begins a new simulation if the correct paramters were recieved
+	simulate X(x,y,NULL,directIO);
+
 	// Parses the config file in order to set some class variables for simulation.
 	ifstream conf("config");
+	int status = 0;
 
-	// Simulation is over if the config file cannot be opened. 
-	// If it is, then the config file is parsed and the simulation is ran.
-	if(!input.is_open())
+	// Simulation is over if the map file or the config file can't load.
+	// Otherwise the config is parsed, the map is built in simulation
+	// and the simulation is ran.
+	if(!loaded)
+	{
+		cerr<<"simulation: Could not open map file, simulation failed!\n";
+		status = 1;
+	}
+	else if(!conf.is_open())
 	{
 		cerr<<"simulation: Could not open configuration file, simulation failed!\n";
+		status = 1;
 	}
 	else
 	{
 		X.parseConfig(conf);
+		X.populateMap(terrain);
+		if(serveName)
+		{
+			string error;
+			if(spectators.open(serveName, terrain, error))
+			{
+				X.watch(&spectators);
+			}
+			else
+			{
+				cerr<<"simulation: could not serve "<<serveName<<" ("<<error<<")\n";
+				serveName = NULL;
+			}
+		}
 		X.runSim();
+		spectators.close();
+		if(X.failed())
+		{
+			status = 1;
+		}
+		if(X.stopReason() == stopStable)
+		{
+			cerr<<"simulation: stopped after turn "<<X.turnsRun()<<", no city or road changed owner (reason "<<stopStable<<")\n";
+		}
+		else if(X.stopReason() == stopCycle)
+		{
+			cerr<<"simulation: stopped after turn "<<X.turnsRun()<<", the state is cycling (reason "<<stopCycle<<")\n";
+		}
+
+		const actionWriter& log = X.actionStats();
+		cerr<<"simulation: action list "<<log.bytes<<" bytes in "<<log.writes<<" writes"
+		    <<(log.direct ? " (O_DIRECT)" : "")<<", writer busy "<<log.writeSeconds
+		    <<"s, turns stalled on the writer "<<log.stallSeconds<<"s\n";
+		if(serveName)
+		{
+			cerr<<"simulation: "<<spectators.clients<<" spectators, "<<spectators.forwarded
+			    <<" fast-forwarded, "<<spectators.dropped<<" dropped\n";
+		}
+	}
+	perfReport(cerr);
+	if(traceName && !traceStop())
+	{
+		cerr<<"simulation: could not write "<<traceName<<"\n";
 	}
-	return 0;
+	return status;
 }
 
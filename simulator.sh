@@ -2,6 +2,7 @@
 x=100
 y=50
 mapfile=map
-./mapcreate $x $y > $mapfile
-./simulation $mapfile $y $x
+./mapcreate -f rle $x $y > $mapfile
+./simulation $mapfile
+./logindex
 ./printmap
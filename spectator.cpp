@@ -0,0 +1,497 @@
+////////////////////////////////////////////////////////
+// File name: spectator.cpp
+// Description: Implementation of the spectatorServer and
+// spectatorClient classes
+//
+#include "spectator.h"
+#include "actionwriter.h"
+#include "trace.h"
+#include <chrono>
+#include <errno.h>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+using namespace std;
+
+typedef chrono::steady_clock spectatorClock;
+
+// Appends the kind and payload length of a message
+static void appendHeader(string& out, char kind, int length)
+{
+	out += kind;
+	out.append((const char*)&length, sizeof(length));
+}
+
+// Payload length of the message that starts at queue[at]
+static int messageLength(const string& queue, size_t at)
+{
+	int length;
+	memcpy(&length, queue.data() + at + 1, sizeof(length));
+	return length;
+}
+
+// Fills a socket address, returns false if the path does not fit
+static bool socketAddress(const char* path, struct sockaddr_un& address)
+{
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(address.sun_path))
+	{
+		return false;
+	}
+	strcpy(address.sun_path, path);
+	return true;
+}
+
+spectatorServer::spectatorServer()
+	: state(0, 0)	//Sized to the map by open
+{
+	clients = 0;
+	forwarded = 0;
+	dropped = 0;
+	started = false;
+	closing = false;
+	listener = -1;
+	wake[0] = wake[1] = -1;
+	now = 0;
+	lastTurn = -1;
+	keyframeTurn = -2;
+}
+
+spectatorServer::~spectatorServer()
+{
+	close();
+}
+
+bool spectatorServer::open(const char* path, const mapFile& terrain, string& error)
+{
+	struct sockaddr_un address;
+	struct stat info;
+
+	if(!socketAddress(path, address))
+	{
+		error = "socket path too long";
+		return false;
+	}
+	// A socket left by an earlier run would make bind fail
+	if(lstat(path, &info) == 0 && S_ISSOCK(info.st_mode))
+	{
+		unlink(path);
+	}
+	listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0
+	   || listen(listener, 16) != 0 || pipe2(wake, O_NONBLOCK | O_CLOEXEC) != 0)
+	{
+		error = strerror(errno);
+		if(listener >= 0) ::close(listener);
+		listener = -1;
+		return false;
+	}
+
+	// Every client starts with the same map message
+	int size[2] = {terrain.width, terrain.height};
+	long long cells = (long long)terrain.width*terrain.height;
+	appendHeader(mapMessage, spectatorMap, sizeof(size) + legendSize + cells);
+	mapMessage.append((const char*)size, sizeof(size));
+	mapMessage.append(terrain.legend, legendSize);
+	mapMessage.append(terrain.terrain.data(), cells);
+	state = mapState(terrain.width, terrain.height);
+
+	socketName = path;
+	started = true;
+	server = thread(&spectatorServer::run, this);
+	return true;
+}
+
+void spectatorServer::add(const actionRecord* records, size_t count)
+{
+	{
+		lock_guard<mutex> lock(guard);
+		inbox.insert(inbox.end(), records, records + count);
+	}
+	// A full pipe already holds a wake up
+	char signal = 0;
+	if(write(wake[1], &signal, 1) < 0) {}
+}
+
+void spectatorServer::close()
+{
+	if(!started)
+	{
+		return;
+	}
+	{
+		lock_guard<mutex> lock(guard);
+		closing = true;
+	}
+	char signal = 0;
+	if(write(wake[1], &signal, 1) < 0) {}
+	server.join();
+	started = false;
+
+	for(size_t c = 0; c < watchers.size(); c++)
+	{
+		::close(watchers[c].fd);
+	}
+	watchers.clear();
+	::close(listener);
+	::close(wake[0]);
+	::close(wake[1]);
+	listener = -1;
+	unlink(socketName.c_str());
+}
+
+void spectatorServer::run()
+{
+	traceThreadName("spectators");
+	vector<struct pollfd> fds;
+	struct pollfd entry;
+	char scratch[4096];
+	bool done = false;
+
+	while(true)
+	{
+		// After the run the server only stays until the clients have it all
+		bool waiting = false;
+		for(size_t c = 0; c < watchers.size(); c++)
+		{
+			waiting = waiting || watchers[c].sent < watchers[c].queue.size();
+		}
+		if(done && !waiting)
+		{
+			break;
+		}
+
+		fds.clear();
+		entry.fd = listener;
+		entry.events = POLLIN;
+		fds.push_back(entry);
+		entry.fd = wake[0];
+		fds.push_back(entry);
+		for(size_t c = 0; c < watchers.size(); c++)
+		{
+			entry.fd = watchers[c].fd;
+			entry.events = POLLIN;
+			if(watchers[c].sent < watchers[c].queue.size()) entry.events |= POLLOUT;
+			fds.push_back(entry);
+		}
+		poll(fds.data(), fds.size(), 1000);
+		now = chrono::duration<double>(spectatorClock::now().time_since_epoch()).count();
+
+		// Clients only ever send to hang up, a stalled one is dropped
+		double limit = done ? 1 : spectatorTimeout;
+		size_t kept = 0;
+		for(size_t c = 0; c < watchers.size(); c++)
+		{
+			spectator& client = watchers[c];
+			short events = fds[c + 2].revents;
+			bool gone = (events & (POLLERR | POLLHUP)) != 0;
+			if(events & POLLIN)
+			{
+				ssize_t count = recv(client.fd, scratch, sizeof(scratch), MSG_DONTWAIT);
+				gone = gone || count == 0 || (count < 0 && errno != EAGAIN && errno != EINTR);
+			}
+			if(!gone && (events & POLLOUT))
+			{
+				gone = !sendQueued(client);
+			}
+			if(!gone && client.sent < client.queue.size() && now - client.lastRead > limit)
+			{
+				gone = true;
+				dropped++;
+			}
+			if(gone)
+			{
+				::close(client.fd);
+				continue;
+			}
+			if(kept != c) swap(watchers[kept], client);
+			kept++;
+		}
+		watchers.resize(kept);
+
+		if(fds[1].revents & POLLIN)
+		{
+			while(read(wake[0], scratch, sizeof(scratch)) > 0) {}
+			records.clear();
+			{
+				lock_guard<mutex> lock(guard);
+				records.swap(inbox);
+				done = closing;
+			}
+			// A turn is whole once the next turn line arrives or the run ends
+			for(size_t r = 0; r < records.size(); r++)
+			{
+				if(records[r].action == turnRecord)
+				{
+					endTurn();
+				}
+				turnRecords.push_back(records[r]);
+			}
+			if(done)
+			{
+				endTurn();
+			}
+		}
+
+		if(fds[0].revents & POLLIN)
+		{
+			int fd;
+			while((fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+			{
+				spectator client;
+				client.fd = fd;
+				client.sent = 0;
+				client.message = 0;
+				client.lastRead = now;
+				queueMessage(client, spectatorMap, mapMessage.data() + spectatorHeader,
+				             mapMessage.size() - spectatorHeader);
+				queueKeyframe(client);
+				watchers.push_back(client);
+				clients++;
+			}
+		}
+	}
+}
+
+void spectatorServer::endTurn()
+{
+	if(turnRecords.empty())
+	{
+		return;
+	}
+	// Like replayTurn, anything before the first turn line is skipped
+	if(turnRecords[0].action == turnRecord)
+	{
+		traceSpan span("send turn", "clients", watchers.size());
+		char line[actionRecordText];
+		turnText.clear();
+		for(size_t r = 0; r < turnRecords.size(); r++)
+		{
+			state.apply(turnRecords[r]);
+			turnText.append(line, formatAction(line, turnRecords[r]) - line);
+		}
+		lastTurn = turnRecords[0].turn;
+		for(size_t c = 0; c < watchers.size(); c++)
+		{
+			queueMessage(watchers[c], spectatorActions, turnText.data(), turnText.size());
+		}
+	}
+	turnRecords.clear();
+}
+
+void spectatorServer::queueMessage(spectator& client, char kind, const char* payload, int length)
+{
+	if(client.sent == client.queue.size())
+	{
+		// An idle client has not stalled
+		client.lastRead = now;
+	}
+	if(kind == spectatorActions && client.queue.size() - client.sent + length > spectatorQueueBytes)
+	{
+		// The message being sent is finished, everything after it is
+		// replaced by the state at the end of this turn
+		skipSent(client);
+		size_t keep = client.message;
+		if(client.sent > client.message)
+		{
+			keep += spectatorHeader + messageLength(client.queue, client.message);
+		}
+		client.queue.resize(keep);
+		queueKeyframe(client);
+		forwarded++;
+		return;
+	}
+	appendHeader(client.queue, kind, length);
+	client.queue.append(payload, length);
+}
+
+void spectatorServer::queueKeyframe(spectator& client)
+{
+	if(keyframeTurn != lastTurn)
+	{
+		ostringstream out;
+		out.write((const char*)&lastTurn, sizeof(lastTurn));
+		state.writeKeyframe(out);
+		string payload = out.str();
+		keyframe.clear();
+		appendHeader(keyframe, spectatorKeyframe, payload.size());
+		keyframe += payload;
+		keyframeTurn = lastTurn;
+	}
+	client.queue += keyframe;
+}
+
+void spectatorServer::skipSent(spectator& client)
+{
+	while(client.message < client.sent
+	      && client.message + spectatorHeader + messageLength(client.queue, client.message) <= client.sent)
+	{
+		client.message += spectatorHeader + messageLength(client.queue, client.message);
+	}
+}
+
+bool spectatorServer::sendQueued(spectator& client)
+{
+	while(client.sent < client.queue.size())
+	{
+		ssize_t count = send(client.fd, client.queue.data() + client.sent, client.queue.size() - client.sent,
+		                     MSG_DONTWAIT | MSG_NOSIGNAL);
+		if(count < 0 && (errno == EAGAIN || errno == EINTR))
+		{
+			// Whole messages that went out are dropped from the queue
+			if(client.sent > spectatorQueueBytes)
+			{
+				skipSent(client);
+				client.queue.erase(0, client.message);
+				client.sent -= client.message;
+				client.message = 0;
+			}
+			return true;
+		}
+		if(count < 0)
+		{
+			return false;
+		}
+		client.sent += count;
+		client.lastRead = now;
+	}
+	// Everything went out, the queue starts over
+	client.queue.clear();
+	client.sent = 0;
+	client.message = 0;
+	return true;
+}
+
+spectatorClient::spectatorClient()
+{
+	turn = -1;
+	keyframes = 0;
+	fd = -1;
+	ended = false;
+}
+
+spectatorClient::~spectatorClient()
+{
+	if(fd >= 0)
+	{
+		::close(fd);
+	}
+}
+
+bool spectatorClient::connect(const char* path, string& error)
+{
+	struct sockaddr_un address;
+
+	if(!socketAddress(path, address))
+	{
+		error = "socket path too long";
+		return false;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0 || ::connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0)
+	{
+		error = strerror(errno);
+		return false;
+	}
+	return true;
+}
+
+bool spectatorClient::receive(int milliseconds)
+{
+	struct pollfd input;
+	char chunk[65536];
+
+	input.fd = fd;
+	input.events = POLLIN;
+	if(ended || poll(&input, 1, milliseconds) <= 0)
+	{
+		return !ended;
+	}
+	// Takes everything that is there without waiting again
+	while(true)
+	{
+		ssize_t count = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+		if(count > 0)
+		{
+			buffer.append(chunk, count);
+			continue;
+		}
+		if(count == 0 || (errno != EAGAIN && errno != EINTR))
+		{
+			ended = true;
+		}
+		break;
+	}
+	return !ended;
+}
+
+size_t spectatorClient::wholeMessage()
+{
+	if(buffer.size() < spectatorHeader)
+	{
+		return 0;
+	}
+	size_t length = spectatorHeader + messageLength(buffer, 0);
+	return buffer.size() >= length ? length : 0;
+}
+
+bool spectatorClient::readMap(mapFile& terrain)
+{
+	while(wholeMessage() == 0)
+	{
+		if(!receive(-1))
+		{
+			return false;
+		}
+	}
+	int size[2];
+	const char* payload = buffer.data() + spectatorHeader;
+	if(buffer[0] != spectatorMap)
+	{
+		return false;
+	}
+	memcpy(size, payload, sizeof(size));
+	terrain.width = size[0];
+	terrain.height = size[1];
+	terrain.encoding = mapRaw;
+	memcpy(terrain.legend, payload + sizeof(size), legendSize);
+	payload += sizeof(size) + legendSize;
+	terrain.terrain.assign(payload, payload + (long long)size[0]*size[1]);
+	buffer.erase(0, wholeMessage());
+	return true;
+}
+
+bool spectatorClient::update(mapState& state, int milliseconds)
+{
+	receive(milliseconds);
+
+	size_t done = 0;
+	size_t length;
+	while(buffer.size() - done >= spectatorHeader
+	      && buffer.size() - done >= (length = spectatorHeader + messageLength(buffer, done)))
+	{
+		const char* payload = buffer.data() + done + spectatorHeader;
+		int size = length - spectatorHeader;
+		if(buffer[done] == spectatorKeyframe)
+		{
+			istringstream in(string(payload + sizeof(turn), size - sizeof(turn)));
+			memcpy(&turn, payload, sizeof(turn));
+			state.readKeyframe(in);
+			keyframes++;
+		}
+		else if(buffer[done] == spectatorActions)
+		{
+			actionScanner scan(payload, payload + size);
+			int replayed;
+			while((replayed = replayTurn(scan, state)) >= 0)
+			{
+				turn = replayed;
+			}
+		}
+		done += length;
+	}
+	buffer.erase(0, done);
+	return !ended;
+}
@@ -0,0 +1,134 @@
+////////////////////////////////////////////////////////
+// File name: spectator.h
+// Description: Header file for the spectatorServer and spectatorClient
+// classes, which stream a running simulation to any number of viewers
+// on the same machine over a Unix domain socket. The action list
+// writer hands every turn to the server, whose thread replays it into
+// a mapState and queues its text for each client. A new client gets
+// the map and a keyframe of the last whole turn, then the live turns.
+// Every client has a bounded queue; one that falls that far behind is
+// fast-forwarded to a fresh keyframe, and one that reads nothing for
+// spectatorTimeout seconds is dropped, so viewers never hold up the run.
+//
+// Stream format, messages of a kind byte and an int payload length
+// (native byte order) followed by the payload:
+//   'M' map       int width, height, char legend[8],
+//                 width*height terrain characters row by row
+//   'K' keyframe  int turn, then the state in the mapState keyframe format
+//   'A' actions   whole turns of action list text
+//
+#ifndef SPECTATOR_H
+#define SPECTATOR_H
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "actionlog.h"
+#include "mapfile.h"
+#include "mapstate.h"
+
+#define spectatorQueueBytes (4 << 20)	//Unsent bytes a client may fall behind by
+#define spectatorTimeout 30		//Seconds a client may read nothing
+#define spectatorHeader 5		//Kind byte and payload length
+
+//Message kinds
+#define spectatorMap 'M'
+#define spectatorKeyframe 'K'
+#define spectatorActions 'A'
+
+//spectatorServer - sends a running simulation to the clients of a socket
+class spectatorServer
+{
+public:
+spectatorServer();
+~spectatorServer();
+//Listens on path and starts the server thread, a stale socket file
+//is replaced. Returns false and sets error if the socket cannot be made.
+bool open(const char* path, const mapFile& terrain, std::string& error);
+//Hands records of the action list to the server, called by the writer
+void add(const actionRecord* records, size_t count);
+//Sends the last turn, waits for the clients to get what is queued
+//(dropping any that stall) and removes the socket
+void close();
+
+int clients;		//Clients that connected
+int forwarded;		//Times a client was fast-forwarded
+int dropped;		//Clients dropped for not reading
+
+private:
+//One connected client
+struct spectator
+{
+	int fd;
+	std::string queue;	//Messages, queue[sent] is the next byte to send
+	size_t sent;
+	size_t message;		//Start of the message that queue[sent] belongs to
+	double lastRead;	//Time the client last took a byte
+};
+
+//Server thread
+void run();
+//Replays and queues the records of the turn in turnRecords
+void endTurn();
+//Appends a message to a client, fast-forwards it if it falls behind
+void queueMessage(spectator& client, char kind, const char* payload, int length);
+//Appends the latest keyframe to a client
+void queueKeyframe(spectator& client);
+//Moves message past the messages that were sent whole
+void skipSent(spectator& client);
+//Sends what the socket takes, returns false if the client is gone
+bool sendQueued(spectator& client);
+
+std::thread server;
+bool started;
+std::string socketName;
+int listener;
+int wake[2];		//Pipe the writer uses to wake the server thread
+
+std::mutex guard;	//Protects inbox and closing
+std::vector<actionRecord> inbox;
+bool closing;
+
+std::vector<spectator> watchers;
+double now;		//Time of the current poll round
+std::string mapMessage;
+mapState state;
+int lastTurn;		//Last whole turn in state, -1 before the first
+std::vector<actionRecord> records;	//Records taken from the inbox
+std::vector<actionRecord> turnRecords;	//Records of the turn in progress
+std::string turnText;
+std::string keyframe;	//Keyframe message of keyframeTurn
+int keyframeTurn;
+};
+
+//spectatorClient - viewer side of a spectator stream
+class spectatorClient
+{
+public:
+spectatorClient();
+~spectatorClient();
+//Connects to a server, returns false and sets error if it fails
+bool connect(const char* path, std::string& error);
+//Waits for the map message, returns false if the stream ends first
+bool readMap(mapFile& terrain);
+//Applies every whole message that has arrived, waiting up to
+//milliseconds for the first one. Returns false once the server closed
+//the stream and everything was applied.
+bool update(mapState& state, int milliseconds);
+
+int turn;		//Last turn applied, -1 before the first
+int keyframes;		//Keyframes applied, more than one means the viewer skipped ahead
+
+private:
+//Reads what the socket has, returns false at the end of the stream
+bool receive(int milliseconds);
+//Length of the whole message at the start of buffer, 0 if it is not in yet
+size_t wholeMessage();
+
+int fd;
+bool ended;
+std::string buffer;
+};
+
+#endif
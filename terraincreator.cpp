@@ -1,4 +1,9 @@
+#include <stdio.h>
+#include <sys/stat.h>
+#include <fstream>
 #include "terraincreator.h"
+#include "trace.h"
+#include "perfcount.h"
 
 
 using namespace std;
@@ -29,7 +34,15 @@ terrainCreator::terrainCreator(unsigned int x,unsigned int y)
 
     m_map_x = x;
     m_map_y = y;
-    m_map = new char[((m_map_x+1)*m_map_y)+1];
+    m_map = new char[((long long)(m_map_x+1)*m_map_y)+1];
+
+    m_seed = time(NULL);
+    m_featureCount = 0;
+    m_smoothPass = 0;
+    m_threads = std::thread::hardware_concurrency();
+    if(m_threads == 0) m_threads = 1;
+    memset(&m_random, 0, sizeof(m_random));
+    initstate_r(1, m_randomState, sizeof(m_randomState), &m_random);
 }
 
 //Function:
@@ -76,13 +89,13 @@ terrainCreator::~terrainCreator()
 //
 void terrainCreator::fillMap(char fillChar)
 {
-    unsigned int mapSize = ((m_map_x+1)*m_map_y);
+    long long mapSize = ((long long)(m_map_x+1)*m_map_y);
 
-    for(int i = 0; i < mapSize;i++)   //Fill map with fill character
+    for(long long i = 0; i < mapSize;i++)   //Fill map with fill character
     {
         m_map[i] = fillChar;
     }
-    for(int j = m_map_x; j < mapSize; (j = j + m_map_x + 1))
+    for(long long j = m_map_x; j < mapSize; (j = j + m_map_x + 1))
     {
         m_map[j] = '\n';
     }
@@ -119,30 +132,37 @@ void terrainCreator::createFeature(unsigned int agentNum, char featureChar, char
     m_agentMaxLife = agentMaxLife;
     //m_pattern = (algType)pattern;
 
+    if(m_agentMaxLife == 0) return;
 
-    srand(time(NULL));//Initialize random seed
+    //Initialize random seed, every feature gets its own sequence (the one srand() would give)
+    memset(&m_random, 0, sizeof(m_random));
+    initstate_r(m_seed + m_featureCount++, m_randomState, sizeof(m_randomState), &m_random);
 
-    unsigned int rand_location;
+    long long rand_location;
+    long long location[agentBatch];
+    unsigned int life[agentBatch];
+    unsigned int batched = 0;
+
+    buildSpawnIndex();
 
     for(int i = 0; i < agentNum; i++)
     {
-        rand_location = rand() % ((m_map_x+1)*(m_map_y));   //Generate random map location
-
-        if( isValidMapLocation(rand_location) )
-        {
-            if( isValidSubcharLocation(rand_location) )
-            {
-                terrainAgent(rand_location, (rand() % m_agentMaxLife));
-                continue;
-            }
-        }
+        rand_location = sampleSpawn();   //Random map location holding subChar
 
-        int closest = findClosestSubChar(rand_location);
+        if(rand_location == -1) break;  //No subChar left anywhere
 
-        if(closest == -1) continue;
-        else terrainAgent(closest, (rand() % m_agentMaxLife));
+        location[batched] = rand_location;
+        life[batched] = nextRandom() % m_agentMaxLife;
+        batched++;
 
+        if(batched == agentBatch)   //Walk a full batch of agents together
+        {
+            terrainAgents(location, life, batched);
+            batched = 0;
+        }
     }
+
+    terrainAgents(location, life, batched);
 }
 
 //Function:
@@ -151,6 +171,12 @@ void terrainCreator::createFeature(unsigned int agentNum, char featureChar, char
 //Description:
 //      By chance, may fill in locations with featureChar.
 //      Chance gets higher the more surrounding cells have featureChar's.
+//      Every subChar cell with weight neighbours (north, south, east, west) holding
+//      featureChar becomes featureChar when (random % 5) + 1 < weight.
+//      The pass reads a copy of the map and writes the map, so every cell sees its
+//      neighbours as they were before the pass. The random value of a cell is a hash
+//      of (seed, pass, cell) rather than a rand() sequence, so the result depends only
+//      on the seed and not on scan order or on how many threads share the work.
 //
 //Preconditions:
 //      Map must exist.
@@ -169,123 +195,551 @@ void terrainCreator::smoothFeature(char featureChar, char subChar)
 {
     m_subChar = subChar;
 
-    int weight = 0;
+    long long rowLength = m_map_x + 1;
+    long long mapSize = rowLength*m_map_y;
 
-    for(int i = 0;i < ((m_map_x+1)*m_map_y);i++)
+    //Source copy with a row of newlines above and below so edge rows need no checks.
+    //Newlines already sit at the end of every row, which covers the east and west edges.
+    std::vector<char> source(mapSize + 2*rowLength, '\n');
+    memcpy(&source[rowLength], m_map, mapSize);
+
+    unsigned long long pass = ((unsigned long long)m_seed << 32) | m_smoothPass++;
+    unsigned int tiles = (m_map_y + smoothTileRows - 1) / smoothTileRows;
+    unsigned int threads = m_threads < tiles ? m_threads : tiles;
+    std::vector<std::thread> workers;
+
+    //Tiles of smoothTileRows rows are dealt out round robin
+    for(unsigned int t = 1; t < threads; t++)
     {
-        if(!isValidSubcharLocation(m_map[i])) continue;
+        workers.push_back(std::thread(&terrainCreator::smoothTiles, this, &source[rowLength], t, threads, featureChar, pass));
+    }
+    smoothTiles(&source[rowLength], 0, threads > 0 ? threads : 1, featureChar, pass);
 
-        if( isValidMapLocation( i+1 ) )//look at east
-        {
-            if(m_map[i+1] == featureChar)
-            {
-                weight++;
-            }
-        }
+    for(unsigned int t = 0; t < workers.size(); t++)
+    {
+        workers[t].join();
+    }
+}
+
+//Function:
+//     smoothTiles
+//
+//Description:
+//      Runs smoothRow over the rows of the tiles first, first + step,
+//      first + 2*step...
+//
+//Preconditions:
+//      source is a padded copy of the map made by smoothFeature
+//
+//Arguments:
+//      source - first row of the padded copy
+//      first, step - tiles handled by this call
+//      featureChar - character to smooth
+//      pass - seed and pass number for cellRandom
+//
+//Postconditions:
+//      Rows of those tiles are written to m_map
+//
+//Returns:
+//      None
+//
+void terrainCreator::smoothTiles(const char* source, unsigned int first, unsigned int step, char featureChar, unsigned long long pass)
+{
+    traceSpan span("smooth tiles", "first", first);
+    long long rowLength = m_map_x + 1;
+    std::vector<unsigned char> weight(m_map_x + 16);
+
+    for(unsigned int tile = first; tile*smoothTileRows < m_map_y; tile += step)
+    {
+        unsigned int lastRow = (tile + 1)*smoothTileRows;
+        if(lastRow > m_map_y) lastRow = m_map_y;
 
-        if( isValidMapLocation( i-m_map_x-1 ) )//look at north
+        for(unsigned int y = tile*smoothTileRows; y < lastRow; y++)
         {
-            if(m_map[i-m_map_x-1] == featureChar)
-            {
-                weight++;
-            }
+            smoothRow(source + y*rowLength, rowLength, m_map + y*rowLength, &weight[0], featureChar, m_subChar, pass, y*rowLength);
         }
+    }
+}
+
+//Function:
+//     smoothRow
+//
+//Description:
+//      One smoothing pass over one row. Neighbour weights are counted 16 cells at
+//      a time with SSE2 byte compares, then only cells that can change draw a
+//      random value. Shared with the noise generator, which smooths map bands
+//      that are never whole in memory.
+//
+//Preconditions:
+//      The rows above and below row are readable and row ends with a newline
+//
+//Arguments:
+//      row - row of the read only copy
+//      rowLength - map width plus the newline
+//      out - same row of the map being written
+//      weight - scratch of at least rowLength + 15 bytes
+//      featureChar - character to smooth
+//      subChar - character featureChar can exist on
+//      pass - seed and pass number for cellRandom
+//      location - map array location of the first cell of the row
+//
+//Postconditions:
+//      Converted cells of the row are written to out
+//
+//Returns:
+//      None
+//
+void terrainCreator::smoothRow(const char* row, long long rowLength, char* out, unsigned char* weight, char featureChar, char subChar, unsigned long long pass, long long location)
+{
+    const char* north = row - rowLength;
+    const char* south = row + rowLength;
+    long long width = rowLength - 1;
+    long long x = 0;
+
+#ifdef __SSE2__
+    __m128i feature = _mm_set1_epi8(featureChar);
+    for(; x + 16 <= width; x += 16)
+    {
+        //Each compare is -1 where the neighbour matches, subtracting counts it
+        __m128i count = _mm_setzero_si128();
+        count = _mm_sub_epi8(count, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(north + x)), feature));
+        count = _mm_sub_epi8(count, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(south + x)), feature));
+        count = _mm_sub_epi8(count, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(row + x - 1)), feature));
+        count = _mm_sub_epi8(count, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(row + x + 1)), feature));
+        _mm_storeu_si128((__m128i*)&weight[x], count);
+    }
+#endif
+    for(; x < width; x++)
+    {
+        weight[x] = (north[x] == featureChar) + (south[x] == featureChar) +
+                    (row[x-1] == featureChar) + (row[x+1] == featureChar);
+    }
+
+    for(x = 0; x < width; x++)
+    {
+        //(random % 5) + 1 is at least 1, so fewer than two neighbours never change
+        if(weight[x] < 2 || row[x] != subChar) continue;
 
-        if( isValidMapLocation( i-1 ) )//look at west
+        if((int)(cellRandom(pass, location + x) % 5) + 1 < weight[x])
         {
-            if(m_map[i-1] == featureChar)
-            {
-                weight++;
-            }
+            out[x] = featureChar;
         }
+    }
+}
 
-        if( isValidMapLocation( i+m_map_x+1 ) )//look at south
+//Function:
+//     cellRandom
+//
+//Description:
+//      Counter based random number: the splitmix64 finalizer applied to the pass
+//      and the cell location. Same inputs always give the same value.
+//
+//Preconditions:
+//      None
+//
+//Arguments:
+//      pass - seed and pass number
+//      location - map array location
+//
+//Postconditions:
+//      None
+//
+//Returns:
+//      64 random bits
+//
+unsigned long long terrainCreator::cellRandom(unsigned long long pass, unsigned long long location)
+{
+    unsigned long long z = pass*0x9E3779B97F4A7C15ULL + location + 0x632BE59BD9B4E019ULL;
+    z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+//Function:
+//     setSeed
+//
+//Description:
+//      Sets the seed every random decision of the generator derives from
+//
+//Preconditions:
+//      None
+//
+//Arguments:
+//      seed - generator seed, defaults to the current time
+//
+//Postconditions:
+//      Later features and smoothing passes follow from seed
+//
+//Returns:
+//      None
+//
+void terrainCreator::setSeed(unsigned int seed)
+{
+    m_seed = seed;
+    m_featureCount = 0;
+    m_smoothPass = 0;
+}
+
+//Function:
+//     runStages
+//
+//Description:
+//      Runs a chain of stages. Each stage is keyed by a hash of the key of the
+//      stage before it and its own settings, the first key covers the seed and
+//      map size. With a cache directory, the output of every stage is stored
+//      under its key and a rerun starts from the last stage whose key is already
+//      cached, so changing a late stage only reruns the stages from there on.
+//
+//Preconditions:
+//      setSeed was called if a fixed seed is wanted
+//
+//Arguments:
+//      stages - the chain, in order
+//      cacheDir - stage cache directory, NULL to run without caching
+//
+//Postconditions:
+//      Map holds the output of the last stage, missing stages are cached
+//
+//Returns:
+//      Number of stages taken from the cache
+//
+unsigned int terrainCreator::runStages(const std::vector<terrainStage>& stages, const char* cacheDir)
+{
+    std::vector<std::string> fileName(stages.size());
+    unsigned long long key = cellRandom(stageCacheVersion, ((unsigned long long)m_seed << 32) ^ m_map_x);
+    key = cellRandom(key, m_map_y);
+    unsigned int reused = 0;
+
+    for(unsigned int i = 0; i < stages.size(); i++)
+    {
+        char name[32];
+        key = stageKey(key, stages[i]);
+        snprintf(name, sizeof(name), "/%016llx.stage", key);
+        if(cacheDir) fileName[i] = std::string(cacheDir) + name;
+    }
+
+    if(cacheDir)
+    {
+        mkdir(cacheDir, 0755);
+        //Longest cached prefix, a stage that fails to load is run again
+        for(unsigned int i = stages.size(); i > 0; i--)
         {
-            if(m_map[i+m_map_x+1] == featureChar)
+            if(loadStage(fileName[i-1]))
             {
-                weight++;
+                reused = i;
+                break;
             }
         }
+    }
 
-        if(((rand() % 5) + 1) < weight)
-        {
-            m_map[i] = featureChar;
-        }
-
-
+    for(unsigned int i = reused; i < stages.size(); i++)
+    {
+        runStage(stages[i]);
+        if(cacheDir) saveStage(fileName[i]);
     }
+    return reused;
 }
 
 //Function:
-//     terrainAgent
+//     runStage
 //
 //Description:
-//      Recursive algorithm to make "somewhat" random and hopefully realistic landmasses
+//      Runs a single stage on the map
 //
 //Preconditions:
-//      Constructor was called, map array was created and exists.
-//      Filling the map array with mapFill is required.
-//      Calling createFeature before calling this function is required.
-//      Argument location must not be an edge (newline) or end (NULL) of the map array
-//      Argument location should be occupied by a character equivalent to m_subChar
+//      Map was filled unless stage is a stageFill
 //
 //Arguments:
-//      unsigned int location - starting location on map array
+//      stage - stage to run
 //
 //Postconditions:
-//      m_featureChar character will be added to the map over top of m_subChar in select locations
+//      Map holds the output of the stage
 //
 //Returns:
 //      None
 //
+void terrainCreator::runStage(const terrainStage& stage)
+{
+    traceSpan span(stage.name);
+    perfSection counters(stage.name, (long long)m_map_x*m_map_y);
+    switch(stage.type)
+    {
+    case stageFill:
+        fillMap(stage.featureChar);
+        break;
+    case stageFeature:
+        createFeature(stage.agentNum, stage.featureChar, stage.subChar, stage.agentMaxLife);
+        break;
+    case stageSmooth:
+        smoothFeature(stage.featureChar, stage.subChar);
+        break;
+    }
+}
+
+//Function:
+//     stageKey
+//
+//Description:
+//      Hashes the settings of a stage into the key of the stage before it.
+//      The stage name is left out, it only labels the stage.
+//
+//Preconditions:
+//      None
+//
+//Arguments:
+//      upstream - key of the stage before
+//      stage - stage to key
+//
+//Postconditions:
+//      None
+//
+//Returns:
+//      Key of the stage's output
+//
+unsigned long long terrainCreator::stageKey(unsigned long long upstream, const terrainStage& stage)
+{
+    unsigned long long key = cellRandom(upstream, stage.type);
+    key = cellRandom(key, ((unsigned long long)(unsigned char)stage.featureChar << 8) | (unsigned char)stage.subChar);
+    key = cellRandom(key, stage.agentNum);
+    return cellRandom(key, stage.agentMaxLife);
+}
+
+//Function:
+//     saveStage
+//
+//Description:
+//      Writes the map and the random sequence counters to a stage cache file.
+//      The file is written under a temporary name and renamed, so other
+//      mapcreate runs sharing the cache never see half a file.
+//
+//Preconditions:
+//      Map exists
+//
+//Arguments:
+//      fileName - cache file
+//
+//Postconditions:
+//      Cache file holds the current stage output
+//
+//Returns:
+//      False if the file could not be written
+//
+bool terrainCreator::saveStage(const std::string& fileName)
+{
+    std::string tempName = fileName + ".tmp";
+    std::ofstream out(tempName.c_str(), std::ios::binary);
+    unsigned int header[5] = {stageCacheVersion, m_map_x, m_map_y, m_featureCount, m_smoothPass};
+
+    out.write((const char*)header, sizeof(header));
+    out.write(m_map, (long long)(m_map_x + 1)*m_map_y);
+    out.close();
+
+    if(!out || rename(tempName.c_str(), fileName.c_str()) != 0)
+    {
+        remove(tempName.c_str());
+        return false;
+    }
+    return true;
+}
 
-void terrainCreator::terrainAgent(unsigned int location, unsigned int life)
+//Function:
+//     loadStage
+//
+//Description:
+//      Restores the map and the random sequence counters from a stage cache
+//      file, so the stages after it draw the same random numbers as a full run
+//
+//Preconditions:
+//      Map exists
+//
+//Arguments:
+//      fileName - cache file
+//
+//Postconditions:
+//      Map holds the cached stage output
+//
+//Returns:
+//      False if there is no usable cache file
+//
+bool terrainCreator::loadStage(const std::string& fileName)
 {
+    std::ifstream in(fileName.c_str(), std::ios::binary);
+    unsigned int header[5];
+    long long mapSize = (long long)(m_map_x + 1)*m_map_y;
 
-    //cout << endl << "life = " << life;
+    in.read((char*)header, sizeof(header));
+    if(!in || header[0] != stageCacheVersion || header[1] != m_map_x || header[2] != m_map_y) return false;
 
-    if(life <= 0)return;
+    in.read(m_map, mapSize);
+    if(!in) return false;
 
-    //cerr << endl << "location = " << location;
+    m_map[mapSize] = '\0';
+    m_featureCount = header[3];
+    m_smoothPass = header[4];
+    return true;
+}
 
-    m_map[location] = m_featureChar;
+//Function:
+//     nextRandom
+//
+//Description:
+//      Next number of the feature's random sequence, same values as rand()
+//      after srand() with the same seed
+//
+//Preconditions:
+//      createFeature seeded the sequence
+//
+//Arguments:
+//      None
+//
+//Postconditions:
+//      Sequence moves on by one
+//
+//Returns:
+//      Random number from 0 to RAND_MAX
+//
+int terrainCreator::nextRandom()
+{
+    int32_t value;
+    random_r(&m_random, &value);
+    return value;
+}
 
+//Function:
+//     setThreads
+//
+//Description:
+//      Sets how many threads smoothFeature uses, the result does not depend on it
+//
+//Preconditions:
+//      None
+//
+//Arguments:
+//      threads - number of threads, defaults to the number of cores
+//
+//Postconditions:
+//      None
+//
+//Returns:
+//      None
+//
+void terrainCreator::setThreads(unsigned int threads)
+{
+    m_threads = threads > 0 ? threads : 1;
+}
 
-    unsigned int compass[4] =
-    {
-        (location + 1),
-        (location - m_map_x - 1),
-        (location - 1),
-        (location + m_map_x + 1)
-    };
+//Function:
+//     terrainAgents
+//
+//Description:
+//      Random walks to make "somewhat" random and hopefully realistic landmasses.
+//      Each step turns the current location into featureChar and moves to a random
+//      neighbour still holding subChar; a walk ends when its life runs out or it is
+//      boxed in. Up to agentBatch agents walk at once, one step of every agent per
+//      pass. All of them read and write the same map, so interleaving them gives
+//      other landmasses than running the walks one after another would. Each agent
+//      draws its directions from its own xorshift generator, seeded from
+//      nextRandom(), so no library call sits in the loop.
+//
+//Preconditions:
+//      Constructor was called, map array was created and exists.
+//      Filling the map array with mapFill is required.
+//      Calling createFeature before calling this function is required.
+//      No starting location may be an edge (newline) or end (NULL) of the map array
+//      Every starting location should hold a character equivalent to m_subChar
+//
+//Arguments:
+//      long long* location - starting location of each agent
+//      unsigned int* life - number of steps of each agent
+//      unsigned int count - number of agents, at most agentBatch
+//
+//Postconditions:
+//      location and life are used as scratch space and left undefined
+//
+//Returns:
+//      None
+//
+void terrainCreator::terrainAgents(long long* location, unsigned int* life, unsigned int count)
+{
+    unsigned int seed[agentBatch];
+    long long directions[4];
+    unsigned int found;
+    unsigned int active = count;
 
-    deque<unsigned int> directions;
+    for(unsigned int a = 0; a < count; a++)
+    {
+        seed[a] = ((unsigned int)nextRandom() << 1) | 1;    //xorshift needs a non-zero state
+    }
 
-    for(int i = 0; i < 4; i++)
+    while(active > 0)
     {
-        if( isValidMapLocation(compass[i]) )
+        active = 0;
+        for(unsigned int a = 0; a < count; a++)
         {
-            if( isValidSubcharLocation(compass[i]) )
+            if(life[a] == 0) continue;
+
+            m_map[location[a]] = m_featureChar;
+
+            found = findDirections(location[a], directions);
+
+            if(found == 0)
             {
-                directions.push_front(compass[i]);
+                life[a] = 0;
+                continue;
             }
+
+            seed[a] ^= seed[a] << 13;
+            seed[a] ^= seed[a] >> 17;
+            seed[a] ^= seed[a] << 5;
+
+            location[a] = directions[seed[a] % found];
+            life[a]--;
+            active++;
         }
     }
+}
 
-    if(directions.empty())
+//Function:
+//     findDirections
+//
+//Description:
+//      Collects the neighbours of location an agent may move to into a fixed
+//      four slot buffer, in south, west, north, east order.
+//
+//Preconditions:
+//      createFeature set m_subChar
+//
+//Arguments:
+//      long long location - current agent location
+//      long long* directions - buffer of four locations
+//
+//Postconditions:
+//      The first (returned value) slots of directions are filled
+//
+//Returns:
+//      Number of neighbours holding m_subChar
+//
+unsigned int terrainCreator::findDirections(long long location, long long* directions)
+{
+    //Last array slot is a newline, never a subChar, so it is left out like in isValidMapLocation
+    long long last = (long long)(m_map_x + 1)*m_map_y - 1;
+    long long compass[4] =
     {
-        return;
-    }
-
-    //srand(time(NULL));//Initialize random seed
-
-    int num = (rand() % directions.size());
+        location + m_map_x + 1,
+        location - 1,
+        location - m_map_x - 1,
+        location + 1
+    };
+    unsigned int count = 0;
 
-    terrainAgent(directions[num], (--life));
+    for(int i = 0; i < 4; i++)
+    {
+        directions[count] = compass[i];
+        count += (compass[i] >= 0 && compass[i] < last && m_map[compass[i]] == m_subChar);
+    }
+    return count;
 }
 
-
-
 //Function:
 //     isValidMapLocation
 //
@@ -304,10 +758,10 @@ void terrainCreator::terrainAgent(unsigned int location, unsigned int life)
 //Returns:
 //      Boolean indicating whether the parameter location is a valid map array location
 //
-bool terrainCreator::isValidMapLocation(int location)
+bool terrainCreator::isValidMapLocation(long long location)
 {
     if(location < 0) return false;
-    if(location >= ((m_map_x + 1)*(m_map_y)) - 1) return false;
+    if(location >= ((long long)(m_map_x + 1)*(m_map_y)) - 1) return false;
     if(m_map[location] == '\n')return false;
 
     //cout << "char at location = " << m_map[location];
@@ -334,59 +788,128 @@ bool terrainCreator::isValidMapLocation(int location)
 //Returns:
 //
 //
-bool terrainCreator::isValidSubcharLocation(int location)
+bool terrainCreator::isValidSubcharLocation(long long location)
 {
     if(m_map[location] == m_subChar) return true;
     else return false;
 }
 
 //Function:
-//      findClosestSubChar
+//      buildSpawnIndex
 //
 //Description:
-//      Finds (more or less) the closest map location with a subChar in it.
+//      Builds a bitmap of every map location holding m_subChar (one padded run of
+//      64 bit words per row) and a Fenwick tree over the popcount of each word,
+//      so a uniformly random subChar location can be picked in O(log n).
 //
 //Preconditions:
-//      Map must be created
+//      createFeature set m_subChar
 //
 //Arguments:
-//      location - origin point which the function will find the closest point
+//      None
 //
 //Postconditions:
-//      None
+//      m_spawnBits, m_spawnTree and m_spawnCount describe the current map
 //
 //Returns:
-//      The closest point on the map with the subChar in it
+//      None
 //
-
-int terrainCreator::findClosestSubChar(int location)
+void terrainCreator::buildSpawnIndex()
 {
+    m_rowWords = (m_map_x + 63) / 64;
+    long long words = m_rowWords * m_map_y;
 
-    for(int i = 0; i < (m_map_x + 1)*(m_map_y);i++ )
+    m_spawnBits.assign(words, 0);
+    m_spawnTree.assign(words + 1, 0);
+    m_spawnCount = 0;
+
+    for(unsigned int y = 0; y < m_map_y; y++)
     {
+        const char* row = m_map + (long long)y*(m_map_x + 1);
+        unsigned long long* bits = &m_spawnBits[0] + (long long)y*m_rowWords;
+        for(unsigned int x = 0; x < m_map_x; x++)
+        {
+            bits[x / 64] |= (unsigned long long)(row[x] == m_subChar) << (x % 64);
+        }
+    }
 
-        if( isValidMapLocation( location + 1 ) )
+    //Fenwick tree built in place from the word popcounts
+    for(long long i = 1; i <= words; i++)
+    {
+        m_spawnTree[i] += __builtin_popcountll(m_spawnBits[i-1]);
+        m_spawnCount += __builtin_popcountll(m_spawnBits[i-1]);
+        long long parent = i + (i & -i);
+        if(parent <= words) m_spawnTree[parent] += m_spawnTree[i];
+    }
+}
+
+//Function:
+//      sampleSpawn
+//
+//Description:
+//      Picks a uniformly random location holding m_subChar. Locations agents have
+//      covered since buildSpawnIndex are dropped from the index when drawn and the
+//      draw is repeated, so each stale entry costs one extra draw at most once.
+//
+//Preconditions:
+//      buildSpawnIndex was called for the current m_subChar
+//
+//Arguments:
+//      None
+//
+//Postconditions:
+//      Stale index entries may be removed
+//
+//Returns:
+//      A map array location, or -1 if no location holds m_subChar
+//
+long long terrainCreator::sampleSpawn()
+{
+    long long words = m_spawnBits.size();
+    long long top = 1;
+    while(top * 2 <= words) top *= 2;
+
+    while(m_spawnCount > 0)
+    {
+        //Two draws in a fixed order, the operands of | may be evaluated in either
+        unsigned long long high = nextRandom();
+        unsigned long long low = nextRandom();
+        unsigned long long rank = ((high << 31) | low) % m_spawnCount;
+
+        //Descend the Fenwick tree to the word holding the rank-th set bit
+        long long word = 0;
+        for(long long step = top; step > 0; step /= 2)
         {
-            if(isValidSubcharLocation( location + 1 ))
+            if(word + step <= words && m_spawnTree[word + step] <= rank)
             {
-                return ( location + i );
+                word += step;
+                rank -= m_spawnTree[word];
             }
         }
 
+        //Select the rank-th set bit of that word
+        unsigned long long bits = m_spawnBits[word];
+        for(; rank > 0; rank--) bits &= bits - 1;
+        unsigned int bit = __builtin_ctzll(bits);
+
+        long long y = word / m_rowWords;
+        long long x = (word % m_rowWords) * 64 + bit;
+        long long location = (long long)y*(m_map_x + 1) + x;
 
-        if( isValidMapLocation( location - i ) )
+        if(m_map[location] == m_subChar) return location;
+
+        //Covered by an agent, remove it and draw again
+        m_spawnBits[word] &= ~(1ULL << bit);
+        m_spawnCount--;
+        for(long long i = word + 1; i <= words; i += i & -i)
         {
-            if(isValidSubcharLocation( location - i ))
-            {
-                return ( location - i );
-            }
+            m_spawnTree[i]--;
         }
     }
 
-    return -1; //Failure
+    return -1;
 }
 
-
 //Function:
 //
 //
@@ -408,7 +931,7 @@ int terrainCreator::findClosestSubChar(int location)
 
 void terrainCreator::sanityCheck()
 {
-    for(int i = m_map_x; i < (m_map_y)*(m_map_x + 1); i+=(m_map_x + 1))
+    for(long long i = m_map_x; i < (long long)(m_map_y)*(m_map_x + 1); i+=(m_map_x + 1))
     {
         m_map[i] = '\n';
     }
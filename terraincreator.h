@@ -1,7 +1,36 @@
+#ifndef TERRAINCREATOR_H
+#define TERRAINCREATOR_H
+
 #include <stdlib.h>
-#include <deque>
+#include <string.h>
+#include <vector>
+#include <thread>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <time.h>
+#include <string>
+
+#define agentBatch 8    //Number of agents createFeature walks together
+#define smoothTileRows 64   //Rows in one smoothFeature work unit
+#define stageCacheVersion 1 //Bump when a change to the generator makes cached stages stale
+
+//Kinds of generation stages
+#define stageFill 0
+#define stageFeature 1
+#define stageSmooth 2
+
+//terrainStage - one named step of the generation chain
+struct terrainStage
+{
+    const char* name;
+    int type;                   //stageFill, stageFeature or stageSmooth
+    char featureChar;           //Character placed, the fill character of stageFill
+    char subChar;               //Character featureChar grows on
+    unsigned int agentNum;      //Agents of stageFeature
+    unsigned int agentMaxLife;
+};
 
 class terrainCreator
 {
@@ -13,10 +42,23 @@ public:
 
     void createFeature(unsigned int agentNum, char featureChar, char subChar, unsigned int agentMaxLife);
     void smoothFeature(char featureChar, char subChar);
-    void terrainAgent(unsigned int location, unsigned int life);
-    bool isValidMapLocation(int location);
-    bool isValidSubcharLocation(int location);
-    int findClosestSubChar(int location);
+    void smoothTiles(const char* source, unsigned int first, unsigned int step, char featureChar, unsigned long long pass);
+    static void smoothRow(const char* row, long long rowLength, char* out, unsigned char* weight, char featureChar, char subChar, unsigned long long pass, long long location);
+    static unsigned long long cellRandom(unsigned long long pass, unsigned long long location);
+    void setSeed(unsigned int seed);
+    int nextRandom();
+    unsigned int runStages(const std::vector<terrainStage>& stages, const char* cacheDir);
+    void runStage(const terrainStage& stage);
+    unsigned long long stageKey(unsigned long long upstream, const terrainStage& stage);
+    bool saveStage(const std::string& fileName);
+    bool loadStage(const std::string& fileName);
+    void setThreads(unsigned int threads);
+    void terrainAgents(long long* location, unsigned int* life, unsigned int count);
+    unsigned int findDirections(long long location, long long* directions);
+    bool isValidMapLocation(long long location);
+    bool isValidSubcharLocation(long long location);
+    void buildSpawnIndex();
+    long long sampleSpawn();
 
     void sanityCheck();
 
@@ -34,7 +76,20 @@ private:
     char m_subChar;             //Hold current character with which to replace with featureChar
     //double m_burnoutCoef;       //Hold current burnout coeffecient for any Agents created
     unsigned int m_agentMaxLife;
+
+    unsigned int m_seed;            //Seed of every random decision
+    unsigned int m_featureCount;    //Features created so far, picks each feature's rand() sequence
+    unsigned int m_smoothPass;      //Smoothing passes so far, picks each pass' cellRandom values
+    unsigned int m_threads;         //Threads used by smoothFeature
+    struct random_data m_random;    //rand() sequence of the current feature, kept per object so
+    char m_randomState[128];        //several maps can be made at once on different threads
+
+    std::vector<unsigned long long> m_spawnBits;   //Bitmap of subChar locations, m_rowWords words per row
+    std::vector<unsigned long long> m_spawnTree;        //Fenwick tree over the popcount of each bitmap word
+    long long m_rowWords;
+    unsigned long long m_spawnCount;               //Set bits left in m_spawnBits
     enum algType{snake, dense} m_pattern;
 
 };
 
+#endif
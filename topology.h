@@ -0,0 +1,86 @@
+////////////////////////////////////////////////////////
+// File name: topology.h
+// Description: Grid topologies of the simulation as compile time
+// policies. A neighbourhood is a constexpr table of the offsets of a
+// cell's neighbours, an edge policy says what lies past the edge of the
+// map. simulate runs its turns through templates on one of each, picked
+// once per run from the config (neighbours, wrap_edges), so every
+// topology gets its own findAdjacent with the table unrolled and no
+// edge cases: bounded maps have a border of closed cells round them and
+// wrapped maps fold coordinates back in with arithmetic, not branches.
+//
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#define maxNeighbours 8	//Most neighbours of any topology
+
+//Values of the neighbours config key
+#define vonNeumannGrid 4
+#define hexGrid 6
+#define mooreGrid 8
+
+//Offset of a neighbour in rows (x) and columns (y)
+struct gridOffset
+{
+int dx;
+int dy;
+};
+
+//Up, right, left and down, the order findAdjacent always used. Its
+//bottom row (corners aside) listed right, left, up instead; that order
+//is kept too, so old configs and seeds still play the same games.
+struct vonNeumann
+{
+static constexpr int count = 4;
+static constexpr gridOffset inner[count] = {{-1,0}, {0,1}, {0,-1}, {1,0}};
+static constexpr gridOffset bottom[count] = {{0,1}, {0,-1}, {-1,0}, {1,0}};
+static const gridOffset* table(int x, int y, int rows, int columns)
+{
+	return x == rows - 1 && y > 0 && y < columns - 1 ? bottom : inner;
+}
+};
+
+//The four sides first, then the corners
+struct moore
+{
+static constexpr int count = 8;
+static constexpr gridOffset inner[count] = {{-1,0}, {0,1}, {0,-1}, {1,0}, {-1,-1}, {-1,1}, {1,-1}, {1,1}};
+static const gridOffset* table(int, int, int, int) { return inner; }
+};
+
+//Hexagons laid out in rows, every odd row shifted half a cell right.
+//Wrapped rows only line up if the map has an even number of rows.
+struct hexagonal
+{
+static constexpr int count = 6;
+static constexpr gridOffset even[count] = {{-1,-1}, {-1,0}, {0,1}, {0,-1}, {1,-1}, {1,0}};
+static constexpr gridOffset odd[count] = {{-1,0}, {-1,1}, {0,1}, {0,-1}, {1,0}, {1,1}};
+static const gridOffset* table(int x, int, int, int) { return x & 1 ? odd : even; }
+};
+
+//Nothing past the edge, the closed border round the map turns those cells down
+struct boundedEdges
+{
+static void fold(int&, int&, int, int) {}
+};
+
+//Leaving the map at one edge comes back in at the opposite one
+struct wrappedEdges
+{
+static void fold(int& x, int& y, int rows, int columns)
+{
+	x += rows & -(x < 0);
+	x -= rows & -(x >= rows);
+	y += columns & -(y < 0);
+	y -= columns & -(y >= columns);
+}
+};
+
+template <class Neighbours, class Edges>
+struct gridTopology
+{
+typedef Neighbours neighbours;
+typedef Edges edges;
+};
+
+#endif
@@ -0,0 +1,128 @@
+////////////////////////////////////////////////////////
+// File name: trace.cpp
+// Description: Implementation of the trace-event recorder
+//
+#include "trace.h"
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+bool traceEnabled = false;
+
+// One finished span, times in nanoseconds since traceStart
+struct traceEvent
+{
+	const char* name;
+	const char* argName;
+	long long arg;
+	long long begin;
+	long long duration;
+};
+
+// Events of one thread. Only the owning thread adds to it, traceStop
+// reads it once the thread is done, so it needs no lock.
+struct traceBuffer
+{
+	int id;
+	string name;
+	vector < unique_ptr <traceEvent[]> > blocks;
+	size_t used;	//Events in the last block
+};
+
+static mutex registryGuard;	//Only taken the first time a thread records
+static vector < unique_ptr <traceBuffer> > buffers;
+static thread_local traceBuffer* threadBuffer = NULL;
+static string traceFile;
+static chrono::steady_clock::time_point traceZero;
+
+// Buffer of the calling thread, made on its first event
+static traceBuffer* ownBuffer()
+{
+	if(threadBuffer == NULL)
+	{
+		lock_guard <mutex> lock(registryGuard);
+		buffers.push_back(unique_ptr <traceBuffer>(new traceBuffer));
+		threadBuffer = buffers.back().get();
+		threadBuffer->id = buffers.size();
+		threadBuffer->used = traceBlockEvents;
+	}
+	return threadBuffer;
+}
+
+void traceStart(const char* fileName)
+{
+	traceFile = fileName;
+	traceZero = chrono::steady_clock::now();
+	traceEnabled = true;
+}
+
+void traceThreadName(const char* name)
+{
+	if(traceEnabled) ownBuffer()->name = name;
+}
+
+void traceRecord(const char* name, const char* argName, long long arg,
+	chrono::steady_clock::time_point start)
+{
+	chrono::steady_clock::time_point end = chrono::steady_clock::now();
+	if(!traceEnabled) return;
+
+	traceBuffer* buffer = ownBuffer();
+	if(buffer->used == traceBlockEvents)
+	{
+		buffer->blocks.push_back(unique_ptr <traceEvent[]>(new traceEvent[traceBlockEvents]));
+		buffer->used = 0;
+	}
+	traceEvent& event = buffer->blocks.back()[buffer->used++];
+	event.name = name;
+	event.argName = argName;
+	event.arg = arg;
+	event.begin = chrono::duration_cast<chrono::nanoseconds>(start - traceZero).count();
+	event.duration = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+}
+
+bool traceStop()
+{
+	if(!traceEnabled) return true;
+	traceEnabled = false;
+
+	ofstream out(traceFile.c_str());
+	if(!out.is_open()) return false;
+
+	// Times are given in microseconds with nanosecond decimals
+	out<<fixed<<setprecision(3)<<"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	lock_guard <mutex> lock(registryGuard);
+	for(unsigned int b = 0; b < buffers.size(); b++)
+	{
+		traceBuffer& buffer = *buffers[b];
+		if(!buffer.name.empty())
+		{
+			out<<(first ? "" : ",")<<"\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"<<buffer.id
+			   <<",\"args\":{\"name\":\""<<buffer.name<<"\"}}";
+			first = false;
+		}
+		for(unsigned int k = 0; k < buffer.blocks.size(); k++)
+		{
+			size_t count = k + 1 == buffer.blocks.size() ? buffer.used : traceBlockEvents;
+			for(size_t e = 0; e < count; e++)
+			{
+				traceEvent& event = buffer.blocks[k][e];
+				out<<(first ? "" : ",")<<"\n{\"name\":\""<<event.name<<"\",\"ph\":\"X\",\"pid\":1,\"tid\":"<<buffer.id
+				   <<",\"ts\":"<<event.begin/1000.0<<",\"dur\":"<<event.duration/1000.0;
+				if(event.argName) out<<",\"args\":{\""<<event.argName<<"\":"<<event.arg<<"}";
+				out<<"}";
+				first = false;
+			}
+		}
+		buffer.blocks.clear();
+		buffer.used = traceBlockEvents;
+	}
+	out<<"\n]}\n";
+	out.close();
+	return !out.fail();
+}
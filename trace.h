@@ -0,0 +1,60 @@
+////////////////////////////////////////////////////////
+// File name: trace.h
+// Description: Timeline tracing in the Chrome trace-event format, which
+// chrome://tracing and ui.perfetto.dev open. A traceSpan marks a block
+// of code; spans that are open at the same time on one thread show up
+// nested. Every thread records into a buffer of its own, so recording
+// takes no lock, and the buffers are written out by traceStop. Tracing
+// is off until traceStart, a span then costs a single branch.
+//
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+
+#define traceBlockEvents 1024	//Events per buffer block of a thread
+#define traceNoArg -1
+
+//True between traceStart and traceStop
+extern bool traceEnabled;
+
+//Starts recording, the events go to fileName when traceStop is called
+void traceStart(const char* fileName);
+//Writes every recorded event and stops recording, false on write errors.
+//All threads that recorded events must be done.
+bool traceStop();
+//Names the calling thread in the timeline
+void traceThreadName(const char* name);
+//Records one finished span. name must outlive traceStop (a literal).
+void traceRecord(const char* name, const char* argName, long long arg,
+	std::chrono::steady_clock::time_point start);
+
+//traceSpan - records the time from its construction to its destruction
+class traceSpan
+{
+public:
+traceSpan(const char* spanName, const char* spanArgName = 0, long long spanArg = traceNoArg)
+{
+	if(traceEnabled)
+	{
+		name = spanName;
+		argName = spanArgName;
+		arg = spanArg;
+		start = std::chrono::steady_clock::now();
+	}
+	else name = 0;
+}
+
+~traceSpan()
+{
+	if(name) traceRecord(name, argName, arg, start);
+}
+
+private:
+const char* name;
+const char* argName;
+long long arg;
+std::chrono::steady_clock::time_point start;
+};
+
+#endif
@@ -0,0 +1,126 @@
+////////////////////////////////////////////////////////
+// File name: workpool.h
+// Description: Header only work-stealing thread pool. The tasks of a
+// run are numbered 0..n-1 and dealt out to the workers in contiguous
+// blocks, so neighbouring tasks (which often share inputs) tend to
+// run on the same thread. A worker takes its own tasks from the
+// front of its deque; once it runs dry it steals from the back of
+// the fullest other deque, so uneven tasks still keep every thread
+// busy until the end.
+//
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <functional>
+
+class workPool
+{
+public:
+workPool(unsigned int threads)
+{
+	workers = threads > 0 ? threads : 1;
+	stolen = 0;
+}
+
+//Runs work(task, worker) for every task from 0 to tasks-1 and
+//returns once all of them are done
+void run(size_t tasks, std::function<void(size_t, unsigned int)> work)
+{
+	queues = std::vector<taskQueue>(workers);
+	stolen = 0;
+	for(unsigned int w = 0; w < workers; w++)
+	{
+		size_t first = tasks*w/workers;
+		size_t last = tasks*(w+1)/workers;
+		for(size_t t = first; t < last; t++)
+		{
+			queues[w].tasks.push_back(t);
+		}
+	}
+
+	std::vector<std::thread> threads;
+	for(unsigned int w = 1; w < workers; w++)
+	{
+		threads.push_back(std::thread(&workPool::loop, this, w, work));
+	}
+	loop(0, work);
+	for(unsigned int t = 0; t < threads.size(); t++)
+	{
+		threads[t].join();
+	}
+}
+
+unsigned int size() { return workers; }
+//Tasks that ran on another worker than the one they were dealt to
+size_t steals() { return stolen; }
+
+private:
+struct taskQueue
+{
+	std::deque<size_t> tasks;
+	std::mutex guard;
+};
+
+unsigned int workers;
+std::vector<taskQueue> queues;
+std::mutex stealGuard;
+size_t stolen;
+
+void loop(unsigned int worker, std::function<void(size_t, unsigned int)> work)
+{
+	size_t task;
+	while(next(worker, task))
+	{
+		work(task, worker);
+	}
+}
+
+//Own tasks first, then the back of the fullest other queue
+bool next(unsigned int worker, size_t& task)
+{
+	{
+		std::lock_guard<std::mutex> lock(queues[worker].guard);
+		if(!queues[worker].tasks.empty())
+		{
+			task = queues[worker].tasks.front();
+			queues[worker].tasks.pop_front();
+			return true;
+		}
+	}
+
+	while(true)
+	{
+		unsigned int victim = worker;
+		size_t most = 0;
+		for(unsigned int w = 0; w < workers; w++)
+		{
+			std::lock_guard<std::mutex> lock(queues[w].guard);
+			if(w != worker && queues[w].tasks.size() > most)
+			{
+				most = queues[w].tasks.size();
+				victim = w;
+			}
+		}
+		if(victim == worker)
+		{
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(queues[victim].guard);
+		if(!queues[victim].tasks.empty())
+		{
+			task = queues[victim].tasks.back();
+			queues[victim].tasks.pop_back();
+			std::lock_guard<std::mutex> count(stealGuard);
+			stolen++;
+			return true;
+		}
+	}
+}
+};
+
+#endif